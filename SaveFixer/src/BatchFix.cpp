@@ -0,0 +1,188 @@
+#include "BatchFix.h"
+
+#include "ThreadPool.h"
+
+#include <map>
+#include <set>
+
+using namespace save_fixer;
+
+namespace
+{
+    constexpr std::array< std::pair< PositionPolicy, std::u8string_view >, 5 > position_policy_names = { {
+        { PositionPolicy::keep, u8"keep" },
+        { PositionPolicy::swap_reserve_and_car1, u8"swap-reserve-car1" },
+        { PositionPolicy::swap_reserve_and_car2, u8"swap-reserve-car2" },
+        { PositionPolicy::swap_car1_and_car2, u8"swap-car1-car2" },
+        { PositionPolicy::assign_in_file_order, u8"file-order" },
+    } };
+
+    void swap_positions( std::array< SaveFile::DriverRef, 3 > const &drivers, SaveFile::DriverPosition const a,
+                         SaveFile::DriverPosition const b )
+    {
+        for ( SaveFile::DriverRef const &driver : drivers )
+        {
+            if ( driver.position == a )
+            {
+                driver.position = b;
+            }
+            else if ( driver.position == b )
+            {
+                driver.position = a;
+            }
+        }
+    }
+
+    void apply_position_policy( SaveFile &save_file, PositionPolicy const policy )
+    {
+        // get_drivers() returns the drivers in the order they are in the file
+        std::array< SaveFile::DriverRef, 3 > const drivers = save_file.get_drivers();
+        switch ( policy )
+        {
+            case PositionPolicy::keep:
+                break;
+            case PositionPolicy::swap_reserve_and_car1:
+                swap_positions( drivers, SaveFile::DriverPosition::reserve, SaveFile::DriverPosition::car1 );
+                break;
+            case PositionPolicy::swap_reserve_and_car2:
+                swap_positions( drivers, SaveFile::DriverPosition::reserve, SaveFile::DriverPosition::car2 );
+                break;
+            case PositionPolicy::swap_car1_and_car2:
+                swap_positions( drivers, SaveFile::DriverPosition::car1, SaveFile::DriverPosition::car2 );
+                break;
+            case PositionPolicy::assign_in_file_order:
+                drivers[ 0 ].position = SaveFile::DriverPosition::car1;
+                drivers[ 1 ].position = SaveFile::DriverPosition::car2;
+                drivers[ 2 ].position = SaveFile::DriverPosition::reserve;
+                break;
+        }
+    }
+
+    void fix_positions( SaveFile &save_file, BatchFixJob const &job, BatchFixResult &result )
+    {
+        apply_position_policy( save_file, job.policy );
+
+        std::array< SaveFile::DriverRef, 3 > const drivers = save_file.get_drivers();
+        result.positions = { drivers[ 0 ].position, drivers[ 1 ].position, drivers[ 2 ].position };
+        if ( !save_file.driver_positions_are_unique() )
+        {
+            throw SaveFixerException( u8"driver positions overlap after applying "s +
+                                      std::u8string( get_position_policy_name( job.policy ) ) );
+        }
+    }
+
+    // Fixes and writes a copy of the save, so other jobs can fix the same save at the same time
+    BatchFixResult fix_save( SaveFile const &save_file, BatchFixJob const &job, bool const allow_overwrite,
+                             ThreadPool &pool, CompressionPolicy const &compression )
+    {
+        BatchFixResult result;
+        try
+        {
+            SaveFile variant = save_file;
+            fix_positions( variant, job, result );
+            variant.write( job.output_path, extract_save_name_from_save_path( job.output_path ), allow_overwrite,
+                           &pool, compression );
+        }
+        catch ( SaveFixerException const &ex )
+        {
+            result.error = ex.description;
+        }
+        catch ( std::bad_alloc const & )
+        {
+            result.error = u8"out of memory"s;
+        }
+        return result;
+    }
+
+    // The jobs for one save, which is opened once and shared by all of them
+    void fix_saves( std::span< BatchFixJob const > const jobs, std::vector< size_t > const &job_indexes,
+                    std::vector< BatchFixResult > &results, bool const allow_overwrite, ThreadPool &pool,
+                    CompressionPolicy const &compression )
+    {
+        std::optional< SaveFile > save_file;
+        std::optional< std::u8string > error;
+        try
+        {
+            save_file.emplace( jobs[ job_indexes.front() ].input_path );
+        }
+        catch ( SaveFixerException const &ex )
+        {
+            error = ex.description;
+        }
+        catch ( std::bad_alloc const & )
+        {
+            error = u8"out of memory"s;
+        }
+        if ( error.has_value() )
+        {
+            for ( size_t const job_index : job_indexes )
+            {
+                results[ job_index ].error = error;
+            }
+            return;
+        }
+
+        pool.parallel_for( job_indexes.size(), [ & ]( size_t const i ) {
+            results[ job_indexes[ i ] ] =
+                fix_save( save_file.value(), jobs[ job_indexes[ i ] ], allow_overwrite, pool, compression );
+        } );
+    }
+}
+
+std::optional< PositionPolicy > save_fixer::parse_position_policy( std::u8string_view const name )
+{
+    for ( auto const &[ policy, policy_name ] : position_policy_names )
+    {
+        if ( name == policy_name )
+        {
+            return policy;
+        }
+    }
+    return std::nullopt;
+}
+
+std::u8string_view save_fixer::get_position_policy_name( PositionPolicy const policy )
+{
+    for ( auto const &[ p, policy_name ] : position_policy_names )
+    {
+        if ( p == policy )
+        {
+            return policy_name;
+        }
+    }
+    throw SaveFixerException( u8"internal error: unreachable"s );
+}
+
+std::vector< BatchFixResult > save_fixer::run_batch_fix( std::span< BatchFixJob const > const jobs, ThreadPool &pool,
+                                                         bool const allow_overwrite,
+                                                         CompressionPolicy const &compression )
+{
+    std::vector< BatchFixResult > results( jobs.size() );
+
+    // Two jobs writing the same file would race, so only the first one is run. The jobs that are
+    // run are grouped by the save they read, so each save is only opened once.
+    std::set< std::u8string_view > output_paths;
+    std::map< std::u8string_view, size_t > input_groups;
+    std::vector< std::vector< size_t > > jobs_by_input;
+    for ( size_t i = 0; i < jobs.size(); ++i )
+    {
+        if ( output_paths.insert( jobs[ i ].output_path ).second )
+        {
+            auto const [ group, is_new ] = input_groups.try_emplace( jobs[ i ].input_path, jobs_by_input.size() );
+            if ( is_new )
+            {
+                jobs_by_input.emplace_back();
+            }
+            jobs_by_input[ group->second ].push_back( i );
+        }
+        else
+        {
+            results[ i ].error = u8"output file is also written by an earlier job \""s + jobs[ i ].output_path + u8"\""s;
+        }
+    }
+
+    pool.parallel_for( jobs_by_input.size(), [ & ]( size_t const i ) {
+        fix_saves( jobs, jobs_by_input[ i ], results, allow_overwrite, pool, compression );
+    } );
+    return results;
+}
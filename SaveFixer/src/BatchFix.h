@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Common.h"
+#include "SaveFile.h"
+
+#include <array>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace save_fixer
+{
+    class ThreadPool;
+
+    // How the driver positions of a save are changed by a batch fix
+    enum class PositionPolicy
+    {
+        keep,
+        swap_reserve_and_car1,
+        swap_reserve_and_car2,
+        swap_car1_and_car2,
+        assign_in_file_order,    // car1, car2 then reserve, in the order the drivers are in the file
+    };
+
+    std::optional< PositionPolicy > parse_position_policy( std::u8string_view name );
+    std::u8string_view get_position_policy_name( PositionPolicy policy );
+
+    struct BatchFixJob
+    {
+        std::u8string input_path;
+        std::u8string output_path;
+        PositionPolicy policy;
+    };
+
+    struct BatchFixResult
+    {
+        // Set if the save could not be fixed, in which case no output file was written
+        std::optional< std::u8string > error;
+        std::array< SaveFile::DriverPosition, 3 > positions = {};
+    };
+
+    // Opens, fixes and writes every save on the thread pool. The results are in the same order as
+    // the jobs, and each save is written with the save name taken from its output path. Jobs that
+    // read the same save share one decode of it.
+    std::vector< BatchFixResult > run_batch_fix( std::span< BatchFixJob const > jobs, ThreadPool &pool,
+                                                 bool allow_overwrite = false, CompressionPolicy const &compression = {} );
+}
@@ -0,0 +1,107 @@
+#include "CacheFile.h"
+
+#include "FileSystem.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+using namespace save_fixer;
+
+namespace
+{
+    //-------------------------------------------------------------------------
+    // XXH64
+    //-------------------------------------------------------------------------
+
+    constexpr uint64_t prime1 = 0x9E3779B185EBCA87;
+    constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4F;
+    constexpr uint64_t prime3 = 0x165667B19E3779F9;
+    constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63;
+    constexpr uint64_t prime5 = 0x27D4EB2F165667C5;
+
+    // In native byte order, which is little endian on every platform the fixer is built for
+    template < typename T >
+    T read_word( std::byte const *const p )
+    {
+        T value;
+        std::memcpy( &value, p, sizeof( T ) );
+        return value;
+    }
+
+    uint64_t hash_round( uint64_t acc, uint64_t const input )
+    {
+        acc += input * prime2;
+        acc = std::rotl( acc, 31 );
+        return acc * prime1;
+    }
+
+    uint64_t merge_round( uint64_t acc, uint64_t const value )
+    {
+        acc ^= hash_round( 0, value );
+        return acc * prime1 + prime4;
+    }
+}
+
+void save_fixer::write_cache_file( std::u8string const &file_path, std::span< std::byte const > const bytes )
+{
+    constexpr bool overwrite_temp_file = true;
+    WriteFileMapping file_out( file_path + u8".mmsftmp"s, bytes.size(), overwrite_temp_file );
+    std::copy( bytes.begin(), bytes.end(), file_out.data() );
+
+    constexpr bool allow_overwrite = true;
+    WriteFileMapping::write_truncate_and_rename( std::move( file_out ), file_path, bytes.size(), allow_overwrite );
+}
+
+uint64_t save_fixer::hash_bytes( std::span< std::byte const > const bytes, uint64_t const seed )
+{
+    std::byte const *p = bytes.data();
+    std::byte const *const end = p + bytes.size();
+
+    uint64_t hash;
+    if ( bytes.size() >= 32 )
+    {
+        std::array< uint64_t, 4 > acc = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+        for ( ; end - p >= 32; p += 32 )
+        {
+            for ( size_t i = 0; i < acc.size(); ++i )
+            {
+                acc[ i ] = hash_round( acc[ i ], read_word< uint64_t >( p + i * 8 ) );
+            }
+        }
+        hash = std::rotl( acc[ 0 ], 1 ) + std::rotl( acc[ 1 ], 7 ) + std::rotl( acc[ 2 ], 12 ) + std::rotl( acc[ 3 ], 18 );
+        for ( uint64_t const a : acc )
+        {
+            hash = merge_round( hash, a );
+        }
+    }
+    else
+    {
+        hash = seed + prime5;
+    }
+    hash += bytes.size();
+
+    for ( ; end - p >= 8; p += 8 )
+    {
+        hash ^= hash_round( 0, read_word< uint64_t >( p ) );
+        hash = std::rotl( hash, 27 ) * prime1 + prime4;
+    }
+    if ( end - p >= 4 )
+    {
+        hash ^= read_word< uint32_t >( p ) * prime1;
+        hash = std::rotl( hash, 23 ) * prime2 + prime3;
+        p += 4;
+    }
+    for ( ; p != end; ++p )
+    {
+        hash ^= static_cast< uint64_t >( *p ) * prime5;
+        hash = std::rotl( hash, 11 ) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Common.h"
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace save_fixer
+{
+    // Builds the contents of a cache file, all in native byte order
+    class CacheWriter
+    {
+    public:
+        template < typename T >
+        requires std::is_trivially_copyable_v< T >
+        void write( T const value )
+        {
+            std::byte const *p = reinterpret_cast< std::byte const * >( &value );
+            bytes.insert( bytes.end(), p, p + sizeof( T ) );
+        }
+
+        void write_string( std::u8string_view const s )
+        {
+            write_bytes( std::span( reinterpret_cast< std::byte const * >( s.data() ), s.size() ) );
+        }
+
+        void write_bytes( std::span< std::byte const > const b )
+        {
+            write( static_cast< uint32_t >( b.size() ) );
+            bytes.insert( bytes.end(), b.begin(), b.end() );
+        }
+
+        std::vector< std::byte > bytes;
+    };
+
+    // Reads what a CacheWriter wrote. Reading past the end throws Invalid.
+    class CacheReader
+    {
+    public:
+        explicit CacheReader( std::span< std::byte const > b ) : remaining( b ) {}
+
+        class Invalid
+        {
+        };
+
+        template < typename T >
+        requires std::is_trivially_copyable_v< T >
+        T read()
+        {
+            T value;
+            std::memcpy( &value, take( sizeof( T ) ).data(), sizeof( T ) );
+            return value;
+        }
+
+        std::u8string read_string()
+        {
+            std::span< std::byte const > const s = read_bytes();
+            return std::u8string( reinterpret_cast< char8_t const * >( s.data() ), s.size() );
+        }
+
+        // A view of the bytes being read
+        std::span< std::byte const > read_bytes() { return take( read< uint32_t >() ); }
+
+        bool empty() const { return remaining.empty(); }
+
+    private:
+        std::span< std::byte const > take( size_t const n )
+        {
+            if ( n > remaining.size() )
+            {
+                throw Invalid();
+            }
+            std::span< std::byte const > const s = remaining.first( n );
+            remaining = remaining.subspan( n );
+            return s;
+        }
+
+        std::span< std::byte const > remaining;
+    };
+
+    // Replaces the cache file with bytes, by way of a temporary file so a reader never sees half of
+    // it. Throws SaveFixerException on error.
+    void write_cache_file( std::u8string const &file_path, std::span< std::byte const > bytes );
+
+    // A 64 bit hash of bytes, which is XXH64 so that it is fast enough to check a whole save when
+    // it is opened
+    uint64_t hash_bytes( std::span< std::byte const > bytes, uint64_t seed = 0 );
+}
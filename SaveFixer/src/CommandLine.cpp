@@ -0,0 +1,791 @@
+#include "CommandLine.h"
+
+#include "BatchFix.h"
+#include "FileSystem.h"
+#include "JsonRefTable.h"
+#include "SaveFile.h"
+#include "SaveIndex.h"
+#include "SectionCache.h"
+#include "ThreadPool.h"
+#include "Version.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <optional>
+#include <type_traits>
+
+using namespace save_fixer;
+
+namespace
+{
+    constexpr char const *usage_text =
+        "usage: mmsavefix <save file> [options]\n"
+        "       mmsavefix --index <saves folder> [--cache <file>]\n"
+        "       mmsavefix --batch <list file> [--policy <policy>] [--threads <n>]\n"
+        "                 [--compression <method>] [--overwrite]\n"
+        "\n"
+        "Prints the save name and the player team's drivers. If --output is given a new save file is\n"
+        "written with the chosen driver positions. With --index every save in the folder is checked\n"
+        "for the practice driver glitch.\n"
+        "\n"
+        "With --batch many saves are fixed in parallel. Each line of the list file is a save file,\n"
+        "optionally followed by a tab and a policy, then a tab and an output file. The output file\n"
+        "defaults to the save file with \"(fixed)\" added to its name. The policies are keep,\n"
+        "swap-reserve-car1, swap-reserve-car2, swap-car1-car2 and file-order, which puts the drivers\n"
+        "in car 1, car 2 and reserve in the order they are in the save file.\n"
+        "\n"
+        "options:\n"
+        "  -i, --info               only print the save name, which is much faster\n"
+        "  -o, --output <file>      write the fixed save to <file>\n"
+        "  -n, --name <name>        save name of the new file, defaults to the output file name\n"
+        "  -p, --positions <a,b,c>  positions of drivers 1, 2 and 3, each one of car1, car2 or reserve\n"
+        "  -c, --compression <method>\n"
+        "                           how new saves are compressed: fast (the default) or fast:<n> for\n"
+        "                           LZ4 with acceleration n, hc or hc:<level> for levels 3 to 12, or\n"
+        "                           auto or auto:<ms> for the best level that takes about ms\n"
+        "                           milliseconds, 1000 by default\n"
+        "      --overwrite          allow an existing output file to be replaced\n"
+        "      --check-refs         check that every \"$ref\" in the save is to an object that exists\n"
+        "      --audit              check the driver positions of every team, not just the player's\n"
+        "      --fix-all            with --output, fix the driver positions of every team with the\n"
+        "                           glitch\n"
+        "      --sidecar            keep what is found in the save in <save file>.idx, so opening\n"
+        "                           the save again is faster while it is unchanged\n"
+        "      --section-cache <folder>\n"
+        "                           keep up to 2GB of decompressed saves in <folder>, so opening\n"
+        "                           them again does not decompress them\n"
+        "      --stream             read and write the save through a small window rather than all\n"
+        "                           in memory, for saves too large to open otherwise\n"
+        "      --out-of-core        decompress the save into a temporary file next to it rather\n"
+        "                           than into memory, so it can be paged out when memory is short\n"
+        "      --index              index every save in the folder\n"
+        "      --cache <file>       keep the index in <file> so unchanged saves are not reopened\n"
+        "      --batch              fix every save in the list file\n"
+        "      --policy <policy>    policy for list file lines without one, defaults to keep\n"
+        "  -j, --threads <n>        number of threads to use, defaults to one per core\n"
+        "  -h, --help               show this help\n"
+        "  -v, --version            show the version number\n";
+
+    constexpr uint64_t section_cache_size = 2ULL * 1024ULL * 1024ULL * 1024ULL;
+
+    constexpr int exit_success = 0;
+    constexpr int exit_error = 1;
+    constexpr int exit_usage = 2;
+
+    void print( std::u8string_view const s )
+    {
+        std::fwrite( s.data(), 1, s.size(), stdout );
+    }
+
+    void print_error( std::u8string_view const s )
+    {
+        std::fwrite( u8"mmsavefix: ", 1, 11, stderr );
+        std::fwrite( s.data(), 1, s.size(), stderr );
+        std::fputc( '\n', stderr );
+    }
+
+    class UsageError
+    {
+    public:
+        UsageError( std::u8string desc ) : description( std::move( desc ) ) {}
+        std::u8string const description;
+    };
+
+    std::u8string_view position_name( SaveFile::DriverPosition const p )
+    {
+        switch ( p )
+        {
+            case SaveFile::DriverPosition::reserve:
+                return u8"reserve";
+            case SaveFile::DriverPosition::car1:
+                return u8"car1";
+            case SaveFile::DriverPosition::car2:
+                return u8"car2";
+            default:
+                throw SaveFixerException( u8"internal error: unreachable"s );
+        }
+    }
+
+    SaveFile::DriverPosition parse_position( std::u8string_view const s )
+    {
+        for ( SaveFile::DriverPosition const p :
+              { SaveFile::DriverPosition::reserve, SaveFile::DriverPosition::car1, SaveFile::DriverPosition::car2 } )
+        {
+            if ( s == position_name( p ) )
+            {
+                return p;
+            }
+        }
+        throw UsageError( u8"unknown driver position \""s + std::u8string( s ) + u8"\""s );
+    }
+
+    std::array< SaveFile::DriverPosition, 3 > parse_positions( std::u8string_view s )
+    {
+        std::array< SaveFile::DriverPosition, 3 > positions;
+        for ( size_t i = 0; i < positions.size(); ++i )
+        {
+            size_t const comma = s.find( u8',' );
+            if ( ( comma == std::u8string_view::npos ) != ( i + 1 == positions.size() ) )
+            {
+                throw UsageError( u8"--positions needs exactly three comma separated positions"s );
+            }
+            positions[ i ] = parse_position( s.substr( 0, comma ) );
+            s = s.substr( comma + 1 );
+        }
+        return positions;
+    }
+
+    enum class Mode
+    {
+        show_save,
+        show_save_info,
+        index_folder,
+        batch_fix,
+    };
+
+    struct Options
+    {
+        Mode mode = Mode::show_save;
+        std::u8string path;
+        std::optional< std::u8string > output_path;
+        std::optional< std::u8string > save_name;
+        std::optional< std::array< SaveFile::DriverPosition, 3 > > positions;
+        std::optional< std::u8string > cache_path;
+        std::optional< PositionPolicy > policy;
+        size_t thread_count = 0;
+        std::optional< CompressionPolicy > compression;
+        bool allow_overwrite = false;
+        bool check_refs = false;
+        bool audit = false;
+        bool fix_all = false;
+        bool use_sidecar = false;
+        std::optional< std::u8string > section_cache_path;
+        bool stream = false;
+        bool out_of_core = false;
+        bool show_help = false;
+        bool show_version = false;
+    };
+
+    PositionPolicy parse_policy( std::u8string_view const s )
+    {
+        if ( std::optional< PositionPolicy > const policy = parse_position_policy( s ); policy.has_value() )
+        {
+            return policy.value();
+        }
+        throw UsageError( u8"unknown policy \""s + std::u8string( s ) + u8"\""s );
+    }
+
+    // Returns nullopt if s is not a number from min to max
+    std::optional< size_t > parse_number( std::u8string_view const s, size_t const min, size_t const max )
+    {
+        size_t n = 0;
+        for ( char8_t const c : s )
+        {
+            if ( c < u8'0' || c > u8'9' || n > max )
+            {
+                return std::nullopt;
+            }
+            n = n * 10 + static_cast< size_t >( c - u8'0' );
+        }
+        if ( s.empty() || n < min || n > max )
+        {
+            return std::nullopt;
+        }
+        return n;
+    }
+
+    size_t parse_thread_count( std::u8string_view const s )
+    {
+        if ( std::optional< size_t > const count = parse_number( s, 1, 99999 ); count.has_value() )
+        {
+            return count.value();
+        }
+        throw UsageError( u8"invalid thread count \""s + std::u8string( s ) + u8"\""s );
+    }
+
+    // fast[:<acceleration>], hc[:<level>] or auto[:<milliseconds>]
+    CompressionPolicy parse_compression( std::u8string_view const s )
+    {
+        size_t const colon = s.find( u8':' );
+        std::u8string_view const method = s.substr( 0, colon );
+        bool const has_argument = ( colon != std::u8string_view::npos );
+        std::u8string_view const argument = has_argument ? s.substr( colon + 1 ) : std::u8string_view();
+
+        CompressionPolicy policy;
+        std::optional< size_t > number;
+        if ( method == u8"fast"sv )
+        {
+            number = has_argument ? parse_number( argument, 1, lz4_max_acceleration ) : 1;
+            policy.compression.method = Lz4Compression::Method::fast;
+            policy.compression.level = static_cast< int >( number.value_or( 0 ) );
+        }
+        else if ( method == u8"hc"sv )
+        {
+            number = has_argument ? parse_number( argument, lz4_min_high_level, lz4_max_high_level )
+                                  : lz4_default_high_level;
+            policy.compression.method = Lz4Compression::Method::high;
+            policy.compression.level = static_cast< int >( number.value_or( 0 ) );
+        }
+        else if ( method == u8"auto"sv )
+        {
+            number = has_argument ? parse_number( argument, 1, 3600000 )
+                                  : static_cast< size_t >( policy.time_budget.count() );
+            policy.automatic = true;
+            policy.time_budget = std::chrono::milliseconds( number.value_or( 0 ) );
+        }
+        if ( !number.has_value() )
+        {
+            throw UsageError( u8"unknown compression method \""s + std::u8string( s ) + u8"\""s );
+        }
+        return policy;
+    }
+
+    Options parse_options( std::span< std::u8string const > args )
+    {
+        Options options;
+        std::optional< std::u8string_view > mode_option;
+        auto const set_mode = [ & ]( Mode const mode, std::u8string_view const option ) {
+            if ( mode_option.has_value() )
+            {
+                throw UsageError( std::u8string( option ) + u8" cannot be used with "s +
+                                  std::u8string( mode_option.value() ) );
+            }
+            options.mode = mode;
+            mode_option = option;
+        };
+
+        for ( size_t i = 0; i < args.size(); ++i )
+        {
+            std::u8string_view const arg = args[ i ];
+            auto const value = [ & ]() -> std::u8string const & {
+                if ( i + 1 >= args.size() )
+                {
+                    throw UsageError( std::u8string( arg ) + u8" needs a value"s );
+                }
+                return args[ ++i ];
+            };
+
+            if ( arg == u8"-h"sv || arg == u8"--help"sv )
+            {
+                options.show_help = true;
+            }
+            else if ( arg == u8"-v"sv || arg == u8"--version"sv )
+            {
+                options.show_version = true;
+            }
+            else if ( arg == u8"-i"sv || arg == u8"--info"sv )
+            {
+                set_mode( Mode::show_save_info, arg );
+            }
+            else if ( arg == u8"--index"sv )
+            {
+                set_mode( Mode::index_folder, arg );
+            }
+            else if ( arg == u8"--batch"sv )
+            {
+                set_mode( Mode::batch_fix, arg );
+            }
+            else if ( arg == u8"--cache"sv )
+            {
+                options.cache_path = value();
+            }
+            else if ( arg == u8"--policy"sv )
+            {
+                options.policy = parse_policy( value() );
+            }
+            else if ( arg == u8"-j"sv || arg == u8"--threads"sv )
+            {
+                options.thread_count = parse_thread_count( value() );
+            }
+            else if ( arg == u8"-o"sv || arg == u8"--output"sv )
+            {
+                options.output_path = value();
+            }
+            else if ( arg == u8"-n"sv || arg == u8"--name"sv )
+            {
+                options.save_name = value();
+            }
+            else if ( arg == u8"-p"sv || arg == u8"--positions"sv )
+            {
+                options.positions = parse_positions( value() );
+            }
+            else if ( arg == u8"-c"sv || arg == u8"--compression"sv )
+            {
+                options.compression = parse_compression( value() );
+            }
+            else if ( arg == u8"--overwrite"sv )
+            {
+                options.allow_overwrite = true;
+            }
+            else if ( arg == u8"--check-refs"sv )
+            {
+                options.check_refs = true;
+            }
+            else if ( arg == u8"--audit"sv )
+            {
+                options.audit = true;
+            }
+            else if ( arg == u8"--fix-all"sv )
+            {
+                options.fix_all = true;
+            }
+            else if ( arg == u8"--sidecar"sv )
+            {
+                options.use_sidecar = true;
+            }
+            else if ( arg == u8"--section-cache"sv )
+            {
+                options.section_cache_path = value();
+            }
+            else if ( arg == u8"--stream"sv )
+            {
+                options.stream = true;
+            }
+            else if ( arg == u8"--out-of-core"sv )
+            {
+                options.out_of_core = true;
+            }
+            else if ( arg.starts_with( u8'-' ) )
+            {
+                throw UsageError( u8"unknown option "s + std::u8string( arg ) );
+            }
+            else if ( options.path.empty() )
+            {
+                options.path = arg;
+            }
+            else
+            {
+                throw UsageError( u8"unexpected argument "s + std::u8string( arg ) );
+            }
+        }
+
+        if ( options.show_help || options.show_version )
+        {
+            return options;
+        }
+        if ( options.path.empty() )
+        {
+            throw UsageError( options.mode == Mode::index_folder ? u8"no saves folder given"s
+                              : options.mode == Mode::batch_fix  ? u8"no list file given"s
+                                                                 : u8"no save file given"s );
+        }
+        if ( options.mode != Mode::show_save &&
+             ( options.output_path.has_value() || options.save_name.has_value() || options.positions.has_value() ) )
+        {
+            throw UsageError( std::u8string( mode_option.value() ) +
+                              u8" cannot be used with --output, --name or --positions"s );
+        }
+        if ( options.cache_path.has_value() && options.mode != Mode::index_folder )
+        {
+            throw UsageError( u8"--cache can only be used with --index"s );
+        }
+        if ( ( options.policy.has_value() || options.thread_count != 0 ) && options.mode != Mode::batch_fix )
+        {
+            throw UsageError( u8"--policy and --threads can only be used with --batch"s );
+        }
+        if ( options.allow_overwrite && options.mode != Mode::show_save && options.mode != Mode::batch_fix )
+        {
+            throw UsageError( u8"--overwrite can only be used with --output or --batch"s );
+        }
+        if ( options.check_refs && options.mode != Mode::show_save )
+        {
+            throw UsageError( std::u8string( mode_option.value() ) + u8" cannot be used with --check-refs"s );
+        }
+        if ( ( options.audit || options.fix_all ) && options.mode != Mode::show_save )
+        {
+            throw UsageError( std::u8string( mode_option.value() ) + u8" cannot be used with --audit or --fix-all"s );
+        }
+        if ( ( options.use_sidecar || options.section_cache_path.has_value() ) && options.mode != Mode::show_save )
+        {
+            throw UsageError( std::u8string( mode_option.value() ) + u8" cannot be used with --sidecar or --section-cache"s );
+        }
+        if ( options.stream && options.mode != Mode::show_save )
+        {
+            throw UsageError( std::u8string( mode_option.value() ) + u8" cannot be used with --stream"s );
+        }
+        if ( options.stream && ( options.check_refs || options.audit || options.fix_all || options.use_sidecar ||
+                                 options.section_cache_path.has_value() ) )
+        {
+            throw UsageError( u8"--stream cannot be used with --check-refs, --audit, --fix-all, --sidecar or --section-cache"s );
+        }
+        if ( options.out_of_core && options.mode != Mode::show_save )
+        {
+            throw UsageError( std::u8string( mode_option.value() ) + u8" cannot be used with --out-of-core"s );
+        }
+        if ( options.out_of_core && options.stream )
+        {
+            throw UsageError( u8"--out-of-core cannot be used with --stream"s );
+        }
+        if ( options.fix_all && !options.output_path.has_value() )
+        {
+            throw UsageError( u8"--fix-all can only be used with --output"s );
+        }
+        if ( options.compression.has_value() && !options.output_path.has_value() && options.mode != Mode::batch_fix )
+        {
+            throw UsageError( u8"--compression can only be used with --output or --batch"s );
+        }
+        if ( options.positions.has_value() && !SaveFile::driver_positions_are_unique( options.positions.value() ) )
+        {
+            throw UsageError( u8"--positions must use each of car1, car2 and reserve once"s );
+        }
+        return options;
+    }
+
+    // Returns the save file path with "(fixed)" added before the extension
+    std::u8string get_default_output_path( std::u8string_view const save_path )
+    {
+        constexpr std::u8string_view extension = u8".sav";
+        std::u8string output_path( save_path.ends_with( extension )
+                                       ? save_path.substr( 0, save_path.size() - extension.size() )
+                                       : save_path );
+        output_path.append( u8"(fixed).sav"s );
+        return output_path;
+    }
+
+    std::vector< BatchFixJob > read_batch_list_file( std::u8string const &list_path, PositionPolicy const default_policy )
+    {
+        ReadFileMapping const list_file( list_path );
+        std::u8string_view remaining( reinterpret_cast< char8_t const * >( list_file.data() ), list_file.size() );
+
+        std::vector< BatchFixJob > jobs;
+        for ( size_t line_number = 1; !remaining.empty(); ++line_number )
+        {
+            size_t const line_end = remaining.find( u8'\n' );
+            std::u8string_view line = remaining.substr( 0, line_end );
+            remaining = ( line_end == std::u8string_view::npos ) ? std::u8string_view() : remaining.substr( line_end + 1 );
+            if ( line.ends_with( u8'\r' ) )
+            {
+                line.remove_suffix( 1 );
+            }
+            if ( line.empty() )
+            {
+                continue;
+            }
+
+            std::array< std::u8string_view, 3 > fields;
+            size_t field_count = 0;
+            for ( ; field_count < fields.size() && !line.empty(); ++field_count )
+            {
+                size_t const tab = line.find( u8'\t' );
+                fields[ field_count ] = line.substr( 0, tab );
+                line = ( tab == std::u8string_view::npos ) ? std::u8string_view() : line.substr( tab + 1 );
+            }
+            std::optional< PositionPolicy > const policy =
+                fields[ 1 ].empty() ? default_policy : parse_position_policy( fields[ 1 ] );
+            if ( !line.empty() || fields[ 0 ].empty() || !policy.has_value() )
+            {
+                throw SaveFixerException( list_path + u8" line "s +
+                                          std::u8string( char_as_u8( std::to_string( line_number ) ) ) +
+                                          u8" is invalid"s );
+            }
+
+            BatchFixJob &job = jobs.emplace_back();
+            job.input_path = fields[ 0 ];
+            job.policy = policy.value();
+            job.output_path = fields[ 2 ].empty() ? get_default_output_path( fields[ 0 ] ) : std::u8string( fields[ 2 ] );
+        }
+        return jobs;
+    }
+
+    int batch_fix( Options const &options )
+    {
+        std::vector< BatchFixJob > const jobs =
+            read_batch_list_file( options.path, options.policy.value_or( PositionPolicy::keep ) );
+
+        ThreadPool pool( options.thread_count );
+        std::vector< BatchFixResult > const results =
+            run_batch_fix( jobs, pool, options.allow_overwrite, options.compression.value_or( CompressionPolicy{} ) );
+
+        int exit_code = exit_success;
+        for ( size_t i = 0; i < jobs.size(); ++i )
+        {
+            std::u8string line = jobs[ i ].input_path;
+            if ( results[ i ].error.has_value() )
+            {
+                line.append( u8"\terror: "s ).append( results[ i ].error.value() );
+                exit_code = exit_error;
+            }
+            else
+            {
+                line.append( u8"\t"s ).append( jobs[ i ].output_path ).append( u8"\t"s );
+                for ( SaveFile::DriverPosition const p : results[ i ].positions )
+                {
+                    line.append( position_name( p ) ).push_back( u8',' );
+                }
+                line.pop_back();
+            }
+            line.push_back( u8'\n' );
+            print( line );
+        }
+        return exit_code;
+    }
+
+    template < typename Save >
+    void print_save( Save &save_file )
+    {
+        print( u8"name: "s.append( save_file.get_original_save_name() ).append( u8"\n"s ) );
+
+        std::array< SaveFile::DriverRef, 3 > const drivers = save_file.get_drivers();
+        for ( size_t i = 0; i < drivers.size(); ++i )
+        {
+            std::u8string line( char_as_u8( std::to_string( i + 1 ) ) );
+            line.append( u8": "s )
+                .append( position_name( drivers[ i ].position ) )
+                .append( u8"\t"s )
+                .append( drivers[ i ].name )
+                .push_back( u8'\n' );
+            print( line );
+        }
+
+        if ( !save_file.driver_positions_are_unique() )
+        {
+            print( u8"driver positions overlap, the practice driver glitch is present\n"sv );
+        }
+    }
+
+    // Returns false if any ref is broken
+    bool print_ref_check( SaveFile const &save_file )
+    {
+        JsonRefTable const refs = save_file.build_ref_table();
+        std::u8string line = u8"refs: "s;
+        line.append( char_as_u8( std::to_string( refs.get_object_count() ) ) )
+            .append( u8" objects, "s )
+            .append( char_as_u8( std::to_string( refs.get_ref_count() ) ) )
+            .append( u8" refs"s );
+        if ( refs.all_refs_resolve() )
+        {
+            line.append( u8", all resolve\n"s );
+        }
+        else
+        {
+            line.append( u8", "s )
+                .append( char_as_u8( std::to_string( refs.get_broken_keys().size() ) ) )
+                .append( u8" broken, the first at offset "s )
+                .append( char_as_u8( std::to_string( refs.get_broken_keys().front() ) ) )
+                .append( u8" of the data section\n"s );
+        }
+        print( line );
+        return refs.all_refs_resolve();
+    }
+
+    // The team's drivers as "<position> <name>, ..."
+    std::u8string get_team_positions( SaveFile::TeamDrivers const &team )
+    {
+        std::u8string positions;
+        for ( SaveFile::Driver const &driver : team.drivers )
+        {
+            if ( !positions.empty() )
+            {
+                positions.append( u8", "s );
+            }
+            positions.append( position_name( driver.position ) ).append( u8" "s ).append( driver.name );
+        }
+        return positions;
+    }
+
+    // Prints the teams with the glitch, and fixes them if fix is set so they are fixed when the
+    // save is written
+    void print_audit( SaveFile &save_file, bool const fix )
+    {
+        std::vector< SaveFile::TeamDrivers > teams = save_file.find_all_team_drivers();
+        size_t const glitch_count = std::count_if( teams.begin(), teams.end(), []( SaveFile::TeamDrivers const &team ) {
+            return !SaveFile::team_positions_are_valid( team.drivers );
+        } );
+        print( u8"audit: "s.append( char_as_u8( std::to_string( teams.size() ) ) )
+                   .append( u8" teams, "s )
+                   .append( char_as_u8( std::to_string( glitch_count ) ) )
+                   .append( u8" with overlapping or missing car positions\n"s ) );
+
+        for ( SaveFile::TeamDrivers &team : teams )
+        {
+            if ( SaveFile::team_positions_are_valid( team.drivers ) )
+            {
+                continue;
+            }
+            std::u8string line = u8"team "s;
+            line.append( team.team_id )
+                .append( team.team_id == save_file.get_player_team_id() ? u8" (player): "sv : u8": "sv )
+                .append( get_team_positions( team ) )
+                .push_back( u8'\n' );
+            print( line );
+            if ( !fix )
+            {
+                continue;
+            }
+            if ( !SaveFile::fix_team_positions( team.drivers ) )
+            {
+                print( u8"    cannot be fixed, the team has fewer than two drivers\n"sv );
+                continue;
+            }
+            for ( SaveFile::Driver const &driver : team.drivers )
+            {
+                save_file.set_driver_position( driver );
+            }
+            print( u8"    fixed: "s.append( get_team_positions( team ) ).append( u8"\n"s ) );
+        }
+    }
+
+    void print_index( SaveIndex const &index )
+    {
+        for ( SaveIndexEntry const &entry : index.get_entries() )
+        {
+            std::u8string line = entry.file_path;
+            if ( entry.error.has_value() )
+            {
+                line.append( u8"\terror: "s ).append( entry.error.value() ).push_back( u8'\n' );
+                print( line );
+                continue;
+            }
+
+            line.append( u8"\t"s )
+                .append( entry.has_practice_driver_bug ? u8"glitch"sv : u8"ok"sv )
+                .append( u8"\tname: "s )
+                .append( entry.save_name )
+                .append( u8"\tteam: "s )
+                .append( entry.player_team_id )
+                .push_back( u8'\n' );
+            for ( SaveIndexEntry::Driver const &driver : entry.drivers )
+            {
+                line.append( u8"    "s )
+                    .append( position_name( driver.position ) )
+                    .append( u8"\t"s )
+                    .append( driver.name )
+                    .push_back( u8'\n' );
+            }
+            print( line );
+        }
+    }
+
+    template < typename Save >
+    int write_save( Save &save_file, Options const &options )
+    {
+        std::u8string const &output_path = options.output_path.value();
+
+        std::array< SaveFile::DriverRef, 3 > drivers = save_file.get_drivers();
+        if ( options.positions.has_value() )
+        {
+            for ( size_t i = 0; i < drivers.size(); ++i )
+            {
+                drivers[ i ].position = options.positions.value()[ i ];
+            }
+        }
+
+        if ( !save_file.driver_positions_are_unique() )
+        {
+            print_error( u8"driver positions overlap, use --positions to choose new positions"sv );
+            return exit_error;
+        }
+
+        if ( query_file( output_path ) != path_state::does_not_exist && !options.allow_overwrite )
+        {
+            print_error( output_path + u8" already exists, use --overwrite to replace it"s );
+            return exit_error;
+        }
+
+        std::u8string const save_name =
+            options.save_name.has_value() ? options.save_name.value() : extract_save_name_from_save_path( output_path );
+        CompressionPolicy const compression = options.compression.value_or( CompressionPolicy{} );
+        if constexpr ( std::is_same_v< Save, StreamedSaveFile > )
+        {
+            save_file.write( output_path, save_name, options.allow_overwrite, compression );
+        }
+        else
+        {
+            save_file.write( output_path, save_name, options.allow_overwrite, nullptr, compression );
+        }
+        return exit_success;
+    }
+}
+
+int save_fixer::run_command_line( std::span< std::u8string const > args )
+{
+    try
+    {
+        Options const options = parse_options( args );
+        if ( options.show_help )
+        {
+            print( char_as_u8( usage_text ) );
+            return exit_success;
+        }
+        if ( options.show_version )
+        {
+            print( u8"mmsavefix " SAVE_FIXER_VERSION_STRING "\n"sv );
+            return exit_success;
+        }
+
+        switch ( options.mode )
+        {
+            case Mode::index_folder:
+            {
+                SaveIndex index( options.cache_path );
+                index.update( options.path );
+                index.write_cache();
+                print_index( index );
+                return exit_success;
+            }
+            case Mode::show_save_info:
+            {
+                SaveFileInfo const save_info( options.path );
+                print( u8"name: "s.append( save_info.get_save_name() ).append( u8"\n"s ) );
+                return exit_success;
+            }
+            case Mode::batch_fix:
+                return batch_fix( options );
+            case Mode::show_save:
+                break;
+        }
+
+        if ( options.stream )
+        {
+            StreamedSaveFile save_file( options.path );
+            print_save( save_file );
+            return options.output_path.has_value() ? write_save( save_file, options ) : exit_success;
+        }
+
+        // The sections are only kept if something after opening the save reads them, or if they are
+        // in a temporary file rather than in memory anyway
+        bool const keep_sections = options.check_refs || options.audit || options.fix_all || options.output_path.has_value();
+        SaveFile::Residency const residency = options.out_of_core ? SaveFile::Residency::file_backed
+                                              : keep_sections     ? SaveFile::Residency::decompressed
+                                                                  : SaveFile::Residency::compressed;
+        std::optional< SectionCache > section_cache;
+        if ( options.section_cache_path.has_value() )
+        {
+            section_cache.emplace( options.section_cache_path.value(), section_cache_size );
+        }
+        SaveFile save_file( options.path, residency, options.use_sidecar, section_cache.has_value() ? &section_cache.value() : nullptr );
+        print_save( save_file );
+        if ( options.check_refs && !print_ref_check( save_file ) )
+        {
+            return exit_error;
+        }
+
+        if ( options.audit || options.fix_all )
+        {
+            print_audit( save_file, options.fix_all );
+        }
+
+        if ( options.output_path.has_value() )
+        {
+            return write_save( save_file, options );
+        }
+        return exit_success;
+    }
+    catch ( UsageError const &ex )
+    {
+        print_error( ex.description );
+        std::fputs( "run mmsavefix --help for usage\n", stderr );
+        return exit_usage;
+    }
+    catch ( SaveFixerException const &ex )
+    {
+        print_error( ex.description );
+        return exit_error;
+    }
+    catch ( ... )
+    {
+        print_error( u8"unknown error"sv );
+        return exit_error;
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "Common.h"
+
+#include <span>
+
+namespace save_fixer
+{
+    // args excludes the program name
+    int run_command_line( std::span< std::u8string const > args );
+}
@@ -40,7 +40,7 @@ namespace save_fixer
     template < typename T >
     concept HandleTraits = requires( typename T::HandleType h )
     {
-        { T::HandleType ( T::null_value ) };
+        { typename T::HandleType ( T::null_value ) };
         { h = T::null_value };
         { T::close( h ) };
     };
@@ -4,6 +4,7 @@
 
 #include <span>
 #include <memory>
+#include <utility>
 
 namespace save_fixer
 {
@@ -16,11 +17,17 @@ namespace save_fixer
     };
     path_state query_file( std::u8string const &file_path );
 
+    enum class read_access
+    {
+        whole_file,    // The whole file will be read, so it can be read ahead
+        partial,       // Only a small part of the file will be read
+    };
+
     class ReadFileMapping
     {
     public:
         // Throws SaveFixerException on error
-        ReadFileMapping( std::u8string const &file_path );
+        ReadFileMapping( std::u8string const &file_path, read_access access = read_access::whole_file );
 
         ~ReadFileMapping();
 
@@ -59,4 +66,70 @@ namespace save_fixer
         class impl;
         std::unique_ptr< impl > pimpl;
     };
+
+    // Memory that is backed by a temporary file rather than by swap, so that when memory is short
+    // the system writes its pages to the file and drops them, and reads them back when they are
+    // touched again. The file is made next to near_file_path and is removed when the mapping is
+    // destroyed, or by the system if the process ends first.
+    class TempFileMapping
+    {
+    public:
+        // Throws SaveFixerException on error
+        TempFileMapping( std::u8string const &near_file_path, size_t size );
+
+        ~TempFileMapping();
+
+        TempFileMapping( TempFileMapping && ) noexcept;
+        TempFileMapping &operator=( TempFileMapping && ) noexcept;
+
+        std::span< std::byte > bytes() const;
+
+    private:
+        class impl;
+        std::unique_ptr< impl > pimpl;
+    };
+
+    // Uninitialized memory for buffers of many MB, such as the decompressed sections of a save. It
+    // is in huge pages where the system has them, and its pages are faulted in when it is
+    // allocated, so filling it does not take a page fault for every 4 KB. Smaller buffers, or
+    // buffers the system cannot do this for, are allocated as usual.
+    class LargeBuffer
+    {
+    public:
+        LargeBuffer() = default;
+
+        // Throws std::bad_alloc if there is not enough memory
+        explicit LargeBuffer( size_t size );
+
+        ~LargeBuffer() { release(); }
+
+        LargeBuffer( LargeBuffer &&other ) noexcept
+            : buffer( std::exchange( other.buffer, nullptr ) )
+            , buffer_size( std::exchange( other.buffer_size, 0 ) )
+            , mapped_size( std::exchange( other.mapped_size, 0 ) )
+        {
+        }
+        LargeBuffer &operator=( LargeBuffer &&other ) noexcept
+        {
+            if ( this != &other )
+            {
+                release();
+                buffer = std::exchange( other.buffer, nullptr );
+                buffer_size = std::exchange( other.buffer_size, 0 );
+                mapped_size = std::exchange( other.mapped_size, 0 );
+            }
+            return *this;
+        }
+
+        std::byte *get() const { return buffer; }
+        size_t size() const { return buffer_size; }
+        std::span< std::byte > bytes() const { return std::span( buffer, buffer_size ); }
+
+    private:
+        void release();
+
+        std::byte *buffer = nullptr;
+        size_t buffer_size = 0;
+        size_t mapped_size = 0;    // Zero if the buffer was allocated with new
+    };
 }
@@ -0,0 +1,913 @@
+#include "JsonIndex.h"
+
+#include <algorithm>
+#include <array>
+#include <assert.h>
+#include <bit>
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+#define JSON_INDEX_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only allow the intrinsics for an instruction set in functions that target it, MSVC
+// allows them anywhere. A function that is forced inline is compiled for the target of its caller.
+#if defined( __GNUC__ )
+#define JSON_INDEX_TARGET( isa ) __attribute__( ( target( isa ) ) )
+#define JSON_INDEX_FORCE_INLINE inline __attribute__( ( always_inline ) )
+#else
+#define JSON_INDEX_TARGET( isa )
+#define JSON_INDEX_FORCE_INLINE __forceinline
+#endif
+
+using namespace save_fixer;
+
+namespace
+{
+    constexpr size_t block_size = 64;
+
+    // The number of entries in each level of the tree of depths that one entry of the level above
+    // covers
+    constexpr size_t depth_level_fanout = 64;
+
+    // The blocks indexed at a time, so their bits are still in the cache when their depths are found
+    constexpr size_t index_chunk_size = 1024;
+
+    // What one block passes on to the next
+    struct Carry
+    {
+        uint64_t escaped;
+        uint64_t in_string;
+    };
+
+    // Where the bits of the blocks being indexed are written
+    struct BlockBits
+    {
+        uint64_t *quotes;
+        uint64_t *opens;
+        uint64_t *closes;
+    };
+
+    using IndexBlocks = void ( * )( char8_t const *data, size_t block_count, Carry &carry, BlockBits out );
+
+    // Key candidates are found a window of 64 positions at a time, and each window reads the two
+    // bytes after it. Bit i of a window's candidates is set if the first three bytes of a key
+    // match at position i.
+    constexpr size_t key_window_size = 64;
+    constexpr size_t key_window_batch_size = 64;
+
+    using FindKeyCandidates = void ( * )( char8_t const *data, size_t window_count,
+                                          JsonKeyScanner::NibbleMasks const &masks, uint64_t *candidates );
+
+    // The keys whose byte j could be c
+    uint8_t key_byte_mask( JsonKeyScanner::NibbleMasks const &masks, size_t const j, char8_t const c )
+    {
+        return masks.low[ j ][ c & 0x0f ] & masks.high[ j ][ c >> 4 ];
+    }
+
+    void find_key_candidates_scalar( char8_t const *const data, size_t const window_count,
+                                     JsonKeyScanner::NibbleMasks const &masks, uint64_t *const candidates )
+    {
+        for ( size_t w = 0; w < window_count; ++w )
+        {
+            uint64_t bits = 0;
+            for ( size_t i = 0; i < key_window_size; ++i )
+            {
+                char8_t const *const p = data + w * key_window_size + i;
+                if ( ( key_byte_mask( masks, 0, p[ 0 ] ) & key_byte_mask( masks, 1, p[ 1 ] ) &
+                       key_byte_mask( masks, 2, p[ 2 ] ) ) != 0 )
+                {
+                    bits |= uint64_t{ 1 } << i;
+                }
+            }
+            candidates[ w ] = bits;
+        }
+    }
+
+    // Returns the quotes that are not escaped. A backslash escapes the next byte unless it is
+    // escaped itself. Every run of backslashes that starts on an odd bit is moved to start on an
+    // even bit by adding the run's start to it, the carry clearing the run, and then every other
+    // bit of a run escapes the byte after it. This is the approach of simdjson's string scanner.
+    inline uint64_t find_unescaped_quotes( uint64_t const quotes, uint64_t const backslashes, Carry &carry )
+    {
+        constexpr uint64_t even_bits = 0x5555555555555555ULL;
+        uint64_t const escapes = backslashes & ~carry.escaped;
+        uint64_t const follows_escape = ( escapes << 1 ) | carry.escaped;
+        uint64_t const odd_run_starts = escapes & ~even_bits & ~follows_escape;
+        uint64_t const runs_on_even_bits = odd_run_starts + escapes;
+        uint64_t const escaped = ( even_bits ^ ( runs_on_even_bits << 1 ) ) & follows_escape;
+        carry.escaped = runs_on_even_bits < odd_run_starts ? 1 : 0;
+        return quotes & ~escaped;
+    }
+
+    // Stores block b. quotes_prefix_xor has each bit set to the XOR of the quotes at and below
+    // it, which is the mask of the bytes in a string that started in this block.
+    inline void store_block( size_t const b, uint64_t const quotes, uint64_t const quotes_prefix_xor,
+                             uint64_t const opens, uint64_t const closes, Carry &carry, BlockBits const &out )
+    {
+        uint64_t const in_string = quotes_prefix_xor ^ carry.in_string;
+        carry.in_string = ( in_string >> 63 ) != 0 ? ~uint64_t{ 0 } : 0;
+        out.quotes[ b ] = quotes;
+        out.opens[ b ] = opens & ~in_string;
+        out.closes[ b ] = closes & ~in_string;
+    }
+
+    uint64_t prefix_xor( uint64_t bits )
+    {
+        bits ^= bits << 1;
+        bits ^= bits << 2;
+        bits ^= bits << 4;
+        bits ^= bits << 8;
+        bits ^= bits << 16;
+        bits ^= bits << 32;
+        return bits;
+    }
+
+#ifdef JSON_INDEX_X86
+    // '{' and '[' differ only in bit 5, as do '}' and ']', so setting that bit finds both with one
+    // comparison
+
+    JSON_INDEX_TARGET( "sse2" )
+    uint64_t movemask_64( __m128i const a, __m128i const b, __m128i const c, __m128i const d )
+    {
+        return uint64_t{ static_cast< uint16_t >( _mm_movemask_epi8( a ) ) } |
+               ( uint64_t{ static_cast< uint16_t >( _mm_movemask_epi8( b ) ) } << 16 ) |
+               ( uint64_t{ static_cast< uint16_t >( _mm_movemask_epi8( c ) ) } << 32 ) |
+               ( uint64_t{ static_cast< uint16_t >( _mm_movemask_epi8( d ) ) } << 48 );
+    }
+
+    JSON_INDEX_TARGET( "sse2" )
+    void index_blocks_sse2( char8_t const *const data, size_t const block_count, Carry &carry, BlockBits const out )
+    {
+        __m128i const quote = _mm_set1_epi8( '"' );
+        __m128i const backslash = _mm_set1_epi8( '\\' );
+        __m128i const open = _mm_set1_epi8( '{' );
+        __m128i const close = _mm_set1_epi8( '}' );
+        __m128i const bit5 = _mm_set1_epi8( 0x20 );
+        for ( size_t b = 0; b < block_count; ++b )
+        {
+            __m128i v[ 4 ];
+            __m128i folded[ 4 ];
+            for ( size_t i = 0; i < 4; ++i )
+            {
+                v[ i ] = _mm_loadu_si128( reinterpret_cast< __m128i const * >( data + b * block_size + i * 16 ) );
+                folded[ i ] = _mm_or_si128( v[ i ], bit5 );
+            }
+            uint64_t const quotes = find_unescaped_quotes(
+                movemask_64( _mm_cmpeq_epi8( v[ 0 ], quote ), _mm_cmpeq_epi8( v[ 1 ], quote ),
+                             _mm_cmpeq_epi8( v[ 2 ], quote ), _mm_cmpeq_epi8( v[ 3 ], quote ) ),
+                movemask_64( _mm_cmpeq_epi8( v[ 0 ], backslash ), _mm_cmpeq_epi8( v[ 1 ], backslash ),
+                             _mm_cmpeq_epi8( v[ 2 ], backslash ), _mm_cmpeq_epi8( v[ 3 ], backslash ) ),
+                carry );
+            store_block( b, quotes, prefix_xor( quotes ),
+                         movemask_64( _mm_cmpeq_epi8( folded[ 0 ], open ), _mm_cmpeq_epi8( folded[ 1 ], open ),
+                                      _mm_cmpeq_epi8( folded[ 2 ], open ), _mm_cmpeq_epi8( folded[ 3 ], open ) ),
+                         movemask_64( _mm_cmpeq_epi8( folded[ 0 ], close ), _mm_cmpeq_epi8( folded[ 1 ], close ),
+                                      _mm_cmpeq_epi8( folded[ 2 ], close ), _mm_cmpeq_epi8( folded[ 3 ], close ) ),
+                         carry, out );
+        }
+    }
+
+    // A carry-less multiply by all ones is a prefix XOR in one instruction
+    JSON_INDEX_TARGET( "pclmul" )
+    uint64_t prefix_xor_clmul( uint64_t const bits )
+    {
+        __m128i const product =
+            _mm_clmulepi64_si128( _mm_set_epi64x( 0, static_cast< int64_t >( bits ) ), _mm_set1_epi8( -1 ), 0 );
+        return static_cast< uint64_t >( _mm_cvtsi128_si64( product ) );
+    }
+
+    JSON_INDEX_TARGET( "avx2" )
+    uint64_t movemask_64( __m256i const lo, __m256i const hi )
+    {
+        return uint64_t{ static_cast< uint32_t >( _mm256_movemask_epi8( lo ) ) } |
+               ( uint64_t{ static_cast< uint32_t >( _mm256_movemask_epi8( hi ) ) } << 32 );
+    }
+
+    JSON_INDEX_TARGET( "avx2,pclmul" )
+    void index_blocks_avx2( char8_t const *const data, size_t const block_count, Carry &carry, BlockBits const out )
+    {
+        __m256i const quote = _mm256_set1_epi8( '"' );
+        __m256i const backslash = _mm256_set1_epi8( '\\' );
+        __m256i const open = _mm256_set1_epi8( '{' );
+        __m256i const close = _mm256_set1_epi8( '}' );
+        __m256i const bit5 = _mm256_set1_epi8( 0x20 );
+        for ( size_t b = 0; b < block_count; ++b )
+        {
+            __m256i const lo = _mm256_loadu_si256( reinterpret_cast< __m256i const * >( data + b * block_size ) );
+            __m256i const hi = _mm256_loadu_si256( reinterpret_cast< __m256i const * >( data + b * block_size + 32 ) );
+            __m256i const folded_lo = _mm256_or_si256( lo, bit5 );
+            __m256i const folded_hi = _mm256_or_si256( hi, bit5 );
+            uint64_t const quotes =
+                find_unescaped_quotes( movemask_64( _mm256_cmpeq_epi8( lo, quote ), _mm256_cmpeq_epi8( hi, quote ) ),
+                                       movemask_64( _mm256_cmpeq_epi8( lo, backslash ),
+                                                    _mm256_cmpeq_epi8( hi, backslash ) ),
+                                       carry );
+            store_block( b, quotes, prefix_xor_clmul( quotes ),
+                         movemask_64( _mm256_cmpeq_epi8( folded_lo, open ), _mm256_cmpeq_epi8( folded_hi, open ) ),
+                         movemask_64( _mm256_cmpeq_epi8( folded_lo, close ), _mm256_cmpeq_epi8( folded_hi, close ) ),
+                         carry, out );
+        }
+    }
+
+    JSON_INDEX_TARGET( "avx512f,avx512bw,pclmul" )
+    void index_blocks_avx512( char8_t const *const data, size_t const block_count, Carry &carry, BlockBits const out )
+    {
+        __m512i const quote = _mm512_set1_epi8( '"' );
+        __m512i const backslash = _mm512_set1_epi8( '\\' );
+        __m512i const open = _mm512_set1_epi8( '{' );
+        __m512i const close = _mm512_set1_epi8( '}' );
+        __m512i const bit5 = _mm512_set1_epi8( 0x20 );
+        for ( size_t b = 0; b < block_count; ++b )
+        {
+            __m512i const v = _mm512_loadu_si512( data + b * block_size );
+            __m512i const folded = _mm512_or_si512( v, bit5 );
+            uint64_t const quotes = find_unescaped_quotes( _mm512_cmpeq_epi8_mask( v, quote ),
+                                                           _mm512_cmpeq_epi8_mask( v, backslash ), carry );
+            store_block( b, quotes, prefix_xor_clmul( quotes ), _mm512_cmpeq_epi8_mask( folded, open ),
+                         _mm512_cmpeq_epi8_mask( folded, close ), carry, out );
+        }
+    }
+
+    // The CPU must have the instructions, and the OS must save the registers they use. Both the
+    // AVX2 and AVX-512 index paths also need PCLMULQDQ.
+#ifdef _MSC_VER
+    bool can_use_avx2()
+    {
+        std::array< int, 4 > regs = {};
+        __cpuid( regs.data(), 1 );
+        bool const has_pclmul = ( regs[ 2 ] & ( 1 << 1 ) ) != 0;
+        bool const has_osxsave = ( regs[ 2 ] & ( 1 << 27 ) ) != 0;
+        if ( !has_pclmul || !has_osxsave || ( _xgetbv( 0 ) & 0x6 ) != 0x6 )
+        {
+            return false;
+        }
+        __cpuidex( regs.data(), 7, 0 );
+        return ( regs[ 1 ] & ( 1 << 5 ) ) != 0;
+    }
+
+    bool can_use_avx512()
+    {
+        if ( !can_use_avx2() || ( _xgetbv( 0 ) & 0xe6 ) != 0xe6 )
+        {
+            return false;
+        }
+        std::array< int, 4 > regs = {};
+        __cpuidex( regs.data(), 7, 0 );
+        return ( regs[ 1 ] & ( 1 << 16 ) ) != 0 && ( regs[ 1 ] & ( 1 << 30 ) ) != 0;
+    }
+#else
+    bool can_use_avx2()
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "pclmul" );
+    }
+
+    bool can_use_avx512()
+    {
+        return can_use_avx2() && __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx512bw" );
+    }
+#endif
+
+    // Each byte is split into nibbles, which look up the keys that could have that byte with a
+    // shuffle. A key is a candidate where the lookups of all three bytes agree.
+
+    JSON_INDEX_TARGET( "avx2" )
+    __m256i key_byte_matches( __m256i const v, __m256i const low_table, __m256i const high_table )
+    {
+        __m256i const nibble = _mm256_set1_epi8( 0x0f );
+        __m256i const low = _mm256_and_si256( v, nibble );
+        __m256i const high = _mm256_and_si256( _mm256_srli_epi16( v, 4 ), nibble );
+        return _mm256_and_si256( _mm256_shuffle_epi8( low_table, low ), _mm256_shuffle_epi8( high_table, high ) );
+    }
+
+    JSON_INDEX_TARGET( "avx2" )
+    void find_key_candidates_avx2( char8_t const *const data, size_t const window_count,
+                                   JsonKeyScanner::NibbleMasks const &masks, uint64_t *const candidates )
+    {
+        __m256i low_tables[ 3 ];
+        __m256i high_tables[ 3 ];
+        for ( size_t j = 0; j < 3; ++j )
+        {
+            low_tables[ j ] =
+                _mm256_broadcastsi128_si256( _mm_loadu_si128( reinterpret_cast< __m128i const * >( masks.low[ j ].data() ) ) );
+            high_tables[ j ] = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128( reinterpret_cast< __m128i const * >( masks.high[ j ].data() ) ) );
+        }
+
+        __m256i const zero = _mm256_setzero_si256();
+        for ( size_t w = 0; w < window_count; ++w )
+        {
+            uint64_t bits = 0;
+            for ( size_t half = 0; half < 2; ++half )
+            {
+                char8_t const *const p = data + w * key_window_size + half * 32;
+                __m256i matches = zero;
+                for ( size_t j = 0; j < 3; ++j )
+                {
+                    __m256i const v = _mm256_loadu_si256( reinterpret_cast< __m256i const * >( p + j ) );
+                    __m256i const byte_matches = key_byte_matches( v, low_tables[ j ], high_tables[ j ] );
+                    matches = j == 0 ? byte_matches : _mm256_and_si256( matches, byte_matches );
+                }
+                uint32_t const no_match = static_cast< uint32_t >( _mm256_movemask_epi8( _mm256_cmpeq_epi8( matches, zero ) ) );
+                bits |= uint64_t{ ~no_match } << ( half * 32 );
+            }
+            candidates[ w ] = bits;
+        }
+    }
+
+    JSON_INDEX_TARGET( "avx512f,avx512bw" )
+    __m512i key_byte_matches( __m512i const v, __m512i const low_table, __m512i const high_table )
+    {
+        __m512i const nibble = _mm512_set1_epi8( 0x0f );
+        __m512i const low = _mm512_and_si512( v, nibble );
+        __m512i const high = _mm512_and_si512( _mm512_srli_epi16( v, 4 ), nibble );
+        return _mm512_and_si512( _mm512_shuffle_epi8( low_table, low ), _mm512_shuffle_epi8( high_table, high ) );
+    }
+
+    JSON_INDEX_TARGET( "avx512f,avx512bw" )
+    void find_key_candidates_avx512( char8_t const *const data, size_t const window_count,
+                                     JsonKeyScanner::NibbleMasks const &masks, uint64_t *const candidates )
+    {
+        __m512i low_tables[ 3 ];
+        __m512i high_tables[ 3 ];
+        // The zero-masking broadcast, as GCC 12 warns that the plain one reads an uninitialized value
+        for ( size_t j = 0; j < 3; ++j )
+        {
+            low_tables[ j ] = _mm512_maskz_broadcast_i32x4(
+                0xffff, _mm_loadu_si128( reinterpret_cast< __m128i const * >( masks.low[ j ].data() ) ) );
+            high_tables[ j ] = _mm512_maskz_broadcast_i32x4(
+                0xffff, _mm_loadu_si128( reinterpret_cast< __m128i const * >( masks.high[ j ].data() ) ) );
+        }
+
+        for ( size_t w = 0; w < window_count; ++w )
+        {
+            char8_t const *const p = data + w * key_window_size;
+            __m512i const matches = _mm512_and_si512(
+                key_byte_matches( _mm512_loadu_si512( p ), low_tables[ 0 ], high_tables[ 0 ] ),
+                _mm512_and_si512( key_byte_matches( _mm512_loadu_si512( p + 1 ), low_tables[ 1 ], high_tables[ 1 ] ),
+                                  key_byte_matches( _mm512_loadu_si512( p + 2 ), low_tables[ 2 ], high_tables[ 2 ] ) ) );
+            candidates[ w ] = _mm512_test_epi8_mask( matches, matches );
+        }
+    }
+
+    IndexBlocks select_index_blocks()
+    {
+        if ( can_use_avx512() )
+        {
+            return index_blocks_avx512;
+        }
+        if ( can_use_avx2() )
+        {
+            return index_blocks_avx2;
+        }
+        // Every x86-64 CPU has SSE2
+        return index_blocks_sse2;
+    }
+#else
+    void index_blocks_scalar( char8_t const *const data, size_t const block_count, Carry &carry, BlockBits const out )
+    {
+        for ( size_t b = 0; b < block_count; ++b )
+        {
+            uint64_t quotes = 0;
+            uint64_t backslashes = 0;
+            uint64_t opens = 0;
+            uint64_t closes = 0;
+            for ( size_t i = 0; i < block_size; ++i )
+            {
+                uint64_t const bit = uint64_t{ 1 } << i;
+                switch ( data[ b * block_size + i ] )
+                {
+                    case u8'"':
+                        quotes |= bit;
+                        break;
+                    case u8'\\':
+                        backslashes |= bit;
+                        break;
+                    case u8'{':
+                    case u8'[':
+                        opens |= bit;
+                        break;
+                    case u8'}':
+                    case u8']':
+                        closes |= bit;
+                        break;
+                    default:
+                        break;
+                }
+            }
+            quotes = find_unescaped_quotes( quotes, backslashes, carry );
+            store_block( b, quotes, prefix_xor( quotes ), opens, closes, carry, out );
+        }
+    }
+
+    IndexBlocks select_index_blocks()
+    {
+        return index_blocks_scalar;
+    }
+#endif
+
+    // Writes the depth before each block and the lowest depth in it, counting the depth before it
+    using IndexDepths = void ( * )( uint64_t const *opens, uint64_t const *closes, size_t block_count, int32_t depth,
+                                    int32_t *block_depths, int32_t *shallowest_depths );
+
+    JSON_INDEX_FORCE_INLINE
+    void index_depths_generic( uint64_t const *const opens, uint64_t const *const closes, size_t const block_count,
+                                  int32_t depth, int32_t *const block_depths, int32_t *const shallowest_depths )
+    {
+        for ( size_t b = 0; b < block_count; ++b )
+        {
+            // The depth is lowest just after a close, and not one that is straight away followed by
+            // another. The depth after each of those is found from the counts before it, which is
+            // quicker than following the depth from brace to brace.
+            uint64_t const block_opens = opens[ b ];
+            uint64_t const block_closes = closes[ b ];
+            int32_t lowest = 0;
+            for ( uint64_t remaining = block_closes & ~( block_closes >> 1 ); remaining != 0; remaining &= remaining - 1 )
+            {
+                uint64_t const to_close = remaining ^ ( remaining - 1 );
+                lowest = std::min( lowest, std::popcount( block_opens & to_close ) - std::popcount( block_closes & to_close ) );
+            }
+
+            block_depths[ b ] = depth;
+            shallowest_depths[ b ] = depth + lowest;
+            depth += std::popcount( block_opens ) - std::popcount( block_closes );
+        }
+    }
+
+#ifdef JSON_INDEX_X86
+    // Without POPCNT every count is a library call
+    JSON_INDEX_TARGET( "popcnt" )
+    void index_depths_popcnt( uint64_t const *const opens, uint64_t const *const closes, size_t const block_count,
+                              int32_t const depth, int32_t *const block_depths, int32_t *const shallowest_depths )
+    {
+        index_depths_generic( opens, closes, block_count, depth, block_depths, shallowest_depths );
+    }
+#endif
+
+    IndexDepths select_index_depths()
+    {
+#ifdef JSON_INDEX_X86
+        // Every CPU with AVX2 has POPCNT
+        if ( can_use_avx2() )
+        {
+            return index_depths_popcnt;
+        }
+#endif
+        return index_depths_generic;
+    }
+
+    IndexDepths get_index_depths()
+    {
+        static IndexDepths const index_depths = select_index_depths();
+        return index_depths;
+    }
+
+    IndexBlocks get_index_blocks()
+    {
+        static IndexBlocks const index_blocks = select_index_blocks();
+        return index_blocks;
+    }
+
+    FindKeyCandidates select_find_key_candidates()
+    {
+#ifdef JSON_INDEX_X86
+        if ( can_use_avx512() )
+        {
+            return find_key_candidates_avx512;
+        }
+        if ( can_use_avx2() )
+        {
+            return find_key_candidates_avx2;
+        }
+#endif
+        return find_key_candidates_scalar;
+    }
+
+    FindKeyCandidates get_find_key_candidates()
+    {
+        static FindKeyCandidates const find_key_candidates = select_find_key_candidates();
+        return find_key_candidates;
+    }
+
+    // The lowest set bit
+    uint64_t lowest_bit( uint64_t const bits )
+    {
+        return bits & ( ~bits + 1 );
+    }
+
+    // The highest set bit, bits must not be 0
+    uint64_t highest_bit( uint64_t const bits )
+    {
+        return uint64_t{ 1 } << ( 63 - std::countl_zero( bits ) );
+    }
+}
+
+void JsonIndex::reserve( size_t const json_size )
+{
+    size_t const block_count = ( json_size + block_size - 1 ) / block_size;
+    quote_bits.reserve( block_count );
+    open_bits.reserve( block_count );
+    close_bits.reserve( block_count );
+    block_depths.reserve( block_count );
+    shallowest_depths[ 0 ].reserve( block_count );
+}
+
+void JsonIndex::clear()
+{
+    indexed_text = {};
+    quote_bits.clear();
+    open_bits.clear();
+    close_bits.clear();
+    block_depths.clear();
+    for ( std::vector< int32_t > &level : shallowest_depths )
+    {
+        level.clear();
+    }
+    escaped_carry = 0;
+    in_string_carry = 0;
+    complete = false;
+}
+
+void JsonIndex::append( std::u8string_view const json, bool const is_complete )
+{
+    assert( !complete && json.size() >= indexed_text.size() );
+
+    size_t const first_block = quote_bits.size();
+    size_t const whole_block_count = json.size() / block_size;
+    size_t const block_count = is_complete ? ( json.size() + block_size - 1 ) / block_size : whole_block_count;
+    if ( block_count > first_block )
+    {
+        quote_bits.resize( block_count );
+        open_bits.resize( block_count );
+        close_bits.resize( block_count );
+        block_depths.resize( block_count );
+        shallowest_depths[ 0 ].resize( block_count );
+        auto const bits_from = [ & ]( size_t const b ) {
+            return BlockBits{ quote_bits.data() + b, open_bits.data() + b, close_bits.data() + b };
+        };
+
+        IndexBlocks const index_blocks = get_index_blocks();
+        Carry carry{ escaped_carry, in_string_carry };
+        for ( size_t b = first_block; b < whole_block_count; b += index_chunk_size )
+        {
+            size_t const chunk_block_count = std::min( index_chunk_size, whole_block_count - b );
+            index_blocks( json.data() + b * block_size, chunk_block_count, carry, bits_from( b ) );
+            index_depths( b, chunk_block_count );
+        }
+        if ( block_count > whole_block_count )
+        {
+            // The last part block is copied so the SIMD loads do not read past the end
+            std::array< char8_t, block_size > last_block;
+            last_block.fill( u8' ' );
+            std::copy( json.begin() + static_cast< ptrdiff_t >( whole_block_count * block_size ), json.end(),
+                       last_block.begin() );
+            index_blocks( last_block.data(), 1, carry, bits_from( whole_block_count ) );
+            index_depths( whole_block_count, 1 );
+        }
+        escaped_carry = carry.escaped;
+        in_string_carry = carry.in_string;
+        index_depth_levels( first_block );
+    }
+
+    indexed_text = json.substr( 0, is_complete ? json.size() : whole_block_count * block_size );
+    complete = is_complete;
+}
+
+size_t JsonIndex::find_quote( size_t const pos ) const
+{
+    if ( pos >= indexed_text.size() )
+    {
+        return npos;
+    }
+
+    size_t b = pos / block_size;
+    uint64_t quotes = quote_bits[ b ] & ( ~uint64_t{ 0 } << ( pos % block_size ) );
+    while ( quotes == 0 )
+    {
+        if ( ++b == quote_bits.size() )
+        {
+            return npos;
+        }
+        quotes = quote_bits[ b ];
+    }
+    return b * block_size + static_cast< size_t >( std::countr_zero( quotes ) );
+}
+
+size_t JsonIndex::rfind_quote( size_t const pos ) const
+{
+    if ( indexed_text.empty() )
+    {
+        return npos;
+    }
+
+    size_t const last = std::min( pos, indexed_text.size() - 1 );
+    size_t b = last / block_size;
+    uint64_t quotes = quote_bits[ b ] & ( ~uint64_t{ 0 } >> ( block_size - 1 - last % block_size ) );
+    while ( quotes == 0 )
+    {
+        if ( b-- == 0 )
+        {
+            return npos;
+        }
+        quotes = quote_bits[ b ];
+    }
+    return b * block_size + block_size - 1 - static_cast< size_t >( std::countl_zero( quotes ) );
+}
+
+size_t JsonIndex::find_unmatched_close( size_t const pos ) const
+{
+    if ( pos >= indexed_text.size() )
+    {
+        return npos;
+    }
+
+    // The close that ends the object is the first one after which the depth is less than before
+    // pos. In pos's own block only the depth relative to pos is needed.
+    size_t const b = pos / block_size;
+    uint64_t const before_pos = ( uint64_t{ 1 } << ( pos % block_size ) ) - 1;
+    if ( size_t const close = find_shallower_close( b, ~before_pos, 0, 0 ); close != npos )
+    {
+        return close;
+    }
+    int32_t const depth = get_depth( b, before_pos );
+    size_t const close_block = find_shallower_block( b + 1, depth );
+    return close_block == npos ? npos
+                               : find_shallower_close( close_block, ~uint64_t{ 0 }, block_depths[ close_block ], depth );
+}
+
+size_t JsonIndex::rfind_unmatched_open( size_t const pos ) const
+{
+    if ( indexed_text.empty() )
+    {
+        return npos;
+    }
+
+    // The open that starts the object is the last one before which the depth is less than at pos.
+    // In pos's own block only the depth relative to pos is needed.
+    size_t const last = std::min( pos, indexed_text.size() - 1 );
+    size_t const b = last / block_size;
+    uint64_t const to_last = ~uint64_t{ 0 } >> ( block_size - 1 - last % block_size );
+    if ( size_t const open = rfind_shallower_open( b, to_last, 0, 0 ); open != npos )
+    {
+        return open;
+    }
+    int32_t const depth = get_depth( b, to_last );
+    size_t const open_block = rfind_shallower_block( b, depth );
+    return open_block == npos
+               ? npos
+               : rfind_shallower_open( open_block, ~uint64_t{ 0 }, block_depths[ open_block + 1 ], depth );
+}
+
+void JsonIndex::index_depths( size_t const first_block, size_t const block_count )
+{
+    int32_t const depth = first_block == 0 ? 0 : get_depth( first_block - 1, ~uint64_t{ 0 } );
+    get_index_depths()( open_bits.data() + first_block, close_bits.data() + first_block, block_count, depth,
+                        block_depths.data() + first_block, shallowest_depths[ 0 ].data() + first_block );
+}
+
+void JsonIndex::index_depth_levels( size_t const first_block )
+{
+    // Only the entries over the new blocks change, unless the level is new
+    size_t first_entry = first_block;
+    for ( size_t level = 1; shallowest_depths[ level - 1 ].size() > depth_level_fanout; ++level )
+    {
+        if ( level == shallowest_depths.size() )
+        {
+            shallowest_depths.emplace_back();
+        }
+        std::vector< int32_t > const &below = shallowest_depths[ level - 1 ];
+        std::vector< int32_t > &entries = shallowest_depths[ level ];
+
+        first_entry = std::min( first_entry / depth_level_fanout, entries.size() );
+        entries.resize( ( below.size() + depth_level_fanout - 1 ) / depth_level_fanout );
+        for ( size_t e = first_entry; e < entries.size(); ++e )
+        {
+            auto const first_below = below.begin() + static_cast< ptrdiff_t >( e * depth_level_fanout );
+            entries[ e ] = *std::min_element(
+                first_below, first_below + static_cast< ptrdiff_t >(
+                                               std::min( depth_level_fanout, below.size() - e * depth_level_fanout ) ) );
+        }
+    }
+}
+
+int32_t JsonIndex::get_depth( size_t const b, uint64_t const mask ) const
+{
+    return block_depths[ b ] + std::popcount( open_bits[ b ] & mask ) - std::popcount( close_bits[ b ] & mask );
+}
+
+size_t JsonIndex::find_shallower_block( size_t const first_block, int32_t const depth ) const
+{
+    // Climb the tree until there is a lower entry after first_block in the same group, then go
+    // down to the first lower entry under it
+    size_t level = 0;
+    size_t e = first_block;
+    for ( ;; )
+    {
+        std::vector< int32_t > const &entries = shallowest_depths[ level ];
+        size_t const group_end = std::min( ( e / depth_level_fanout + 1 ) * depth_level_fanout, entries.size() );
+        while ( e < group_end && entries[ e ] >= depth )
+        {
+            ++e;
+        }
+        if ( e < group_end )
+        {
+            break;
+        }
+        if ( group_end == entries.size() )
+        {
+            return npos;
+        }
+        e = group_end / depth_level_fanout;
+        ++level;
+    }
+
+    while ( level != 0 )
+    {
+        std::vector< int32_t > const &entries = shallowest_depths[ --level ];
+        e *= depth_level_fanout;
+        while ( entries[ e ] >= depth )
+        {
+            ++e;
+        }
+    }
+    return e;
+}
+
+size_t JsonIndex::rfind_shallower_block( size_t const block_end, int32_t const depth ) const
+{
+    // As find_shallower_block, but towards the start. e is one past the next entry to look at.
+    size_t level = 0;
+    size_t e = block_end;
+    for ( ;; )
+    {
+        if ( e == 0 )
+        {
+            return npos;
+        }
+        std::vector< int32_t > const &entries = shallowest_depths[ level ];
+        size_t const group_start = ( e - 1 ) / depth_level_fanout * depth_level_fanout;
+        while ( e > group_start && entries[ e - 1 ] >= depth )
+        {
+            --e;
+        }
+        if ( e > group_start )
+        {
+            break;
+        }
+        e = group_start / depth_level_fanout;
+        ++level;
+    }
+
+    while ( level != 0 )
+    {
+        std::vector< int32_t > const &entries = shallowest_depths[ --level ];
+        e = std::min( e * depth_level_fanout, entries.size() );
+        while ( entries[ e - 1 ] >= depth )
+        {
+            --e;
+        }
+    }
+    return e - 1;
+}
+
+size_t JsonIndex::find_shallower_close( size_t const b, uint64_t const mask, int32_t const start_depth,
+                                        int32_t const depth ) const
+{
+    uint64_t const opens = open_bits[ b ] & mask;
+    uint64_t const closes = close_bits[ b ] & mask;
+    int32_t d = start_depth;
+    for ( uint64_t braces = opens | closes; braces != 0; braces &= braces - 1 )
+    {
+        uint64_t const brace = lowest_bit( braces );
+        if ( ( closes & brace ) == 0 )
+        {
+            ++d;
+        }
+        else if ( --d < depth )
+        {
+            return b * block_size + static_cast< size_t >( std::countr_zero( brace ) );
+        }
+    }
+    return npos;
+}
+
+size_t JsonIndex::rfind_shallower_open( size_t const b, uint64_t const mask, int32_t const end_depth,
+                                        int32_t const depth ) const
+{
+    uint64_t const opens = open_bits[ b ] & mask;
+    uint64_t const closes = close_bits[ b ] & mask;
+    int32_t d = end_depth;
+    for ( uint64_t braces = opens | closes; braces != 0; )
+    {
+        uint64_t const brace = highest_bit( braces );
+        braces ^= brace;
+        if ( ( opens & brace ) == 0 )
+        {
+            ++d;
+        }
+        else if ( --d < depth )
+        {
+            return b * block_size + static_cast< size_t >( std::countr_zero( brace ) );
+        }
+    }
+    return npos;
+}
+
+//-----------------------------------------------------------------------------
+// JsonKeyScanner
+//-----------------------------------------------------------------------------
+
+JsonKeyScanner::JsonKeyScanner( std::span< std::u8string_view const > const keys )
+{
+    assert( keys.size() <= max_key_count );
+    for ( size_t k = 0; k < keys.size(); ++k )
+    {
+        std::u8string_view const key = keys[ k ];
+        assert( key.size() >= 3 );
+        key_patterns.push_back( std::u8string( key ) + u8"\":" );
+        max_pattern_size = std::max( max_pattern_size, key_patterns.back().size() );
+        for ( size_t j = 0; j < 3; ++j )
+        {
+            masks.low[ j ][ key[ j ] & 0x0f ] |= static_cast< uint8_t >( 1 << k );
+            masks.high[ j ][ key[ j ] >> 4 ] |= static_cast< uint8_t >( 1 << k );
+        }
+    }
+}
+
+void JsonKeyScanner::scan( JsonIndex const &json )
+{
+    std::u8string_view const text = json.text();
+
+    // A key near the end of a partial document may not have arrived in full
+    scan_until( json, json.is_complete() ? text.size() : text.size() - std::min( text.size(), max_pattern_size ) );
+}
+
+void JsonKeyScanner::scan( JsonIndex const &json, size_t const begin, size_t const end )
+{
+    assert( json.is_complete() );
+    scan_start = std::max( scan_start, begin );
+    scan_until( json, end );
+}
+
+void JsonKeyScanner::scan_until( JsonIndex const &json, size_t const end )
+{
+    // The candidate search reads three bytes at each position
+    std::u8string_view const text = json.text();
+    size_t const scan_end = std::min( end, text.size() - std::min( text.size(), size_t{ 2 } ) );
+
+    FindKeyCandidates const find_key_candidates = get_find_key_candidates();
+    std::array< uint64_t, key_window_batch_size > candidates;
+    size_t pos = scan_start;
+    while ( scan_end >= pos + key_window_size )
+    {
+        size_t const window_count = std::min( key_window_batch_size, ( scan_end - pos ) / key_window_size );
+        find_key_candidates( text.data() + pos, window_count, masks, candidates.data() );
+        for ( size_t w = 0; w < window_count; ++w )
+        {
+            for ( uint64_t bits = candidates[ w ]; bits != 0; bits &= bits - 1 )
+            {
+                size_t const candidate = pos + w * key_window_size + static_cast< size_t >( std::countr_zero( bits ) );
+                check_candidate( json, candidate, key_byte_mask( masks, 0, text[ candidate ] ) &
+                                                      key_byte_mask( masks, 1, text[ candidate + 1 ] ) &
+                                                      key_byte_mask( masks, 2, text[ candidate + 2 ] ) );
+            }
+        }
+        pos += window_count * key_window_size;
+    }
+    for ( ; pos < scan_end; ++pos )
+    {
+        if ( uint8_t const key_mask = key_byte_mask( masks, 0, text[ pos ] ) & key_byte_mask( masks, 1, text[ pos + 1 ] ) &
+                                      key_byte_mask( masks, 2, text[ pos + 2 ] );
+             key_mask != 0 )
+        {
+            check_candidate( json, pos, key_mask );
+        }
+    }
+    scan_start = std::max( scan_start, pos );
+}
+
+void JsonKeyScanner::check_candidate( JsonIndex const &json, size_t const pos, uint8_t const key_mask )
+{
+    // A key is a string followed by a colon. Only an unescaped quote can start one, and as the
+    // key patterns end with a quote no two of them can match at the same position.
+    std::u8string_view const text = json.text();
+    if ( pos == 0 || !json.is_quote( pos - 1 ) )
+    {
+        return;
+    }
+    for ( uint8_t keys = key_mask; keys != 0; keys &= static_cast< uint8_t >( keys - 1 ) )
+    {
+        size_t const key = static_cast< size_t >( std::countr_zero( keys ) );
+        if ( text.substr( pos, key_patterns[ key ].size() ) == key_patterns[ key ] )
+        {
+            size_t const object_offset = json.rfind_unmatched_open( pos - 1 );
+            bool const in_object = object_offset != JsonIndex::npos && text[ object_offset ] == u8'{';
+            hits.push_back( JsonKeyHit{ key, pos - 1, in_object ? object_offset : JsonIndex::npos } );
+            return;
+        }
+    }
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "Common.h"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace save_fixer
+{
+    // Bitmaps of the structure of a JSON document, one bit for each byte: the quotes that start
+    // and end strings, and the braces and brackets that are not in a string. They are built 64
+    // bytes at a time with SIMD instructions, so finding the end of a string or an object is a
+    // walk over the bitmaps rather than over every byte.
+    //
+    // The depth of nesting is summarised in a tree of minimums over the blocks, so the object or
+    // array around any offset is found in O(log n) however far away its braces are.
+    class JsonIndex
+    {
+    public:
+        static constexpr size_t npos = std::u8string_view::npos;
+
+        JsonIndex() = default;
+        explicit JsonIndex( std::u8string_view const json ) { append( json, true ); }
+
+        // Allocates the index for a document of json_size bytes, so appending does not reallocate
+        void reserve( size_t json_size );
+
+        // Empties the index so another document can be indexed, but keeps the memory
+        void clear();
+
+        // Indexes more of a document that is still arriving. json must start with the text given
+        // to earlier calls. Only whole blocks of 64 bytes are indexed until is_complete.
+        void append( std::u8string_view json, bool is_complete );
+
+        // The part of the document that has been indexed
+        std::u8string_view text() const { return indexed_text; }
+        bool is_complete() const { return complete; }
+
+        // True if there is a quote at pos that is not escaped
+        bool is_quote( size_t const pos ) const
+        {
+            return pos < indexed_text.size() && ( ( quote_bits[ pos / 64 ] >> ( pos % 64 ) ) & 1 ) != 0;
+        }
+
+        // The first quote at or after pos that is not escaped, or npos
+        size_t find_quote( size_t pos ) const;
+
+        // The last quote at or before pos that is not escaped, or npos
+        size_t rfind_quote( size_t pos ) const;
+
+        // The first closing brace or bracket at or after pos that is not closed out by an opening
+        // one after pos, which ends the object or array that pos is in. Returns npos if there is
+        // none. Brace and bracket are not told apart. O(log n).
+        size_t find_unmatched_close( size_t pos ) const;
+
+        // The last opening brace or bracket at or before pos that is not closed before pos, which
+        // starts the object or array that pos is in. Returns npos if there is none. O(log n).
+        size_t rfind_unmatched_open( size_t pos ) const;
+
+    private:
+        void index_depths( size_t first_block, size_t block_count );
+        void index_depth_levels( size_t first_block );
+
+        // The depth after the part of block b in mask, which must cover the start of the block
+        int32_t get_depth( size_t b, uint64_t mask ) const;
+
+        // The first block at or after first_block, or the last block before block_end, in which the
+        // depth goes below depth. npos if there is none.
+        size_t find_shallower_block( size_t first_block, int32_t depth ) const;
+        size_t rfind_shallower_block( size_t block_end, int32_t depth ) const;
+
+        // The first close in the part of block b in mask after which the depth is below depth, given
+        // the depth before that part. mask must cover the end of the block.
+        size_t find_shallower_close( size_t b, uint64_t mask, int32_t start_depth, int32_t depth ) const;
+
+        // The last open in the part of block b in mask before which the depth is below depth, given
+        // the depth after that part. mask must cover the start of the block.
+        size_t rfind_shallower_open( size_t b, uint64_t mask, int32_t end_depth, int32_t depth ) const;
+
+        std::u8string_view indexed_text;
+
+        // One word for each 64 bytes
+        std::vector< uint64_t > quote_bits;    // Quotes that start or end a string
+        std::vector< uint64_t > open_bits;     // '{' and '[' that are not in a string
+        std::vector< uint64_t > close_bits;    // '}' and ']' that are not in a string
+
+        // The depth is the number of opens before a byte less the number of closes, counting the
+        // byte. block_depths is the depth before each block. shallowest_depths[ 0 ] is the lowest
+        // depth in each block, counting the depth before it, and each level above has the lowest
+        // of every 64 entries in the level below, up to a level of at most 64 entries.
+        std::vector< int32_t > block_depths;
+        std::vector< std::vector< int32_t > > shallowest_depths = std::vector< std::vector< int32_t > >( 1 );
+
+        // Carried from the last indexed block to the next
+        uint64_t escaped_carry = 0;      // 1 if the next block starts with an escaped byte
+        uint64_t in_string_carry = 0;    // All ones if the next block starts in a string
+        bool complete = false;
+    };
+
+    // Where a JsonKeyScanner found a key
+    struct JsonKeyHit
+    {
+        size_t key;              // The index of the key in the scanner's list
+        size_t offset;           // The key's opening quote
+        size_t object_offset;    // The opening brace of the object the key is in, or npos
+    };
+
+    // Finds every use of a few keys in a JSON document in one pass. Candidates are found with SIMD
+    // by the first three bytes of each key, in the manner of the Teddy algorithm, then checked in
+    // full, so the document is only read once however many keys there are.
+    class JsonKeyScanner
+    {
+    public:
+        static constexpr size_t max_key_count = 8;
+
+        // There can be up to max_key_count keys. Each must be at least 3 bytes and contain nothing
+        // that would be escaped in JSON.
+        explicit JsonKeyScanner( std::span< std::u8string_view const > keys );
+
+        // Scans the part of the document that has been indexed since the last call
+        void scan( JsonIndex const &json );
+
+        // Scans for the keys that start in [begin, end) of a complete document, so that its parts
+        // can be scanned on different threads
+        void scan( JsonIndex const &json, size_t begin, size_t end );
+
+        // The keys that have been found, in the order they are in the document
+        std::vector< JsonKeyHit > const &get_hits() const { return hits; }
+
+        // The masks of the keys that each nibble of the first three bytes of a key can belong to
+        struct NibbleMasks
+        {
+            std::array< std::array< uint8_t, 16 >, 3 > low;
+            std::array< std::array< uint8_t, 16 >, 3 > high;
+        };
+
+    private:
+        void scan_until( JsonIndex const &json, size_t end );
+        void check_candidate( JsonIndex const &json, size_t pos, uint8_t key_mask );
+
+        std::vector< std::u8string > key_patterns;    // Each key followed by '":'
+        size_t max_pattern_size = 0;
+        NibbleMasks masks = {};
+
+        size_t scan_start = 0;
+        std::vector< JsonKeyHit > hits;
+    };
+}
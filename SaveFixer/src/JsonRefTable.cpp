@@ -0,0 +1,239 @@
+#include "JsonRefTable.h"
+
+#include "JsonIndex.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <functional>
+#include <limits>
+#include <new>
+#include <optional>
+#include <utility>
+
+using namespace save_fixer;
+
+namespace
+{
+    constexpr std::array< std::u8string_view, 2 > ref_keys = { u8"$id", u8"$ref" };
+    constexpr size_t id_key = 0;
+
+    // The document is scanned in parts of at least this size, a few for each thread so that the
+    // threads finish at about the same time
+    constexpr size_t min_part_size = 1024 * 1024;
+    constexpr size_t parts_per_thread = 4;
+
+    constexpr size_t shard_bits = 6;
+    constexpr size_t shard_count = size_t{ 1 } << shard_bits;
+
+    // The top bits of an id's hash pick its shard and the low bits its slot in the shard
+    size_t get_shard_index( size_t const hash )
+    {
+        return hash >> ( std::numeric_limits< size_t >::digits - shard_bits );
+    }
+
+    struct FoundKey
+    {
+        std::u8string_view id;
+        size_t hash;
+        size_t key_offset;               // The key's opening quote
+        JsonRefTable::Object object;    // The object the key is in, only the offset is known for a ref
+    };
+
+    // The keys found in one part of the document, split by shard
+    struct Part
+    {
+        std::array< std::vector< FoundKey >, shard_count > ids;
+        std::array< std::vector< FoundKey >, shard_count > refs;
+        std::vector< size_t > broken_keys;
+        bool failed = false;
+    };
+
+    void scan_part( JsonIndex const &json, size_t const begin, size_t const end, Part &part )
+    {
+        // Look for:
+        //   {"$id":"<id>",...} and {"$ref":"<id>"}
+
+        std::u8string_view const text = json.text();
+        JsonKeyScanner scanner( ref_keys );
+        scanner.scan( json, begin, end );
+        for ( JsonKeyHit const &hit : scanner.get_hits() )
+        {
+            bool const is_id = ( hit.key == id_key );
+            size_t const value_offset = hit.offset + ref_keys[ hit.key ].size() + 3;
+            size_t const value_end = ( value_offset < text.size() && text[ value_offset ] == u8'"' )
+                                         ? json.find_quote( value_offset + 1 )
+                                         : JsonIndex::npos;
+            size_t const object_end = ( is_id && hit.object_offset != JsonIndex::npos )
+                                          ? json.find_unmatched_close( hit.offset )
+                                          : JsonIndex::npos;
+            if ( value_end == JsonIndex::npos || hit.object_offset == JsonIndex::npos ||
+                 ( is_id && ( object_end == JsonIndex::npos || text[ object_end ] != u8'}' ) ) )
+            {
+                part.broken_keys.push_back( hit.offset );
+                continue;
+            }
+
+            std::u8string_view const id = text.substr( value_offset + 1, value_end - value_offset - 1 );
+            size_t const hash = std::hash< std::u8string_view >{}( id );
+            ( is_id ? part.ids : part.refs )[ get_shard_index( hash ) ].push_back(
+                FoundKey{ id, hash, hit.offset, JsonRefTable::Object{ hit.object_offset, object_end } } );
+        }
+    }
+}
+
+JsonRefTable::JsonRefTable( JsonIndex const &json, ThreadPool *const pool ) : shards( shard_count )
+{
+    std::optional< ThreadPool > local_pool;
+    ThreadPool &scan_pool = ( pool != nullptr ) ? *pool : local_pool.emplace();
+
+    size_t const size = json.text().size();
+    size_t const part_count = std::clamp( size / min_part_size, size_t{ 1 }, scan_pool.thread_count() * parts_per_thread );
+    size_t const part_size = size / part_count;
+    std::vector< Part > parts( part_count );
+    scan_pool.parallel_for( part_count, [ & ]( size_t const i ) {
+        try
+        {
+            scan_part( json, i * part_size, ( i + 1 == part_count ) ? size : ( i + 1 ) * part_size, parts[ i ] );
+        }
+        catch ( std::bad_alloc const & )
+        {
+            parts[ i ].failed = true;
+        }
+    } );
+
+    // Each shard takes its ids and then its refs from every part, in the order they are in the
+    // document. The refs are counted for each id first, so that the refs to an id are together.
+    std::vector< std::vector< size_t > > shard_broken_keys( shard_count );
+    std::vector< char > shard_failed( shard_count, false );
+    scan_pool.parallel_for( shard_count, [ & ]( size_t const s ) {
+        try
+        {
+            Shard &shard = shards[ s ];
+            size_t shard_id_count = 0;
+            size_t shard_ref_count = 0;
+            for ( Part const &part : parts )
+            {
+                shard_id_count += part.ids[ s ].size();
+                shard_ref_count += part.refs[ s ].size();
+            }
+
+            // At most half the slots are used, so probes are short
+            shard.entries.reserve( shard_id_count );
+            shard.slots.assign( std::bit_ceil( shard_id_count * 2 + 1 ), 0 );
+            for ( Part const &part : parts )
+            {
+                for ( FoundKey const &found : part.ids[ s ] )
+                {
+                    size_t const slot = shard.find_slot( found.id, found.hash );
+                    if ( shard.slots[ slot ] != 0 )
+                    {
+                        shard_broken_keys[ s ].push_back( found.key_offset );
+                        continue;
+                    }
+                    shard.entries.push_back( Entry{ found.id, found.object } );
+                    shard.slots[ slot ] = static_cast< uint32_t >( shard.entries.size() );
+                }
+            }
+
+            std::vector< std::pair< uint32_t, size_t > > resolved_refs;
+            resolved_refs.reserve( shard_ref_count );
+            for ( Part const &part : parts )
+            {
+                for ( FoundKey const &found : part.refs[ s ] )
+                {
+                    uint32_t const entry = shard.slots[ shard.find_slot( found.id, found.hash ) ];
+                    if ( entry == 0 )
+                    {
+                        shard_broken_keys[ s ].push_back( found.key_offset );
+                        continue;
+                    }
+                    ++shard.entries[ entry - 1 ].ref_count;
+                    resolved_refs.emplace_back( entry - 1, found.object.offset );
+                }
+            }
+
+            size_t next_ref = 0;
+            for ( Entry &entry : shard.entries )
+            {
+                entry.first_ref = next_ref;
+                next_ref += entry.ref_count;
+                entry.ref_count = 0;
+            }
+            shard.refs.resize( next_ref );
+            for ( auto const &[ entry_index, ref_offset ] : resolved_refs )
+            {
+                Entry &entry = shard.entries[ entry_index ];
+                shard.refs[ entry.first_ref + entry.ref_count++ ] = ref_offset;
+            }
+        }
+        catch ( std::bad_alloc const & )
+        {
+            shard_failed[ s ] = true;
+        }
+    } );
+
+    if ( std::any_of( parts.begin(), parts.end(), []( Part const &part ) { return part.failed; } ) ||
+         std::find( shard_failed.begin(), shard_failed.end(), char{ true } ) != shard_failed.end() )
+    {
+        throw std::bad_alloc();
+    }
+
+    for ( Part const &part : parts )
+    {
+        broken_keys.insert( broken_keys.end(), part.broken_keys.begin(), part.broken_keys.end() );
+    }
+    for ( std::vector< size_t > const &keys : shard_broken_keys )
+    {
+        broken_keys.insert( broken_keys.end(), keys.begin(), keys.end() );
+    }
+    std::sort( broken_keys.begin(), broken_keys.end() );
+
+    for ( Shard const &shard : shards )
+    {
+        object_count += shard.entries.size();
+        ref_count += shard.refs.size();
+    }
+}
+
+size_t JsonRefTable::Shard::find_slot( std::u8string_view const id, size_t const hash ) const
+{
+    size_t const mask = slots.size() - 1;
+    for ( size_t slot = hash & mask;; slot = ( slot + 1 ) & mask )
+    {
+        if ( slots[ slot ] == 0 || entries[ slots[ slot ] - 1 ].id == id )
+        {
+            return slot;
+        }
+    }
+}
+
+JsonRefTable::Entry const *JsonRefTable::Shard::find( std::u8string_view const id, size_t const hash ) const
+{
+    if ( slots.empty() )
+    {
+        return nullptr;
+    }
+    uint32_t const entry = slots[ find_slot( id, hash ) ];
+    return ( entry != 0 ) ? &entries[ entry - 1 ] : nullptr;
+}
+
+JsonRefTable::Object const *JsonRefTable::find_object( std::u8string_view const id ) const
+{
+    size_t const hash = std::hash< std::u8string_view >{}( id );
+    Entry const *const entry = shards[ get_shard_index( hash ) ].find( id, hash );
+    return ( entry != nullptr ) ? &entry->object : nullptr;
+}
+
+std::span< size_t const > JsonRefTable::find_refs( std::u8string_view const id ) const
+{
+    size_t const hash = std::hash< std::u8string_view >{}( id );
+    Shard const &shard = shards[ get_shard_index( hash ) ];
+    Entry const *const entry = shard.find( id, hash );
+    if ( entry == nullptr )
+    {
+        return {};
+    }
+    return std::span( shard.refs ).subspan( entry->first_ref, entry->ref_count );
+}
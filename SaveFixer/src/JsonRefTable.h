@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Common.h"
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace save_fixer
+{
+    class JsonIndex;
+    class ThreadPool;
+
+    // The object graph of a JSON document that preserves references the way Json.NET does: an
+    // object can have an "$id" key, and {"$ref":"<id>"} stands for that object anywhere else it is
+    // used. Every id is mapped to its object and to the refs to it, so looking either up is O(1)
+    // rather than a search of the document. The ids are views of the document's text.
+    class JsonRefTable
+    {
+    public:
+        struct Object
+        {
+            size_t offset;    // The opening brace
+            size_t end;       // The closing brace
+        };
+
+        // Finds every "$id" and "$ref" of a complete document in one pass, with the parts of the
+        // document scanned on the pool, or on a new pool if none is given
+        explicit JsonRefTable( JsonIndex const &json, ThreadPool *pool = nullptr );
+
+        // The object with the id, or nullptr if there is none
+        Object const *find_object( std::u8string_view id ) const;
+
+        // The opening braces of the refs to the object with the id, in the order they are in the
+        // document
+        std::span< size_t const > find_refs( std::u8string_view id ) const;
+
+        size_t get_object_count() const { return object_count; }
+        size_t get_ref_count() const { return ref_count; }
+
+        // The offsets of the "$id" and "$ref" keys that break the graph, in order: refs to an id
+        // that no object has, ids that an earlier object already has, and either key without a
+        // string value or outside an object
+        std::span< size_t const > get_broken_keys() const { return broken_keys; }
+        bool all_refs_resolve() const { return broken_keys.empty(); }
+
+    private:
+        struct Entry
+        {
+            std::u8string_view id;
+            Object object;
+            size_t first_ref = 0;
+            size_t ref_count = 0;
+        };
+
+        // Each id belongs to one shard by the top bits of its hash, so the shards can be built in
+        // parallel. A shard is an open addressing hash table over its entries, in document order.
+        struct Shard
+        {
+            std::vector< Entry > entries;
+            std::vector< uint32_t > slots;    // One more than the index of an entry, or 0 if empty
+            std::vector< size_t > refs;
+
+            // The slot of the entry with the id, or the empty slot it would go in
+            size_t find_slot( std::u8string_view id, size_t hash ) const;
+            Entry const *find( std::u8string_view id, size_t hash ) const;
+        };
+
+        std::vector< Shard > shards;
+        std::vector< size_t > broken_keys;
+        size_t object_count = 0;
+        size_t ref_count = 0;
+    };
+}
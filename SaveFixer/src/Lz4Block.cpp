@@ -0,0 +1,1461 @@
+#include "Lz4Block.h"
+
+#include "ThreadPool.h"
+
+#include "lz4.h"
+
+#include <algorithm>
+#include <array>
+#include <assert.h>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+using namespace save_fixer;
+
+// An LZ4 block is a list of sequences. Each sequence is a token, some literal bytes that are
+// copied to the output, then an offset and length of a match that copies earlier output. The last
+// sequence has only literals. Matches reach at most 64KB back, so once the output is more than
+// 64KB past an edit the original sequences describe the new data exactly, only shifted if the
+// edit changed the size of the data.
+//
+// The original sequences are walked in order. A sequence is copied as it is if neither its own
+// bytes nor the bytes its match copies were edited, and no edit between the two changed the
+// distance between them. Runs of the other sequences are compressed again from the new data with
+// the 64KB before them as a dictionary. LZ4 always ends a block with literals, so the literals at
+// the end of each compressed run are held back and written in front of the next match.
+
+namespace
+{
+    constexpr size_t min_match_size = 4;
+    constexpr size_t max_match_offset = 65535;
+    constexpr size_t max_dictionary_size = 64 * 1024;
+    constexpr unsigned length_mask = 15;
+
+    // A match must start at least 12 bytes before the end of a block, and the last 5 bytes are
+    // always literals
+    constexpr size_t min_match_distance_from_end = 12;
+    constexpr size_t min_last_literals = 5;
+
+    // Large enough that the chunk boundaries cost almost nothing in compression ratio
+    constexpr size_t parallel_chunk_size = 1024 * 1024;
+
+    // How much Lz4StreamDecompressor decompresses at a time, after its 64KB window
+    constexpr size_t stream_piece_size = 64 * 1024;
+
+    // LZ4 decompresses a block that ends in the middle of a sequence's literals as long as there
+    // are enough of them to meet its rules for the end of a block
+    constexpr size_t min_slice_end_literal_size = 16;
+
+    struct Sequence
+    {
+        size_t literal_size;
+        size_t match_offset;      // 0 for the last sequence
+        size_t match_size;
+    };
+
+    class SequenceReader
+    {
+    public:
+        explicit SequenceReader( std::span< std::byte const > b ) : block( b ) {}
+
+        size_t position() const { return pos; }
+        bool at_end() const { return pos == block.size(); }
+
+        // Where the literals of the last sequence read end
+        size_t literals_end() const { return last_literals_end; }
+
+        // Returns nullopt if the block is not valid
+        std::optional< Sequence > next()
+        {
+            if ( pos >= block.size() )
+            {
+                return std::nullopt;
+            }
+            unsigned const token = std::to_integer< unsigned >( block[ pos++ ] );
+
+            Sequence seq;
+            if ( !read_length( token >> 4, seq.literal_size ) || seq.literal_size > block.size() - pos )
+            {
+                return std::nullopt;
+            }
+            pos += seq.literal_size;
+            last_literals_end = pos;
+
+            if ( pos == block.size() )
+            {
+                seq.match_offset = 0;
+                seq.match_size = 0;
+                return seq;
+            }
+
+            if ( block.size() - pos < 2 )
+            {
+                return std::nullopt;
+            }
+            seq.match_offset = std::to_integer< size_t >( block[ pos ] ) |
+                               ( std::to_integer< size_t >( block[ pos + 1 ] ) << 8 );
+            pos += 2;
+            if ( seq.match_offset == 0 || !read_length( token & length_mask, seq.match_size ) )
+            {
+                return std::nullopt;
+            }
+            seq.match_size += min_match_size;
+            return seq;
+        }
+
+    private:
+        bool read_length( unsigned const nibble, size_t &length )
+        {
+            length = nibble;
+            if ( nibble == length_mask )
+            {
+                std::byte b;
+                do
+                {
+                    if ( pos == block.size() )
+                    {
+                        return false;
+                    }
+                    b = block[ pos++ ];
+                    length += std::to_integer< size_t >( b );
+                } while ( b == std::byte{ 255 } );
+            }
+            return true;
+        }
+
+        std::span< std::byte const > block;
+        size_t pos = 0;
+        size_t last_literals_end = 0;
+    };
+
+    class BlockWriter
+    {
+    public:
+        explicit BlockWriter( std::span< std::byte > o ) : output( o ) {}
+
+        bool failed() const { return has_failed; }
+        size_t size() const { return pos; }    // Not counting held literals
+
+        // Writes the first literals of the next sequence before its length is known, so they do
+        // not have to be kept until its match is found. They are moved up to make room for the
+        // length when the sequence is written.
+        void hold_literals( std::span< std::byte const > const literals )
+        {
+            if ( reserve( 1 + held_literal_size + literals.size() ) )
+            {
+                std::memcpy( output.data() + pos + 1 + held_literal_size, literals.data(), literals.size() );
+                held_literal_size += literals.size();
+            }
+        }
+
+        void write_bytes( std::span< std::byte const > const bytes )
+        {
+            if ( reserve( bytes.size() ) )
+            {
+                std::memcpy( output.data() + pos, bytes.data(), bytes.size() );
+                pos += bytes.size();
+            }
+        }
+
+        void write_sequence( std::span< std::byte const > const literals, size_t const match_offset,
+                             size_t const match_size )
+        {
+            size_t const match_length = match_size - min_match_size;
+            write_token( held_literal_size + literals.size(), match_length );
+            write_bytes( literals );
+            write_byte( static_cast< std::byte >( match_offset & 0xFF ) );
+            write_byte( static_cast< std::byte >( match_offset >> 8 ) );
+            write_length_extension( match_length );
+        }
+
+        void write_last_literals( std::span< std::byte const > const literals )
+        {
+            write_token( held_literal_size + literals.size(), 0 );
+            write_bytes( literals );
+        }
+
+    private:
+        bool reserve( size_t const n )
+        {
+            has_failed = has_failed || n > output.size() - pos;
+            return !has_failed;
+        }
+
+        void write_byte( std::byte const b )
+        {
+            if ( reserve( 1 ) )
+            {
+                output[ pos++ ] = b;
+            }
+        }
+
+        void write_token( size_t const literal_length, size_t const match_length )
+        {
+            unsigned const high = static_cast< unsigned >( std::min< size_t >( literal_length, length_mask ) );
+            unsigned const low = static_cast< unsigned >( std::min< size_t >( match_length, length_mask ) );
+            write_byte( static_cast< std::byte >( ( high << 4 ) | low ) );
+            if ( held_literal_size != 0 )
+            {
+                size_t const extension_size =
+                    ( literal_length < length_mask ) ? 0 : ( literal_length - length_mask ) / 255 + 1;
+                if ( reserve( extension_size + held_literal_size ) )
+                {
+                    std::memmove( output.data() + pos + extension_size, output.data() + pos, held_literal_size );
+                }
+            }
+            write_length_extension( literal_length );
+            if ( reserve( held_literal_size ) )
+            {
+                pos += held_literal_size;
+            }
+            held_literal_size = 0;
+        }
+
+        void write_length_extension( size_t length )
+        {
+            if ( length < length_mask )
+            {
+                return;
+            }
+            for ( length -= length_mask; length >= 255; length -= 255 )
+            {
+                write_byte( std::byte{ 255 } );
+            }
+            write_byte( static_cast< std::byte >( length ) );
+        }
+
+        std::span< std::byte > output;
+        size_t pos = 0;
+        size_t held_literal_size = 0;    // After the byte at pos, which is left for their token
+        bool has_failed = false;
+    };
+
+    struct StreamTraits
+    {
+        using HandleType = LZ4_stream_t *;
+        static constexpr LZ4_stream_t *null_value = nullptr;
+        static void close( LZ4_stream_t *s ) { LZ4_freeStream( s ); }
+    };
+
+    using UniqueStream = UniqueHandle< StreamTraits >;
+
+    UniqueStream create_stream()
+    {
+        UniqueStream stream( LZ4_createStream() );
+        if ( !stream.is_valid() )
+        {
+            throw std::bad_alloc();
+        }
+        return stream;
+    }
+
+    // Compresses data[ start, end ) into a block in output, with up to 64KB of the data before it
+    // as a dictionary. Returns the compressed size.
+    std::optional< size_t > compress_with_prefix( LZ4_stream_t *const stream, std::span< std::byte const > const data,
+                                                  size_t const start, size_t const end,
+                                                  std::vector< std::byte > &output, int const acceleration = 1 )
+    {
+        size_t const dictionary_start = start - std::min( start, max_dictionary_size );
+        LZ4_loadDict( stream, reinterpret_cast< char const * >( data.data() + dictionary_start ),
+                      static_cast< int >( start - dictionary_start ) );
+
+        size_t const size = end - start;
+        output.resize( static_cast< size_t >( LZ4_compressBound( static_cast< int >( size ) ) ) );
+        int const compressed_size = LZ4_compress_fast_continue(
+            stream, reinterpret_cast< char const * >( data.data() + start ), reinterpret_cast< char * >( output.data() ),
+            static_cast< int >( size ), static_cast< int >( output.size() ), acceleration );
+        if ( compressed_size <= 0 )
+        {
+            return std::nullopt;
+        }
+        output.resize( static_cast< size_t >( compressed_size ) );
+        return output.size();
+    }
+
+    // How many candidates the hash chain search tries at each position, for each high level.
+    // From level 10 a match is also given up for a longer one two bytes later. There is no optimal
+    // parser as in LZ4HC.
+    constexpr std::array< size_t, lz4_max_high_level - lz4_min_high_level + 1 > hash_chain_attempts = {
+        4, 8, 16, 32, 64, 128, 256, 256, 1024, 16384,
+    };
+
+    constexpr int first_look_ahead_level = 10;
+
+    // Single thread speeds of each high level in bytes per second, measured on large saves
+    constexpr std::array< double, lz4_max_high_level - lz4_min_high_level + 1 > hash_chain_speeds = {
+        140e6, 110e6, 85e6, 57e6, 33e6, 27e6, 19e6, 9.5e6, 4.9e6, 4.9e6,
+    };
+
+    uint32_t read_u32( std::byte const *const p )
+    {
+        uint32_t v;
+        std::memcpy( &v, p, sizeof( v ) );
+        return v;
+    }
+
+    // The number of bytes that are the same at a and b, stopping at b_end
+    size_t count_equal_bytes( std::byte const *a, std::byte const *b, std::byte const *const b_end )
+    {
+        std::byte const *const b_start = b;
+        if constexpr ( std::endian::native == std::endian::little )
+        {
+            for ( ; b_end - b >= 8; a += 8, b += 8 )
+            {
+                uint64_t x, y;
+                std::memcpy( &x, a, sizeof( x ) );
+                std::memcpy( &y, b, sizeof( y ) );
+                if ( x != y )
+                {
+                    return static_cast< size_t >( b - b_start ) + static_cast< size_t >( std::countr_zero( x ^ y ) / 8 );
+                }
+            }
+        }
+        for ( ; b != b_end && *a == *b; ++a, ++b )
+        {
+        }
+        return static_cast< size_t >( b - b_start );
+    }
+
+    // Compresses like LZ4HC. Each position is linked to the last position before it with the same
+    // hash, and the links are followed back up to 64KB to find the longest match. A match is only
+    // taken if the next position does not have a longer one.
+    class HashChainCompressor
+    {
+    public:
+        HashChainCompressor() : head( size_t{ 1 } << hash_bits ), chain( max_match_offset + 1 ) {}
+
+        // Compresses data[ start, end ) like compress_with_prefix()
+        std::optional< size_t > compress( std::span< std::byte const > const data, size_t const start,
+                                          size_t const end, int const level, std::vector< std::byte > &output )
+        {
+            window = data.first( end );
+            window_start = start - std::min( start, max_dictionary_size );
+            next_to_insert = window_start;
+            max_attempts = hash_chain_attempts[ static_cast< size_t >( level - lz4_min_high_level ) ];
+            std::fill( head.begin(), head.end(), 0 );
+
+            output.resize( static_cast< size_t >( LZ4_compressBound( static_cast< int >( end - start ) ) ) );
+            BlockWriter writer( output );
+
+            size_t pos = start;
+            size_t literals_start = start;
+            while ( end - pos >= min_match_distance_from_end )
+            {
+                Match match = find_longest_match( pos );
+                if ( match.size < min_match_size )
+                {
+                    ++pos;
+                    continue;
+                }
+                while ( end - ( pos + 1 ) >= min_match_distance_from_end )
+                {
+                    if ( Match const next = find_longest_match( pos + 1 ); next.size > match.size )
+                    {
+                        match = next;
+                        pos += 1;
+                        continue;
+                    }
+                    if ( level < first_look_ahead_level || end - ( pos + 2 ) < min_match_distance_from_end )
+                    {
+                        break;
+                    }
+                    if ( Match const next = find_longest_match( pos + 2 ); next.size > match.size + 1 )
+                    {
+                        match = next;
+                        pos += 2;
+                        continue;
+                    }
+                    break;
+                }
+
+                writer.write_sequence( data.subspan( literals_start, pos - literals_start ), match.offset, match.size );
+                pos += match.size;
+                literals_start = pos;
+            }
+            writer.write_last_literals( data.subspan( literals_start, end - literals_start ) );
+
+            if ( writer.failed() )
+            {
+                return std::nullopt;
+            }
+            output.resize( writer.size() );
+            return output.size();
+        }
+
+    private:
+        static constexpr unsigned hash_bits = 15;
+
+        struct Match
+        {
+            size_t offset = 0;
+            size_t size = 0;
+        };
+
+        size_t hash( size_t const pos ) const
+        {
+            return ( read_u32( window.data() + pos ) * 2654435761U ) >> ( 32 - hash_bits );
+        }
+
+        // Links every position before pos into the chains
+        void insert_until( size_t const pos )
+        {
+            for ( ; next_to_insert < pos; ++next_to_insert )
+            {
+                uint32_t &last = head[ hash( next_to_insert ) ];
+                size_t const link = next_to_insert - window_start + 1;
+                size_t const distance = link - last;
+                chain[ next_to_insert & max_match_offset ] =
+                    static_cast< uint16_t >( ( last == 0 || distance > max_match_offset ) ? 0 : distance );
+                last = static_cast< uint32_t >( link );
+            }
+        }
+
+        Match find_longest_match( size_t const pos )
+        {
+            insert_until( pos );
+
+            std::byte const *const current = window.data() + pos;
+            std::byte const *const match_end_limit = window.data() + window.size() - min_last_literals;
+            size_t const lowest = pos - std::min( pos - window_start, max_match_offset );
+            uint32_t const current_u32 = read_u32( current );
+
+            Match best;
+            size_t link = head[ hash( pos ) ];
+            for ( size_t attempts = 0; link != 0 && attempts < max_attempts; ++attempts )
+            {
+                size_t const candidate = window_start + link - 1;
+                if ( candidate < lowest )
+                {
+                    break;
+                }
+                std::byte const *const candidate_bytes = window.data() + candidate;
+                if ( read_u32( candidate_bytes ) == current_u32 )
+                {
+                    size_t const size = min_match_size + count_equal_bytes( candidate_bytes + min_match_size,
+                                                                            current + min_match_size, match_end_limit );
+                    if ( size > best.size )
+                    {
+                        best = Match{ pos - candidate, size };
+                        if ( current + size == match_end_limit )
+                        {
+                            break;
+                        }
+                    }
+                }
+
+                uint16_t const distance = chain[ candidate & max_match_offset ];
+                if ( distance == 0 )
+                {
+                    break;
+                }
+                link -= distance;
+            }
+            return best;
+        }
+
+        std::span< std::byte const > window;
+        size_t window_start = 0;
+        size_t next_to_insert = 0;
+        size_t max_attempts = 0;
+
+        // Links are positions in the window plus one, so 0 is the end of a chain. The chain holds
+        // the distance back to the previous position with the same hash.
+        std::vector< uint32_t > head;
+        std::vector< uint16_t > chain;
+    };
+
+    // A chunk's block, split into its first sequence which takes the literals left over from the
+    // previous chunk, the sequences after it which are copied as they are, and its last literals
+    // which are left over for the next chunk, so that joining chunks is little more than a copy
+    struct SplitChunk
+    {
+        std::optional< Sequence > first_sequence;    // not set if the block is only literals
+        std::vector< std::byte > middle;
+        size_t last_literal_size = 0;
+    };
+
+    // Compresses the chunks of a block to be joined. The compressors and a buffer as large as a
+    // chunk are kept from one chunk to the next, and only the sequences that are needed are copied
+    // out of the buffer.
+    class ChunkCompressor
+    {
+    public:
+        // Compresses window[ start, end ) with up to 64KB before it as a dictionary. Returns false if
+        // it failed to compress.
+        bool compress( std::span< std::byte const > const window, size_t const start, size_t const end,
+                       Lz4Compression const compression, SplitChunk &chunk )
+        {
+            std::optional< size_t > compressed_size;
+            if ( compression.method == Lz4Compression::Method::high )
+            {
+                if ( !hash_chain )
+                {
+                    hash_chain = std::make_unique< HashChainCompressor >();
+                }
+                compressed_size = hash_chain->compress( window, start, end, compression.level, scratch );
+            }
+            else
+            {
+                if ( !stream.is_valid() )
+                {
+                    stream = create_stream();
+                }
+                compressed_size = compress_with_prefix( stream.get(), window, start, end, scratch, compression.level );
+            }
+            if ( !compressed_size.has_value() )
+            {
+                return false;
+            }
+
+            chunk.first_sequence.reset();
+            chunk.last_literal_size = 0;
+            SequenceReader reader( scratch );
+            size_t middle_start = 0;
+            size_t last_sequence_start = 0;
+            while ( !reader.at_end() )
+            {
+                size_t const sequence_start = reader.position();
+                std::optional< Sequence > const seq = reader.next();
+                if ( !seq.has_value() )
+                {
+                    return false;
+                }
+                if ( sequence_start == 0 && seq->match_offset != 0 )
+                {
+                    chunk.first_sequence = seq;
+                    middle_start = reader.position();
+                }
+                last_sequence_start = sequence_start;
+                chunk.last_literal_size = seq->literal_size;
+            }
+            size_t const middle_end = std::max( middle_start, last_sequence_start );
+            chunk.middle.assign( scratch.begin() + static_cast< ptrdiff_t >( middle_start ),
+                                 scratch.begin() + static_cast< ptrdiff_t >( middle_end ) );
+            return true;
+        }
+
+    private:
+        UniqueStream stream;
+        std::unique_ptr< HashChainCompressor > hash_chain;
+        std::vector< std::byte > scratch;
+    };
+
+    class EditedBlockWriter
+    {
+    public:
+        EditedBlockWriter( Lz4EditedData const &nd, std::span< std::byte > output )
+            : new_data( nd ), writer( output )
+        {
+        }
+
+        bool failed() const { return writer.failed(); }
+        size_t size() const { return writer.size(); }
+
+        // Where the next sequence's literals start in the new data
+        size_t position() const { return pending_literals_end; }
+
+        void copy_sequences( std::span< std::byte const > const sequences, size_t const decompressed_size )
+        {
+            writer.write_bytes( sequences );
+            pending_literals_start += decompressed_size;
+            pending_literals_end += decompressed_size;
+        }
+
+        void add_literals( size_t const size ) { pending_literals_end += size; }
+
+        void write_sequence( size_t const literal_size, size_t const match_offset, size_t const match_size )
+        {
+            add_literals( literal_size );
+            writer.write_sequence( pending_literals(), match_offset, match_size );
+            pending_literals_end += match_size;
+            pending_literals_start = pending_literals_end;
+        }
+
+        bool has_pending_literals() const { return pending_literals_start != pending_literals_end; }
+
+        // Compresses the new data from position() to end
+        bool compress( size_t const end )
+        {
+            if ( !stream.is_valid() )
+            {
+                stream = create_stream();
+            }
+            size_t const start = position();
+            size_t const dictionary_start = start - std::min( start, max_dictionary_size );
+            std::span< std::byte const > const window = new_data.read( dictionary_start, end, window_scratch );
+            std::optional< size_t > const compressed_size = compress_with_prefix(
+                stream.get(), window, start - dictionary_start, end - dictionary_start, scratch );
+            if ( !compressed_size.has_value() )
+            {
+                return false;
+            }
+
+            SequenceReader reader( std::span( scratch.data(), compressed_size.value() ) );
+            while ( !reader.at_end() )
+            {
+                std::optional< Sequence > const seq = reader.next();
+                if ( !seq.has_value() )
+                {
+                    return false;
+                }
+                if ( seq->match_offset == 0 )
+                {
+                    add_literals( seq->literal_size );
+                }
+                else
+                {
+                    write_sequence( seq->literal_size, seq->match_offset, seq->match_size );
+                }
+            }
+            return pending_literals_end == end;
+        }
+
+        void finish() { writer.write_last_literals( pending_literals() ); }
+
+    private:
+        std::span< std::byte const > pending_literals()
+        {
+            return new_data.read( pending_literals_start, pending_literals_end, literal_scratch );
+        }
+
+        Lz4EditedData const &new_data;
+        BlockWriter writer;
+
+        // Literals that have not been written yet, as offsets in the new data. Everything before
+        // them has been written.
+        size_t pending_literals_start = 0;
+        size_t pending_literals_end = 0;
+
+        UniqueStream stream;
+        std::vector< std::byte > scratch;
+
+        // For the parts of the new data that have to be gathered
+        std::vector< std::byte > window_scratch;
+        std::vector< std::byte > literal_scratch;
+    };
+
+    bool overlaps( Lz4Edit const &edit, size_t const start, size_t const end )
+    {
+        return edit.offset < end && edit.offset + edit.original_size > start;
+    }
+
+    // Edits after a sequence can make the block end closer to its match than LZ4 allows, in which
+    // case it has to be compressed again along with the rest of the block
+    bool meets_end_of_block_rules( Sequence const &seq, size_t const new_literal_end, size_t const new_size )
+    {
+        return seq.match_offset == 0 || ( new_literal_end + min_match_distance_from_end <= new_size &&
+                                          new_literal_end + seq.match_size + min_last_literals <= new_size );
+    }
+
+    // A sequence can be copied if its bytes and the bytes its match copies are unchanged, and the
+    // distance between them is the same. visible_edits starts with the first edit that does not
+    // end more than a match offset before the sequence.
+    bool can_copy_sequence( std::span< Lz4Edit const > const visible_edits, size_t const start, Sequence const &seq )
+    {
+        size_t const literal_end = start + seq.literal_size;
+        size_t const end = literal_end + seq.match_size;
+        if ( visible_edits.empty() || visible_edits.front().offset >= end )
+        {
+            return true;
+        }
+
+        size_t const match_start = literal_end - seq.match_offset;
+        ptrdiff_t size_change_between = 0;
+        for ( size_t i = 0; i < visible_edits.size() && visible_edits[ i ].offset < end; ++i )
+        {
+            Lz4Edit const &edit = visible_edits[ i ];
+            if ( overlaps( edit, start, end ) )
+            {
+                return false;
+            }
+            if ( seq.match_size != 0 )
+            {
+                if ( overlaps( edit, match_start, match_start + seq.match_size ) )
+                {
+                    return false;
+                }
+                if ( edit.offset >= match_start && edit.offset < start )
+                {
+                    size_change_between += static_cast< ptrdiff_t >( edit.new_bytes.size() ) -
+                                           static_cast< ptrdiff_t >( edit.original_size );
+                }
+            }
+        }
+        return size_change_between == 0;
+    }
+}
+
+Lz4EditedData::Lz4EditedData( std::span< std::byte const > const o, std::vector< Lz4Edit > e )
+    : original( o ), edits( std::move( e ) )
+{
+    // Sizes are added and removed separately so the offsets never go below zero
+    size_t added = 0;
+    size_t removed = 0;
+    new_offsets.reserve( edits.size() );
+    for ( size_t i = 0; i < edits.size(); ++i )
+    {
+        assert( edits[ i ].offset + edits[ i ].original_size <= original.size() );
+        assert( i == 0 || edits[ i ].offset >= edits[ i - 1 ].offset + edits[ i - 1 ].original_size );
+        new_offsets.push_back( edits[ i ].offset + added - removed );
+        added += edits[ i ].new_bytes.size();
+        removed += edits[ i ].original_size;
+    }
+    new_size = original.size() + added - removed;
+}
+
+size_t Lz4EditedData::find_edit( size_t const pos ) const
+{
+    size_t i = 0;
+    for ( size_t count = edits.size(); count > 0; )
+    {
+        size_t const half = count / 2;
+        if ( new_offsets[ i + half ] + edits[ i + half ].new_bytes.size() <= pos )
+        {
+            i += half + 1;
+            count -= half + 1;
+        }
+        else
+        {
+            count = half;
+        }
+    }
+    return i;
+}
+
+size_t Lz4EditedData::get_shift( size_t const i ) const
+{
+    // Unsigned arithmetic wraps, so adding the shift to an original offset is still right when the
+    // edits made the contents smaller
+    return ( i < edits.size() ) ? new_offsets[ i ] - edits[ i ].offset : new_size - original.size();
+}
+
+std::span< std::byte const > Lz4EditedData::read( size_t const start, size_t const end,
+                                                  std::vector< std::byte > &scratch ) const
+{
+    assert( start <= end && end <= new_size );
+    if ( start == end )
+    {
+        return original.first( 0 );
+    }
+    size_t const i = find_edit( start );
+    if ( i == edits.size() || new_offsets[ i ] >= end )
+    {
+        return original.subspan( start - get_shift( i ), end - start );
+    }
+    scratch.resize( end - start );
+    gather( start, end, scratch.data() );
+    return scratch;
+}
+
+void Lz4EditedData::gather( size_t const start, size_t const end, std::byte *output ) const
+{
+    assert( start <= end && end <= new_size );
+    size_t pos = start;
+    for ( size_t i = find_edit( start ); pos < end; ++i )
+    {
+        size_t const edit_start = ( i < edits.size() ) ? new_offsets[ i ] : new_size;
+        if ( pos < edit_start )
+        {
+            size_t const copy_end = std::min( end, edit_start );
+            std::memcpy( output, original.data() + ( pos - get_shift( i ) ), copy_end - pos );
+            output += copy_end - pos;
+            pos = copy_end;
+        }
+        if ( i < edits.size() && pos < end )
+        {
+            std::span< std::byte const > const new_bytes = edits[ i ].new_bytes;
+            size_t const copy_end = std::min( end, edit_start + new_bytes.size() );
+            std::memcpy( output, new_bytes.data() + ( pos - edit_start ), copy_end - pos );
+            output += copy_end - pos;
+            pos = copy_end;
+        }
+    }
+}
+
+std::optional< size_t > save_fixer::lz4_recompress_edited_block( std::span< std::byte const > const original_block,
+                                                                 Lz4EditedData const &new_data,
+                                                                 std::span< std::byte > const output )
+{
+    std::span< Lz4Edit const > const edits = new_data.get_edits();
+    if ( edits.empty() )
+    {
+        if ( original_block.size() > output.size() )
+        {
+            return std::nullopt;
+        }
+        std::memcpy( output.data(), original_block.data(), original_block.size() );
+        return original_block.size();
+    }
+
+    // An edit that replaces nothing would be seen by no sequence
+    size_t const original_size = new_data.get_original().size();
+    if ( std::any_of( edits.begin(), edits.end(), []( Lz4Edit const &edit ) { return edit.original_size == 0; } ) ||
+         std::cmp_greater( new_data.size(), std::numeric_limits< int >::max() ) )
+    {
+        return std::nullopt;
+    }
+
+    EditedBlockWriter writer( new_data, output );
+    SequenceReader reader( original_block );
+
+    size_t original_pos = 0;
+    size_t first_visible_edit = 0;    // the first edit a match from original_pos could see
+    size_t passed_edits = 0;          // edits that end before original_pos
+    ptrdiff_t size_change = 0;        // of the passed edits
+    size_t copy_start = 0;            // the block offset of a run of sequences being copied
+    bool is_copying = false;
+    bool is_recompressing = false;
+
+    auto const new_position = [ & ]( size_t const p ) {
+        return static_cast< size_t >( static_cast< ptrdiff_t >( p ) + size_change );
+    };
+    auto const stop_copying = [ & ]( size_t const block_pos ) {
+        if ( is_copying )
+        {
+            writer.copy_sequences( original_block.subspan( copy_start, block_pos - copy_start ),
+                                   new_position( original_pos ) - writer.position() );
+            is_copying = false;
+        }
+    };
+
+    while ( !reader.at_end() )
+    {
+        size_t const block_pos = reader.position();
+        std::optional< Sequence > const seq = reader.next();
+        if ( !seq.has_value() )
+        {
+            return std::nullopt;
+        }
+
+        size_t const literal_end = original_pos + seq->literal_size;
+        size_t const sequence_end = literal_end + seq->match_size;
+        if ( sequence_end > original_size || seq->match_offset > literal_end )
+        {
+            return std::nullopt;
+        }
+
+        // A run of copied sequences never contains an edit, so the size change is the same
+        // for the whole run
+        while ( passed_edits < edits.size() &&
+                edits[ passed_edits ].offset + edits[ passed_edits ].original_size <= original_pos )
+        {
+            size_change += static_cast< ptrdiff_t >( edits[ passed_edits ].new_bytes.size() ) -
+                           static_cast< ptrdiff_t >( edits[ passed_edits ].original_size );
+            ++passed_edits;
+        }
+
+        size_t const window_start = original_pos - std::min( original_pos, max_match_offset );
+        while ( first_visible_edit < edits.size() &&
+                edits[ first_visible_edit ].offset + edits[ first_visible_edit ].original_size <= window_start )
+        {
+            ++first_visible_edit;
+        }
+
+        if ( !can_copy_sequence( edits.subspan( first_visible_edit ), original_pos, seq.value() ) ||
+             !meets_end_of_block_rules( seq.value(), new_position( literal_end ), new_data.size() ) )
+        {
+            stop_copying( block_pos );
+            is_recompressing = true;
+        }
+        else
+        {
+            if ( is_recompressing )
+            {
+                if ( !writer.compress( new_position( original_pos ) ) )
+                {
+                    return std::nullopt;
+                }
+                is_recompressing = false;
+            }
+            if ( !is_copying && writer.position() != new_position( original_pos ) )
+            {
+                return std::nullopt;
+            }
+
+            if ( seq->match_offset == 0 )
+            {
+                stop_copying( block_pos );
+                writer.add_literals( seq->literal_size );
+            }
+            else if ( writer.has_pending_literals() )
+            {
+                writer.write_sequence( seq->literal_size, seq->match_offset, seq->match_size );
+            }
+            else if ( !is_copying )
+            {
+                is_copying = true;
+                copy_start = block_pos;
+            }
+        }
+
+        original_pos = sequence_end;
+    }
+
+    if ( original_pos != original_size )
+    {
+        return std::nullopt;
+    }
+    stop_copying( reader.position() );
+    if ( is_recompressing && !writer.compress( new_data.size() ) )
+    {
+        return std::nullopt;
+    }
+    writer.finish();
+
+    if ( writer.failed() )
+    {
+        return std::nullopt;
+    }
+    return writer.size();
+}
+
+Lz4Compression save_fixer::lz4_choose_compression( size_t const size, std::chrono::nanoseconds const time_budget )
+{
+    double const budget_seconds = std::chrono::duration< double >( time_budget ).count();
+    for ( int level = lz4_max_high_level; level >= lz4_min_high_level; --level )
+    {
+        double const speed = hash_chain_speeds[ static_cast< size_t >( level - lz4_min_high_level ) ];
+        if ( static_cast< double >( size ) / speed <= budget_seconds )
+        {
+            return Lz4Compression{ Lz4Compression::Method::high, level };
+        }
+    }
+    return Lz4Compression{};
+}
+
+//-----------------------------------------------------------------------------
+// Lz4SliceDecompressor
+//-----------------------------------------------------------------------------
+
+// LZ4 cannot stop and carry on in the middle of a block, so the block is cut just after the
+// literals of a sequence, and LZ4 decompresses the part before the cut as if it were a whole block
+// with the output before it as a prefix. The match of the sequence that was cut is copied here.
+
+Lz4SliceDecompressor::Lz4SliceDecompressor( std::span< std::byte const > const b, std::span< std::byte > const o )
+    : block( b ), output( o )
+{
+}
+
+bool Lz4SliceDecompressor::decompress_next( size_t const slice_size )
+{
+    if ( is_finished() )
+    {
+        return true;
+    }
+    if ( std::cmp_greater( block.size(), std::numeric_limits< int >::max() ) ||
+         std::cmp_greater( output.size(), std::numeric_limits< int >::max() ) )
+    {
+        return false;
+    }
+
+    size_t const slice_input_pos = input_pos;
+    size_t const slice_output_pos = output_pos;
+    SequenceReader reader( block.subspan( slice_input_pos ) );
+    size_t sequence_output_pos = slice_output_pos;
+    while ( !reader.at_end() )
+    {
+        std::optional< Sequence > const seq = reader.next();
+        if ( !seq.has_value() || seq->literal_size > output.size() - sequence_output_pos )
+        {
+            return false;
+        }
+        size_t const literals_end = sequence_output_pos + seq->literal_size;
+        if ( seq->match_offset == 0 )
+        {
+            break;
+        }
+        if ( seq->match_offset > literals_end || seq->match_size > output.size() - literals_end )
+        {
+            return false;
+        }
+
+        if ( literals_end - slice_output_pos >= slice_size && seq->literal_size >= min_slice_end_literal_size )
+        {
+            if ( !decompress_part( slice_input_pos + reader.literals_end(), literals_end ) )
+            {
+                return false;
+            }
+
+            // The match may overlap its own output, in which case it is copied a byte at a time
+            std::byte *const match_out = output.data() + literals_end;
+            std::byte const *const match_in = match_out - seq->match_offset;
+            if ( seq->match_offset >= seq->match_size )
+            {
+                std::memcpy( match_out, match_in, seq->match_size );
+            }
+            else
+            {
+                for ( size_t i = 0; i < seq->match_size; ++i )
+                {
+                    match_out[ i ] = match_in[ i ];
+                }
+            }
+
+            input_pos = slice_input_pos + reader.position();
+            output_pos = literals_end + seq->match_size;
+            return true;
+        }
+        sequence_output_pos = literals_end + seq->match_size;
+    }
+
+    return decompress_part( block.size(), output.size() );
+}
+
+bool Lz4SliceDecompressor::decompress_part( size_t const input_end, size_t const output_end )
+{
+    size_t const prefix_size = std::min( output_pos, max_dictionary_size );
+    int const result = LZ4_decompress_safe_usingDict(
+        reinterpret_cast< char const * >( block.data() + input_pos ), reinterpret_cast< char * >( output.data() + output_pos ),
+        static_cast< int >( input_end - input_pos ), static_cast< int >( output_end - output_pos ),
+        reinterpret_cast< char const * >( output.data() + output_pos - prefix_size ), static_cast< int >( prefix_size ) );
+    if ( result < 0 || static_cast< size_t >( result ) != output_end - output_pos )
+    {
+        return false;
+    }
+    input_pos = input_end;
+    output_pos = output_end;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Lz4Checkpoints
+//-----------------------------------------------------------------------------
+
+Lz4Checkpoints::Lz4Checkpoints( std::vector< Lz4Checkpoint > c, size_t const size )
+    : checkpoints( std::move( c ) ), output_size( size )
+{
+}
+
+std::optional< Lz4Checkpoints > Lz4Checkpoints::build( std::span< std::byte const > const block,
+                                                       std::span< std::byte const > const output, size_t const interval )
+{
+    std::vector< Lz4Checkpoint > checkpoints;
+    SequenceReader reader( block );
+    size_t output_pos = 0;
+    size_t last_checkpoint = 0;
+    while ( !reader.at_end() )
+    {
+        std::optional< Sequence > const seq = reader.next();
+        if ( !seq.has_value() || seq->literal_size > output.size() - output_pos )
+        {
+            return std::nullopt;
+        }
+        size_t const literals_end = output_pos + seq->literal_size;
+        if ( seq->match_offset == 0 )
+        {
+            output_pos = literals_end;
+            break;
+        }
+        if ( seq->match_offset > literals_end || seq->match_size > output.size() - literals_end )
+        {
+            return std::nullopt;
+        }
+
+        output_pos = literals_end + seq->match_size;
+        if ( literals_end - last_checkpoint >= interval && seq->literal_size >= min_slice_end_literal_size )
+        {
+            size_t const window_size = std::min( output_pos, max_dictionary_size );
+            checkpoints.push_back( Lz4Checkpoint{
+                reader.literals_end(), literals_end, seq->match_offset, seq->match_size, reader.position(), output_pos,
+                std::vector< std::byte >( output.begin() + ( output_pos - window_size ), output.begin() + output_pos ) } );
+            last_checkpoint = output_pos;
+        }
+    }
+    if ( !reader.at_end() || output_pos != output.size() )
+    {
+        return std::nullopt;
+    }
+    return Lz4Checkpoints( std::move( checkpoints ), output.size() );
+}
+
+bool Lz4Checkpoints::decompress_part( std::span< std::byte const > const block, size_t const i,
+                                      std::span< std::byte > const output,
+                                      std::span< std::byte const > const dictionary ) const
+{
+    bool const is_last = ( i == checkpoints.size() );
+    size_t const input_start = get_part_input_start( i );
+    size_t const start = get_part_start( i );
+    size_t const cut_input = is_last ? block.size() : checkpoints[ i ].cut_input_offset;
+    size_t const cut_output = is_last ? output_size : checkpoints[ i ].cut_output_offset;
+    if ( input_start > cut_input || cut_input > block.size() || start > cut_output ||
+         output.size() != get_part_end( i ) - start || cut_output - start > output.size() ||
+         std::cmp_greater( cut_input - input_start, std::numeric_limits< int >::max() ) ||
+         std::cmp_greater( cut_output - start, std::numeric_limits< int >::max() ) )
+    {
+        return false;
+    }
+
+    size_t const prefix_size = std::min( dictionary.size(), max_dictionary_size );
+    int const result = LZ4_decompress_safe_usingDict(
+        reinterpret_cast< char const * >( block.data() + input_start ), reinterpret_cast< char * >( output.data() ),
+        static_cast< int >( cut_input - input_start ), static_cast< int >( cut_output - start ),
+        reinterpret_cast< char const * >( dictionary.data() + dictionary.size() - prefix_size ),
+        static_cast< int >( prefix_size ) );
+    if ( result < 0 || static_cast< size_t >( result ) != cut_output - start )
+    {
+        return false;
+    }
+    if ( is_last )
+    {
+        return true;
+    }
+
+    // The match may start in the dictionary and may overlap its own output, so it is copied a byte
+    // at a time
+    Lz4Checkpoint const &checkpoint = checkpoints[ i ];
+    size_t const match_pos = cut_output - start;
+    if ( checkpoint.match_offset == 0 || checkpoint.match_offset > match_pos + prefix_size ||
+         checkpoint.match_size != output.size() - match_pos )
+    {
+        return false;
+    }
+    for ( size_t pos = match_pos; pos < output.size(); ++pos )
+    {
+        output[ pos ] = ( pos >= checkpoint.match_offset )
+                            ? output[ pos - checkpoint.match_offset ]
+                            : dictionary[ dictionary.size() - ( checkpoint.match_offset - pos ) ];
+    }
+    return true;
+}
+
+bool Lz4Checkpoints::decompress_range( std::span< std::byte const > const block, size_t const start, size_t const end,
+                                       std::span< std::byte > const output ) const
+{
+    if ( start > end || end > output_size || output.size() != end - start )
+    {
+        return false;
+    }
+
+    // The parts from the one that start is in are decompressed one after another into a buffer
+    // that starts with the window of the checkpoint before them, so each has the output before it
+    // as its dictionary
+    size_t const first_part = static_cast< size_t >(
+        std::upper_bound( checkpoints.begin(), checkpoints.end(), start,
+                          []( size_t const offset, Lz4Checkpoint const &c ) { return offset < c.output_offset; } ) -
+        checkpoints.begin() );
+    std::span< std::byte const > const window =
+        ( first_part == 0 ) ? std::span< std::byte const >() : std::span( checkpoints[ first_part - 1 ].window );
+    size_t const buffer_start = get_part_start( first_part );
+    if ( window.size() != std::min( buffer_start, max_dictionary_size ) )
+    {
+        return false;
+    }
+
+    std::vector< std::byte > buffer( window.begin(), window.end() );
+    for ( size_t i = first_part; buffer_start + ( buffer.size() - window.size() ) < end; ++i )
+    {
+        if ( i > checkpoints.size() || get_part_start( i ) > get_part_end( i ) || get_part_end( i ) > output_size )
+        {
+            return false;
+        }
+        size_t const part_offset = buffer.size();
+        buffer.resize( part_offset + get_part_end( i ) - get_part_start( i ) );
+        if ( !decompress_part( block, i, std::span( buffer ).subspan( part_offset ),
+                               std::span( buffer ).first( part_offset ) ) )
+        {
+            return false;
+        }
+    }
+
+    size_t const offset = window.size() + ( start - buffer_start );
+    std::copy( buffer.begin() + offset, buffer.begin() + offset + output.size(), output.begin() );
+    return true;
+}
+
+bool Lz4Checkpoints::decompress( std::span< std::byte const > const block, std::span< std::byte > const output,
+                                 ThreadPool &pool ) const
+{
+    if ( output.size() != output_size )
+    {
+        return false;
+    }
+    for ( size_t i = 0; i <= checkpoints.size(); ++i )
+    {
+        if ( get_part_start( i ) > get_part_end( i ) || get_part_end( i ) > output_size ||
+             ( i != 0 && checkpoints[ i - 1 ].window.size() != std::min( get_part_start( i ), max_dictionary_size ) ) )
+        {
+            return false;
+        }
+    }
+
+    // Each part has the window of the checkpoint before it as its dictionary, as the output before
+    // it is being written at the same time
+    std::vector< char > part_failed( checkpoints.size() + 1, false );
+    pool.parallel_for( part_failed.size(), [ & ]( size_t const i ) {
+        std::span< std::byte const > const dictionary =
+            ( i == 0 ) ? std::span< std::byte const >() : std::span( checkpoints[ i - 1 ].window );
+        std::span< std::byte > const part = output.subspan( get_part_start( i ), get_part_end( i ) - get_part_start( i ) );
+        part_failed[ i ] = !decompress_part( block, i, part, dictionary );
+    } );
+    return std::find( part_failed.begin(), part_failed.end(), char{ true } ) == part_failed.end();
+}
+
+//-----------------------------------------------------------------------------
+// Lz4StreamDecompressor
+//-----------------------------------------------------------------------------
+
+// The buffer is the window followed by the piece being decompressed. Before each piece the last
+// 64KB of the buffer is moved to its start, which is cheap next to decompressing the piece, and a
+// match never has to wrap around the end of the buffer as it would in a ring. A sequence may be
+// cut by the end of a piece, so what is left of it is carried to the next.
+
+Lz4StreamDecompressor::Lz4StreamDecompressor( std::span< std::byte const > const b, size_t const size )
+    : block( b ), output_size( size ), buffer( max_dictionary_size + stream_piece_size )
+{
+}
+
+std::optional< std::span< std::byte const > > Lz4StreamDecompressor::next()
+{
+    if ( buffer_used > max_dictionary_size )
+    {
+        std::memmove( buffer.data(), buffer.data() + buffer_used - max_dictionary_size, max_dictionary_size );
+        buffer_used = max_dictionary_size;
+    }
+
+    size_t const piece_start = buffer_used;
+    while ( buffer_used < buffer.size() )
+    {
+        size_t const space = buffer.size() - buffer_used;
+        if ( literals_left != 0 )
+        {
+            size_t const size = std::min( literals_left, space );
+            std::memcpy( buffer.data() + buffer_used, block.data() + literal_pos, size );
+            buffer_used += size;
+            literal_pos += size;
+            literals_left -= size;
+            continue;
+        }
+        if ( match_left != 0 )
+        {
+            // A match that overlaps its own output repeats its first match_offset bytes, so it is
+            // copied in steps of at most that many
+            size_t const size = std::min( { match_left, space, match_offset } );
+            std::memcpy( buffer.data() + buffer_used, buffer.data() + buffer_used - match_offset, size );
+            buffer_used += size;
+            match_left -= size;
+            continue;
+        }
+        if ( input_pos == block.size() )
+        {
+            break;
+        }
+
+        SequenceReader reader( block.subspan( input_pos ) );
+        std::optional< Sequence > const seq = reader.next();
+        size_t const sequence_output_pos = output_pos + ( buffer_used - piece_start );
+        if ( !seq.has_value() || seq->literal_size > output_size - sequence_output_pos ||
+             seq->match_offset > sequence_output_pos + seq->literal_size ||
+             seq->match_size > output_size - sequence_output_pos - seq->literal_size )
+        {
+            return std::nullopt;
+        }
+        literal_pos = input_pos + reader.literals_end() - seq->literal_size;
+        literals_left = seq->literal_size;
+        match_offset = seq->match_offset;
+        match_left = seq->match_size;
+        input_pos += reader.position();
+    }
+
+    output_pos += buffer_used - piece_start;
+    if ( buffer_used == piece_start && !is_finished() )
+    {
+        return std::nullopt;
+    }
+    return std::span< std::byte const >( buffer ).subspan( piece_start, buffer_used - piece_start );
+}
+
+//-----------------------------------------------------------------------------
+// Lz4ParallelCompressor
+//-----------------------------------------------------------------------------
+
+// Each chunk is compressed and split by its own task, so joining the chunks is little more than a
+// copy
+struct Lz4ParallelCompressor::Chunk
+{
+    size_t start;
+    size_t end;
+
+    bool failed = false;
+    SplitChunk split;
+};
+
+Lz4ParallelCompressor::Lz4ParallelCompressor( Lz4EditedData const &in, Lz4Compression const c )
+    : input( in ), compression( c )
+{
+    for ( size_t start = 0; start < input.size() || start == 0; start += parallel_chunk_size )
+    {
+        auto chunk = std::make_unique< Chunk >();
+        chunk->start = start;
+        chunk->end = std::min( input.size(), start + parallel_chunk_size );
+        chunks.push_back( std::move( chunk ) );
+    }
+}
+
+Lz4ParallelCompressor::~Lz4ParallelCompressor() = default;
+
+void Lz4ParallelCompressor::start( ThreadPool &pool, TaskGroup &group )
+{
+    for ( std::unique_ptr< Chunk > const &c : chunks )
+    {
+        pool.run( group, [ this, &chunk = *c ]() {
+            try
+            {
+                // A compressor and a buffer for the chunk's window are kept for each thread
+                thread_local ChunkCompressor compressor;
+                thread_local std::vector< std::byte > window_scratch;
+
+                // The chunk and its dictionary, with the chunk's offsets made relative to them
+                size_t const window_start = chunk.start - std::min( chunk.start, max_dictionary_size );
+                std::span< std::byte const > const window = input.read( window_start, chunk.end, window_scratch );
+                chunk.failed = std::cmp_greater( input.size(), std::numeric_limits< int >::max() ) ||
+                               !compressor.compress( window, chunk.start - window_start, chunk.end - window_start,
+                                                     compression, chunk.split );
+            }
+            catch ( std::bad_alloc const & )
+            {
+                chunk.failed = true;
+            }
+        } );
+    }
+}
+
+std::optional< size_t > Lz4ParallelCompressor::finish( std::span< std::byte > const output ) const
+{
+    BlockWriter writer( output );
+    std::vector< std::byte > literal_scratch;
+    size_t pending_literals_start = 0;
+    for ( std::unique_ptr< Chunk > const &c : chunks )
+    {
+        Chunk const &chunk = *c;
+        if ( chunk.failed )
+        {
+            return std::nullopt;
+        }
+        if ( chunk.split.first_sequence.has_value() )
+        {
+            Sequence const &first = chunk.split.first_sequence.value();
+            writer.write_sequence(
+                input.read( pending_literals_start, chunk.start + first.literal_size, literal_scratch ),
+                first.match_offset, first.match_size );
+            writer.write_bytes( chunk.split.middle );
+            pending_literals_start = chunk.end - chunk.split.last_literal_size;
+        }
+    }
+    writer.write_last_literals( input.read( pending_literals_start, input.size(), literal_scratch ) );
+
+    if ( writer.failed() )
+    {
+        return std::nullopt;
+    }
+    return writer.size();
+}
+
+//-----------------------------------------------------------------------------
+// Lz4StreamCompressor
+//-----------------------------------------------------------------------------
+
+// The buffer is the 64KB window followed by the chunk being filled. Each full chunk is compressed
+// and joined to the block just as Lz4ParallelCompressor::finish() joins its chunks, then the end of
+// the buffer becomes the next chunk's window.
+
+struct Lz4StreamCompressor::State
+{
+    State( std::span< std::byte > output, Lz4Compression const c ) : writer( output ), compression( c )
+    {
+        buffer.reserve( max_dictionary_size + parallel_chunk_size );
+    }
+
+    bool compress_chunk()
+    {
+        size_t const chunk_start = buffer.size() - chunk_size;
+        if ( !compressor.compress( buffer, chunk_start, buffer.size(), compression, chunk ) )
+        {
+            return false;
+        }
+
+        std::span< std::byte const > const chunk_bytes = std::span( buffer ).subspan( chunk_start );
+        if ( chunk.first_sequence.has_value() )
+        {
+            Sequence const &first = chunk.first_sequence.value();
+            pending_literals.insert( pending_literals.end(), chunk_bytes.begin(),
+                                     chunk_bytes.begin() + static_cast< ptrdiff_t >( first.literal_size ) );
+            writer.write_sequence( pending_literals, first.match_offset, first.match_size );
+            writer.write_bytes( chunk.middle );
+            pending_literals.assign( chunk_bytes.end() - static_cast< ptrdiff_t >( chunk.last_literal_size ),
+                                     chunk_bytes.end() );
+        }
+        else
+        {
+            pending_literals.insert( pending_literals.end(), chunk_bytes.begin(), chunk_bytes.end() );
+        }
+
+        // Input without matches would make the pending literals grow without bound, so past the
+        // size of the window they are written to the output ahead of their sequence
+        if ( pending_literals.size() > max_dictionary_size )
+        {
+            writer.hold_literals( pending_literals );
+            pending_literals.clear();
+        }
+
+        size_t const window_size = std::min( buffer.size(), max_dictionary_size );
+        buffer.erase( buffer.begin(), buffer.end() - static_cast< ptrdiff_t >( window_size ) );
+        chunk_size = 0;
+        return !writer.failed();
+    }
+
+    BlockWriter writer;
+    Lz4Compression const compression;
+    ChunkCompressor compressor;
+    SplitChunk chunk;
+
+    std::vector< std::byte > buffer;
+    size_t chunk_size = 0;    // The end of the buffer that is the chunk being filled
+    std::vector< std::byte > pending_literals;
+    bool failed = false;
+};
+
+Lz4StreamCompressor::Lz4StreamCompressor( std::span< std::byte > const output, Lz4Compression const compression )
+    : state( std::make_unique< State >( output, compression ) )
+{
+}
+
+Lz4StreamCompressor::~Lz4StreamCompressor() = default;
+
+bool Lz4StreamCompressor::write( std::span< std::byte const > input )
+{
+    while ( !state->failed && !input.empty() )
+    {
+        size_t const size = std::min( input.size(), parallel_chunk_size - state->chunk_size );
+        state->buffer.insert( state->buffer.end(), input.begin(), input.begin() + static_cast< ptrdiff_t >( size ) );
+        state->chunk_size += size;
+        input = input.subspan( size );
+        if ( state->chunk_size == parallel_chunk_size )
+        {
+            state->failed = !state->compress_chunk();
+        }
+    }
+    return !state->failed;
+}
+
+std::optional< size_t > Lz4StreamCompressor::finish()
+{
+    // Like Lz4ParallelCompressor, an empty block is still compressed as one empty chunk
+    if ( !state->failed && ( state->chunk_size != 0 || state->buffer.empty() ) )
+    {
+        state->failed = !state->compress_chunk();
+    }
+    if ( state->failed )
+    {
+        return std::nullopt;
+    }
+    state->writer.write_last_literals( state->pending_literals );
+    if ( state->writer.failed() )
+    {
+        return std::nullopt;
+    }
+    return state->writer.size();
+}
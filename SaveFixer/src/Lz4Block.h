@@ -0,0 +1,278 @@
+#pragma once
+
+#include "Common.h"
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace save_fixer
+{
+    class TaskGroup;
+    class ThreadPool;
+
+    // A change to the decompressed contents of an LZ4 block. The offset and original size are in
+    // the original contents.
+    struct Lz4Edit
+    {
+        size_t offset;
+        size_t original_size;
+        std::span< std::byte const > new_bytes;
+    };
+
+    // The contents of a block with edits applied, read without making the edited copy. A range
+    // that no edit changed is read straight from the original contents, and only ranges with edits
+    // in them are gathered. The edits must be sorted, must not overlap and must be inside the
+    // original contents, which must outlive this, as must the new bytes of the edits.
+    class Lz4EditedData
+    {
+    public:
+        Lz4EditedData( std::span< std::byte const > original, std::vector< Lz4Edit > edits );
+
+        std::span< std::byte const > get_original() const { return original; }
+        std::span< Lz4Edit const > get_edits() const { return edits; }
+        size_t size() const { return new_size; }
+
+        // The bytes from start to end, which are a view of the original contents if no edit is in
+        // them, else gathered into scratch
+        std::span< std::byte const > read( size_t start, size_t end, std::vector< std::byte > &scratch ) const;
+
+        // Copies the bytes from start to end to output in one pass
+        void gather( size_t start, size_t end, std::byte *output ) const;
+
+    private:
+        // The first edit that ends after pos in the new contents, or the number of edits
+        size_t find_edit( size_t pos ) const;
+
+        // How far the new contents are moved from the original up to edit i
+        size_t get_shift( size_t i ) const;
+
+        std::span< std::byte const > original;
+        std::vector< Lz4Edit > edits;
+        std::vector< size_t > new_offsets;    // Where each edit is in the new contents
+        size_t new_size = 0;
+    };
+
+    // How a block is compressed. Every method writes the same block format, so the game can read
+    // any of them, they only trade time for size.
+    struct Lz4Compression
+    {
+        enum class Method
+        {
+            fast,    // LZ4's own compressor, the level is its acceleration where higher is faster
+            high,    // A hash chain search for longer matches, like LZ4HC, with levels 3 to 12
+        };
+
+        Method method = Method::fast;
+        int level = 1;
+    };
+
+    constexpr int lz4_max_acceleration = 65537;
+    constexpr int lz4_min_high_level = 3;
+    constexpr int lz4_default_high_level = 9;
+    constexpr int lz4_max_high_level = 12;
+
+    // The highest level that is expected to compress size bytes on one thread within time_budget,
+    // or the fast method if none is
+    Lz4Compression lz4_choose_compression( size_t size, std::chrono::nanoseconds time_budget );
+
+    // Compresses new_data, which is the contents of original_block with edits applied, into a
+    // single LZ4 block. Sequences of the original block that cannot see an edited byte are copied
+    // as they are, and only the sequences that can are compressed again, so a small edit costs
+    // little more than a copy, and only the new data near the edits is read.
+    //
+    // Returns the compressed size, or nullopt if the output is too small, an edit replaces none of
+    // the original bytes or the original block is not valid, in which case the caller should
+    // compress new_data in full.
+    std::optional< size_t > lz4_recompress_edited_block( std::span< std::byte const > original_block,
+                                                         Lz4EditedData const &new_data,
+                                                         std::span< std::byte > output );
+
+    // Decompresses a single LZ4 block a slice at a time, so the start of the output can be used
+    // while the rest is still being decompressed.
+    class Lz4SliceDecompressor
+    {
+    public:
+        Lz4SliceDecompressor( std::span< std::byte const > block, std::span< std::byte > output );
+
+        // Everything before this in the output has been decompressed
+        size_t decompressed_size() const { return output_pos; }
+        bool is_finished() const { return input_pos == block.size() && output_pos == output.size(); }
+
+        // Decompresses at least slice_size more bytes, or the rest of the block. Returns false if
+        // the block is not valid or does not exactly fill the output.
+        bool decompress_next( size_t slice_size );
+
+    private:
+        bool decompress_part( size_t input_end, size_t output_end );
+
+        std::span< std::byte const > block;
+        std::span< std::byte > output;
+        size_t input_pos = 0;
+        size_t output_pos = 0;
+    };
+
+    // A point in a single LZ4 block where decompressing can start again. The block is cut just
+    // after the literals of a sequence, as Lz4SliceDecompressor does, so that LZ4 can decompress
+    // the part before the cut as if it were a whole block, and the match of the cut sequence is
+    // copied by hand.
+    struct Lz4Checkpoint
+    {
+        size_t cut_input_offset;     // Just after the literals of the cut sequence
+        size_t cut_output_offset;
+        size_t match_offset;         // The match of the cut sequence
+        size_t match_size;
+        size_t input_offset;         // The sequence after the cut
+        size_t output_offset;
+        std::vector< std::byte > window;    // The up to 64KB of output before output_offset
+    };
+
+    // Checkpoints every so often through a single LZ4 block, each with the output that the matches
+    // after it can reach, so that a range of the output is decompressed from the checkpoint before
+    // it rather than from the start of the block, and the parts between checkpoints can be
+    // decompressed at the same time.
+    class Lz4Checkpoints
+    {
+    public:
+        Lz4Checkpoints() = default;
+
+        // The checkpoints must be in order. They are only checked as far as is needed to never
+        // read or write out of bounds, so ones for a different block give the wrong output.
+        Lz4Checkpoints( std::vector< Lz4Checkpoint > checkpoints, size_t output_size );
+
+        // Takes a checkpoint at the first sequence that can be cut after every interval bytes of
+        // output. output is what the block decompresses to. Returns nullopt if the block is not
+        // valid or does not decompress to output's size.
+        static std::optional< Lz4Checkpoints > build( std::span< std::byte const > block,
+                                                      std::span< std::byte const > output, size_t interval );
+
+        std::span< Lz4Checkpoint const > get_checkpoints() const { return checkpoints; }
+        size_t get_output_size() const { return output_size; }
+
+        // Decompresses the bytes from start to end of the block's output, from the last checkpoint
+        // at or before start. Returns false if the block is not valid.
+        bool decompress_range( std::span< std::byte const > block, size_t start, size_t end,
+                               std::span< std::byte > output ) const;
+
+        // Decompresses the whole block, with the parts between checkpoints decompressed on the pool
+        // at the same time. Returns false if the block is not valid.
+        bool decompress( std::span< std::byte const > block, std::span< std::byte > output, ThreadPool &pool ) const;
+
+    private:
+        // Part i runs from checkpoint i - 1, or the start of the block, to checkpoint i, or the end
+        // of the block
+        size_t get_part_input_start( size_t i ) const { return ( i == 0 ) ? 0 : checkpoints[ i - 1 ].input_offset; }
+        size_t get_part_start( size_t i ) const { return ( i == 0 ) ? 0 : checkpoints[ i - 1 ].output_offset; }
+        size_t get_part_end( size_t i ) const
+        {
+            return ( i == checkpoints.size() ) ? output_size : checkpoints[ i ].output_offset;
+        }
+
+        // Decompresses part i into output, which must be exactly its size, with dictionary as the
+        // output before it
+        bool decompress_part( std::span< std::byte const > block, size_t i, std::span< std::byte > output,
+                              std::span< std::byte const > dictionary ) const;
+
+        std::vector< Lz4Checkpoint > checkpoints;
+        size_t output_size = 0;
+    };
+
+    // Decompresses a single LZ4 block in order through a window of the last 64KB of output, which
+    // is all that its matches can reach, so the output is seen a piece at a time and is never held
+    // in full however large the block is. The sequences are copied here rather than by LZ4, as LZ4
+    // needs the whole output, or a slice of it that no match runs past, to write into.
+    class Lz4StreamDecompressor
+    {
+    public:
+        // The block must decompress to exactly output_size bytes
+        Lz4StreamDecompressor( std::span< std::byte const > block, size_t output_size );
+
+        // Everything before this in the output has been returned by next()
+        size_t decompressed_size() const { return output_pos; }
+        bool is_finished() const { return output_pos == output_size && input_pos == block.size(); }
+
+        // The next piece of the output, which stays valid until the next call, or an empty span once
+        // the block is finished. Returns nullopt if the block is not valid or does not decompress to
+        // output_size bytes.
+        std::optional< std::span< std::byte const > > next();
+
+    private:
+        std::span< std::byte const > block;
+        size_t output_size;
+        size_t input_pos = 0;
+        size_t output_pos = 0;
+
+        // What is left of the sequence being copied
+        size_t literal_pos = 0;
+        size_t literals_left = 0;
+        size_t match_offset = 0;
+        size_t match_left = 0;
+
+        // The window followed by the piece being decompressed
+        std::vector< std::byte > buffer;
+        size_t buffer_used = 0;
+    };
+
+    // Compresses a single LZ4 block on a thread pool. The input is split into fixed size chunks
+    // that are compressed at the same time, each with the 64KB before it as a dictionary, and
+    // their sequences are joined into one block. The output depends only on the input, never on
+    // the number of threads.
+    //
+    // The input is read through its edits, so only the chunks near an edit are gathered, one at a
+    // time into a buffer for each thread, and the edited input is never copied in full.
+    class Lz4ParallelCompressor
+    {
+    public:
+        explicit Lz4ParallelCompressor( Lz4EditedData const &input, Lz4Compression compression = {} );
+        ~Lz4ParallelCompressor();
+
+        Lz4ParallelCompressor( Lz4ParallelCompressor const & ) = delete;
+        Lz4ParallelCompressor &operator=( Lz4ParallelCompressor const & ) = delete;
+
+        // Queues a task for each chunk. The input must stay valid until finish() returns.
+        void start( ThreadPool &pool, TaskGroup &group );
+
+        // Joins the compressed chunks once the group has finished. Returns the compressed size, or
+        // nullopt if a chunk failed to compress or the output is too small.
+        std::optional< size_t > finish( std::span< std::byte > output ) const;
+
+    private:
+        struct Chunk;
+
+        Lz4EditedData const &input;
+        Lz4Compression compression;
+        std::vector< std::unique_ptr< Chunk > > chunks;
+    };
+
+    // Compresses a single LZ4 block from input that is written to it a piece at a time, so the input
+    // is never held in full. It is compressed in the same chunks as Lz4ParallelCompressor, each with
+    // the 64KB before it as a dictionary, and gives the same block, only on one thread. Just the
+    // chunk being filled and the window before it are held, along with the literals at the end of
+    // the last chunk that are left over for the next. Once there are more than 64KB of those they
+    // are written to the output ahead of their sequence.
+    class Lz4StreamCompressor
+    {
+    public:
+        // The output must be large enough for the compressed block of all the input
+        explicit Lz4StreamCompressor( std::span< std::byte > output, Lz4Compression compression = {} );
+        ~Lz4StreamCompressor();
+
+        Lz4StreamCompressor( Lz4StreamCompressor const & ) = delete;
+        Lz4StreamCompressor &operator=( Lz4StreamCompressor const & ) = delete;
+
+        // Adds input to the end of the block. Returns false if a chunk failed to compress or the
+        // output is too small, after which the compressor cannot be used.
+        bool write( std::span< std::byte const > input );
+
+        // Compresses the rest of the input and ends the block. Returns the compressed size, or
+        // nullopt on the same errors as write().
+        std::optional< size_t > finish();
+
+    private:
+        struct State;
+
+        std::unique_ptr< State > state;
+    };
+}
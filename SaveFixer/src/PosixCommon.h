@@ -0,0 +1,90 @@
+#pragma once
+
+#ifdef _WIN32
+#error
+#endif
+
+#include "Common.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace save_fixer
+{
+    [[noreturn]] inline void throw_posix_error( std::u8string_view const description, int const error_number )
+    {
+        std::u8string err( description );
+        err.append( u8" ("s ).append( char_as_u8( std::strerror( error_number ) ) ).push_back( u8')' );
+        throw SaveFixerException( std::move( err ) );
+    }
+
+    [[noreturn]] inline void throw_posix_error( std::u8string_view const description )
+    {
+        throw_posix_error( description, errno );
+    }
+
+    [[noreturn]] inline void throw_posix_error( std::u8string_view const description,
+                                                std::u8string_view const file_path, int const error_number )
+    {
+        std::u8string err( description );
+        err.append( u8" \""s )
+            .append( file_path )
+            .append( u8"\" ("s )
+            .append( char_as_u8( std::strerror( error_number ) ) )
+            .push_back( u8')' );
+        throw SaveFixerException( std::move( err ) );
+    }
+
+    [[noreturn]] inline void throw_posix_error( std::u8string_view const description,
+                                                std::u8string_view const file_path )
+    {
+        throw_posix_error( description, file_path, errno );
+    }
+
+    struct FileDescriptorTraits
+    {
+        using HandleType = int;
+        static constexpr int null_value = -1;
+        static void close( int fd ) { ::close( fd ); }
+    };
+
+    using UniqueFileDescriptor = UniqueHandle< FileDescriptorTraits >;
+
+    inline char const *as_path( std::u8string const &file_path )
+    {
+        return u8_as_char( file_path.c_str() );
+    }
+
+    // Throw SaveFixerException on error
+    UniqueFileDescriptor open_file( std::u8string const &file_path, int flags );
+    size_t get_file_size( UniqueFileDescriptor const &file, std::u8string const &file_path );
+
+    // A new file that is written without a name, or with a temporary name if the file system does
+    // not support unnamed files, and is then given its real name as atomically as possible. A
+    // temporary file is removed if the file is abandoned.
+    class PendingFile
+    {
+    public:
+        // Throws SaveFixerException on error
+        PendingFile( std::u8string temp_file_path, bool allow_temp_overwrite );
+        ~PendingFile();
+
+        PendingFile( PendingFile && ) noexcept = default;
+        PendingFile &operator=( PendingFile && ) = delete;
+
+        int get() const { return file.get(); }
+        std::u8string const &get_temp_file_path() const { return temp_file_path; }
+
+        // Throws SaveFixerException on error
+        void resize( size_t size ) const;
+        void commit( std::u8string const &new_file_path, bool allow_overwrite );
+
+    private:
+        std::u8string temp_file_path;
+        bool is_named;
+        bool allow_temp_overwrite;
+        UniqueFileDescriptor file;
+    };
+}
@@ -0,0 +1,532 @@
+#ifdef _WIN32
+#error
+#endif
+
+#include "FileSystem.h"
+
+#include "PosixCommon.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <limits>
+
+using namespace save_fixer;
+
+namespace
+{
+    [[noreturn]] void throw_file_error( std::u8string_view const description, std::u8string_view const file_path )
+    {
+        std::u8string err;
+        err.append( description ).append( u8" \""s ).append( file_path ).push_back( u8'"' );
+        throw SaveFixerException( std::move( err ) );
+    }
+
+    struct MappedView
+    {
+        void *address;
+        size_t size;
+
+        bool operator==( MappedView const & ) const = default;
+    };
+    struct ViewHandleTraits
+    {
+        using HandleType = MappedView;
+        static constexpr MappedView null_value = { nullptr, 0 };
+        static void close( MappedView v ) { ::munmap( v.address, v.size ); }
+    };
+
+    using UniqueViewHandle = UniqueHandle< ViewHandleTraits >;
+
+    std::u8string directory_of( std::u8string const &file_path )
+    {
+        if ( size_t const last_sep = file_path.find_last_of( u8'/' ); last_sep == std::u8string::npos )
+        {
+            return u8"."s;
+        }
+        else if ( last_sep == 0 )
+        {
+            return u8"/"s;
+        }
+        else
+        {
+            return file_path.substr( 0, last_sep );
+        }
+    }
+
+    // Creates an unnamed file in the directory that will contain file_path, so an interrupted
+    // write never leaves a temporary file behind. Returns an invalid descriptor if the file
+    // system does not support O_TMPFILE.
+    UniqueFileDescriptor open_anonymous_file( [[maybe_unused]] std::u8string const &file_path )
+    {
+#ifdef O_TMPFILE
+        std::u8string const directory = directory_of( file_path );
+        UniqueFileDescriptor fd( ::open( as_path( directory ), O_TMPFILE | O_RDWR | O_CLOEXEC, 0666 ) );
+        if ( fd.is_valid() )
+        {
+            return fd;
+        }
+        else if ( errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL )
+        {
+            throw_posix_error( u8"failed to create file", file_path );
+        }
+#endif
+        return UniqueFileDescriptor();
+    }
+
+    void resize_file( UniqueFileDescriptor const &file, std::u8string const &file_path, size_t const size )
+    {
+        if ( std::cmp_greater( size, std::numeric_limits< off_t >::max() ) ||
+             ::ftruncate( file.get(), static_cast< off_t >( size ) ) != 0 )
+        {
+            throw_posix_error( u8"internal error: failed to resize file", file_path );
+        }
+    }
+
+    std::pair< UniqueViewHandle, std::span< std::byte const > >
+    map_read_view_of_file( UniqueFileDescriptor const &file, std::u8string const &file_path, size_t const size,
+                           read_access const access )
+    {
+        if ( size == 0 )
+        {
+            return { UniqueViewHandle(), std::span< std::byte const >() };
+        }
+
+        void *const view = ::mmap( nullptr, size, PROT_READ, MAP_SHARED, file.get(), 0 );
+        if ( view == MAP_FAILED )
+        {
+            throw_posix_error( u8"internal error: failed to map file", file_path );
+        }
+
+        // A whole save file is read from front to back exactly once by the decompressor, otherwise
+        // only the pages that are touched should be read. The advice is only a hint so failures
+        // are ignored.
+        if ( access == read_access::whole_file )
+        {
+            ::madvise( view, size, MADV_SEQUENTIAL );
+            ::madvise( view, size, MADV_WILLNEED );
+        }
+        else
+        {
+            ::madvise( view, size, MADV_RANDOM );
+        }
+
+        return { UniqueViewHandle( MappedView{ view, size } ),
+                 std::span( static_cast< std::byte const * >( view ), size ) };
+    }
+
+    std::pair< UniqueViewHandle, std::span< std::byte > >
+    map_write_view_of_file( int const fd, std::u8string const &file_path, size_t const size )
+    {
+        if ( size == 0 )
+        {
+            return { UniqueViewHandle(), std::span< std::byte >() };
+        }
+
+        void *const view = ::mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        if ( view == MAP_FAILED )
+        {
+            throw_posix_error( u8"internal error: failed to map file", file_path );
+        }
+        return { UniqueViewHandle( MappedView{ view, size } ), std::span( static_cast< std::byte * >( view ), size ) };
+    }
+
+    // Gives an unnamed file a name, failing if new_file_path already exists
+    bool link_anonymous_file( UniqueFileDescriptor const &file, std::u8string const &new_file_path )
+    {
+        std::string const proc_path = "/proc/self/fd/"s + std::to_string( file.get() );
+        if ( ::linkat( AT_FDCWD, proc_path.c_str(), AT_FDCWD, as_path( new_file_path ), AT_SYMLINK_FOLLOW ) == 0 )
+        {
+            return true;
+        }
+        else if ( errno == EEXIST )
+        {
+            return false;
+        }
+        throw_posix_error( u8"failed to write file", new_file_path );
+    }
+
+    // Renames a file, failing if new_file_path already exists
+    void rename_no_replace( std::u8string const &old_file_path, std::u8string const &new_file_path )
+    {
+#ifdef RENAME_NOREPLACE
+        if ( ::renameat2( AT_FDCWD, as_path( old_file_path ), AT_FDCWD, as_path( new_file_path ),
+                          RENAME_NOREPLACE ) == 0 )
+        {
+            return;
+        }
+        else if ( errno != EINVAL && errno != ENOSYS )
+        {
+            throw_posix_error( u8"failed to write file", new_file_path );
+        }
+#endif
+        // Not every file system supports RENAME_NOREPLACE, but link() never replaces its target
+        if ( ::link( as_path( old_file_path ), as_path( new_file_path ) ) != 0 )
+        {
+            throw_posix_error( u8"failed to write file", new_file_path );
+        }
+        ::unlink( as_path( old_file_path ) );
+    }
+}
+
+path_state save_fixer::query_file( std::u8string const &file_path )
+{
+    struct stat st;
+    if ( ::stat( as_path( file_path ), &st ) == 0 )
+    {
+        if ( S_ISDIR( st.st_mode ) )
+        {
+            return path_state::directory;
+        }
+        else if ( ::access( as_path( file_path ), W_OK ) != 0 )
+        {
+            return path_state::file_readonly;
+        }
+        else
+        {
+            return path_state::file;
+        }
+    }
+    else if ( errno == ENOENT || errno == ENOTDIR )
+    {
+        return path_state::does_not_exist;
+    }
+    else
+    {
+        throw_posix_error( u8"internal error: failed to query file", file_path );
+    }
+}
+
+//-----------------------------------------------------------------------------
+// ReadFileMapping
+//-----------------------------------------------------------------------------
+
+class ReadFileMapping::impl
+{
+public:
+    impl( UniqueViewHandle vh, std::span< std::byte const > v ) : view_handle( std::move( vh ) ), view( v ) {}
+
+    UniqueViewHandle view_handle;
+    std::span< std::byte const > view;
+};
+
+ReadFileMapping::ReadFileMapping( std::u8string const &file_path, read_access const access )
+{
+    // The file descriptor does not need to remain open after the mapping has been created.
+    UniqueFileDescriptor const file = open_file( file_path, O_RDONLY );
+    size_t const file_size = get_file_size( file, file_path );
+
+    auto [ view_handle, view_span ] = map_read_view_of_file( file, file_path, file_size, access );
+
+    pimpl = std::make_unique< impl >( std::move( view_handle ), view_span );
+}
+
+ReadFileMapping::~ReadFileMapping() = default;
+ReadFileMapping::ReadFileMapping( ReadFileMapping && ) noexcept = default;
+ReadFileMapping &ReadFileMapping::operator=( ReadFileMapping && ) noexcept = default;
+
+std::span< std::byte const > ReadFileMapping::bytes() const
+{
+    return pimpl->view;
+}
+
+//-----------------------------------------------------------------------------
+// Files
+//-----------------------------------------------------------------------------
+
+UniqueFileDescriptor save_fixer::open_file( std::u8string const &file_path, int const flags )
+{
+    UniqueFileDescriptor fd( ::open( as_path( file_path ), flags | O_CLOEXEC, 0666 ) );
+    if ( fd.is_valid() )
+    {
+        return fd;
+    }
+    else if ( flags & O_CREAT )
+    {
+        throw_posix_error( u8"failed to create file", file_path );
+    }
+    else if ( errno == ENOENT )
+    {
+        throw_file_error( u8"could not find file", file_path );
+    }
+    else
+    {
+        throw_posix_error( u8"failed to open file", file_path );
+    }
+}
+
+size_t save_fixer::get_file_size( UniqueFileDescriptor const &file, std::u8string const &file_path )
+{
+    struct stat st;
+    if ( ::fstat( file.get(), &st ) != 0 )
+    {
+        throw_posix_error( u8"internal error: failed to get file size", file_path );
+    }
+    return static_cast< size_t >( st.st_size );
+}
+
+//-----------------------------------------------------------------------------
+// PendingFile
+//-----------------------------------------------------------------------------
+
+PendingFile::PendingFile( std::u8string path, bool const allow_overwrite )
+    : temp_file_path( std::move( path ) ), allow_temp_overwrite( allow_overwrite )
+{
+    // Prefer an unnamed file, temp_file_path is only used if the file system cannot create one
+    file = open_anonymous_file( temp_file_path );
+    is_named = !file.is_valid();
+    if ( is_named )
+    {
+        file = open_file( temp_file_path, O_RDWR | O_CREAT | O_TRUNC | ( allow_temp_overwrite ? 0 : O_EXCL ) );
+    }
+}
+
+PendingFile::~PendingFile()
+{
+    // A named temporary file that was never renamed is an abandoned write
+    if ( is_named && file.is_valid() )
+    {
+        ::unlink( as_path( temp_file_path ) );
+    }
+}
+
+void PendingFile::resize( size_t const size ) const
+{
+    resize_file( file, temp_file_path, size );
+}
+
+void PendingFile::commit( std::u8string const &new_file_path, bool const allow_overwrite )
+{
+    if ( is_named )
+    {
+        if ( allow_overwrite )
+        {
+            if ( ::rename( as_path( temp_file_path ), as_path( new_file_path ) ) != 0 )
+            {
+                throw_posix_error( u8"failed to write file", new_file_path );
+            }
+        }
+        else
+        {
+            rename_no_replace( temp_file_path, new_file_path );
+        }
+        file.reset();
+    }
+    else if ( !link_anonymous_file( file, new_file_path ) )
+    {
+        if ( !allow_overwrite )
+        {
+            throw_posix_error( u8"failed to write file", new_file_path, EEXIST );
+        }
+
+        // Replacing a file atomically needs a rename, so the file is briefly given the temporary
+        // name. Nothing is left behind if linking fails.
+        if ( allow_temp_overwrite )
+        {
+            ::unlink( as_path( temp_file_path ) );
+        }
+        if ( !link_anonymous_file( file, temp_file_path ) )
+        {
+            throw_posix_error( u8"failed to write file", temp_file_path, EEXIST );
+        }
+        if ( ::rename( as_path( temp_file_path ), as_path( new_file_path ) ) != 0 )
+        {
+            int const err = errno;
+            ::unlink( as_path( temp_file_path ) );
+            throw_posix_error( u8"failed to write file", new_file_path, err );
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// WriteFileMapping
+//-----------------------------------------------------------------------------
+
+class WriteFileMapping::impl
+{
+public:
+    impl( PendingFile f, UniqueViewHandle vh, std::span< std::byte > v )
+        : file( std::move( f ) ), view_handle( std::move( vh ) ), view( v )
+    {
+    }
+
+    PendingFile file;
+    UniqueViewHandle view_handle;
+    std::span< std::byte > view;
+};
+
+WriteFileMapping::WriteFileMapping( std::u8string const &file_path, size_t const size, bool const allow_overwrite )
+{
+    PendingFile file( file_path, allow_overwrite );
+    file.resize( size );
+
+    auto [ view_handle, view_span ] = map_write_view_of_file( file.get(), file_path, size );
+
+    pimpl = std::make_unique< impl >( std::move( file ), std::move( view_handle ), view_span );
+}
+
+WriteFileMapping::~WriteFileMapping() = default;
+WriteFileMapping::WriteFileMapping( WriteFileMapping && ) noexcept = default;
+WriteFileMapping &WriteFileMapping::operator=( WriteFileMapping && ) noexcept = default;
+
+std::span< std::byte > WriteFileMapping::bytes()
+{
+    return pimpl->view;
+}
+size_t WriteFileMapping::size() const
+{
+    return pimpl->view.size();
+}
+
+void WriteFileMapping::write_truncate_and_rename( WriteFileMapping &&mapping, std::u8string const &new_file_path,
+                                                  size_t new_size, bool allow_overwrite )
+{
+    impl &m = *mapping.pimpl;
+    size_t const old_size = m.view.size();
+
+    m.view_handle.reset();
+    m.view = std::span< std::byte >();
+
+    if ( new_size != old_size )
+    {
+        m.file.resize( new_size );
+    }
+    m.file.commit( new_file_path, allow_overwrite );
+}
+
+//-----------------------------------------------------------------------------
+// TempFileMapping
+//-----------------------------------------------------------------------------
+
+class TempFileMapping::impl
+{
+public:
+    impl( UniqueViewHandle vh, std::span< std::byte > v ) : view_handle( std::move( vh ) ), view( v ) {}
+
+    UniqueViewHandle view_handle;
+    std::span< std::byte > view;
+};
+
+TempFileMapping::TempFileMapping( std::u8string const &near_file_path, size_t const size )
+{
+    // Without O_TMPFILE the file is given a unique name and unlinked at once, which leaves it
+    // behind only if the process ends in between
+    UniqueFileDescriptor file = open_anonymous_file( near_file_path );
+    if ( !file.is_valid() )
+    {
+        std::string temp_path( u8_as_char( directory_of( near_file_path ) ) );
+        temp_path.append( "/.mmsavefix-XXXXXX" );
+        file = ::mkostemp( temp_path.data(), O_CLOEXEC );
+        if ( !file.is_valid() )
+        {
+            throw_posix_error( u8"failed to create file", char_as_u8( temp_path ) );
+        }
+        ::unlink( temp_path.c_str() );
+    }
+    resize_file( file, near_file_path, size );
+
+    // The file descriptor does not need to remain open after the mapping has been created
+    auto [ view_handle, view_span ] = map_write_view_of_file( file.get(), near_file_path, size );
+    pimpl = std::make_unique< impl >( std::move( view_handle ), view_span );
+}
+
+TempFileMapping::~TempFileMapping() = default;
+TempFileMapping::TempFileMapping( TempFileMapping && ) noexcept = default;
+TempFileMapping &TempFileMapping::operator=( TempFileMapping && ) noexcept = default;
+
+std::span< std::byte > TempFileMapping::bytes() const
+{
+    return pimpl->view;
+}
+
+//-----------------------------------------------------------------------------
+// LargeBuffer
+//-----------------------------------------------------------------------------
+
+namespace
+{
+    // Buffers smaller than a huge page are left to new, as they take few page faults to fill anyway
+    constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+    size_t round_up_to_huge_pages( size_t const size )
+    {
+        return ( size + huge_page_size - 1 ) & ~( huge_page_size - 1 );
+    }
+
+    // Reserved huge pages, which most systems have none of unless they are set up for them
+    std::byte *map_reserved_huge_pages( [[maybe_unused]] size_t const size )
+    {
+#ifdef MAP_HUGETLB
+        void *const view =
+            ::mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0 );
+        return view != MAP_FAILED ? static_cast< std::byte * >( view ) : nullptr;
+#else
+        return nullptr;
+#endif
+    }
+
+    // Ordinary pages which transparent huge pages can be used for, aligned to a huge page so that
+    // all of them can be
+    std::byte *map_transparent_huge_pages( size_t const size )
+    {
+        size_t const unaligned_size = size + huge_page_size;
+        void *const view = ::mmap( nullptr, unaligned_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( view == MAP_FAILED )
+        {
+            return nullptr;
+        }
+
+        std::byte *const unaligned = static_cast< std::byte * >( view );
+        std::byte *const aligned = reinterpret_cast< std::byte * >(
+            round_up_to_huge_pages( reinterpret_cast< uintptr_t >( unaligned ) ) );
+        if ( aligned != unaligned )
+        {
+            ::munmap( unaligned, static_cast< size_t >( aligned - unaligned ) );
+        }
+        ::munmap( aligned + size, static_cast< size_t >( unaligned + unaligned_size - ( aligned + size ) ) );
+
+        // Both are only hints, and faulting the pages in is left to the code that fills the
+        // buffer if the system does not support it
+#ifdef MADV_HUGEPAGE
+        ::madvise( aligned, size, MADV_HUGEPAGE );
+#endif
+#ifdef MADV_POPULATE_WRITE
+        ::madvise( aligned, size, MADV_POPULATE_WRITE );
+#endif
+        return aligned;
+    }
+}
+
+LargeBuffer::LargeBuffer( size_t const size ) : buffer_size( size )
+{
+    if ( size >= huge_page_size )
+    {
+        size_t const rounded_size = round_up_to_huge_pages( size );
+        buffer = map_reserved_huge_pages( rounded_size );
+        if ( buffer == nullptr )
+        {
+            buffer = map_transparent_huge_pages( rounded_size );
+        }
+        if ( buffer != nullptr )
+        {
+            mapped_size = rounded_size;
+            return;
+        }
+    }
+    buffer = new std::byte[ size ];
+}
+
+void LargeBuffer::release()
+{
+    if ( mapped_size != 0 )
+    {
+        ::munmap( buffer, mapped_size );
+    }
+    else
+    {
+        delete[] buffer;
+    }
+}
@@ -1,11 +1,25 @@
 #include "SaveFile.h"
 
+#include "CacheFile.h"
 #include "FileSystem.h"
+#include "JsonIndex.h"
+#include "JsonRefTable.h"
+#include "Lz4Block.h"
+#include "SectionCache.h"
+#include "ThreadPool.h"
 
 #include "lz4.h"
 
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <span>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 
 using namespace save_fixer;
 
@@ -54,14 +68,30 @@ namespace
         }
     }
 
-    template < typename T >
-    size_t lz4_max_compressed_size( std::span< T > const input_data )
+    // Decompresses at least target_size bytes from the start of the block into output_buffer, but
+    // usually stops well before the end of the block. Returns the number of bytes decompressed.
+    size_t lz4_decompress_prefix( std::span< std::byte const > compressed_data, std::span< std::byte > output_buffer,
+                                  size_t const target_size, std::u8string const &file_path )
+    {
+        int const result = LZ4_decompress_safe_partial( reinterpret_cast< char const * >( compressed_data.data() ),
+                                                        reinterpret_cast< char * >( output_buffer.data() ),
+                                                        static_cast< int >( compressed_data.size() ),
+                                                        static_cast< int >( target_size ),
+                                                        static_cast< int >( output_buffer.size() ) );
+        if ( result < 0 || std::cmp_less( result, std::min( target_size, output_buffer.size() ) ) )
+        {
+            throw SaveFixerException( file_path + u8" is invalid or corrupted" );
+        }
+        return static_cast< size_t >( result );
+    }
+
+    size_t lz4_max_compressed_size( size_t const input_size )
     {
-        if ( std::cmp_greater( input_data.size_bytes(), std::numeric_limits< int >::max() ) )
+        if ( std::cmp_greater( input_size, std::numeric_limits< int >::max() ) )
         {
             throw SaveFixerException( u8"output too large" );
         }
-        return static_cast< size_t >( LZ4_compressBound( static_cast< int >( input_data.size_bytes() ) ) );
+        return static_cast< size_t >( LZ4_compressBound( static_cast< int >( input_size ) ) );
     }
 
     // Returns the size of the compressed data in the output buffer
@@ -85,6 +115,16 @@ namespace
     constexpr int mm_save_file_magic = 1932684653;
     constexpr int mm_save_file_supported_version = 4;
     constexpr size_t max_decompressed_buffer_size = 4ULL * 1024ULL * 1024ULL * 1024ULL;
+    constexpr size_t initial_info_prefix_size = 4ULL * 1024ULL;
+
+    // Data sections at least this large are searched while they are being decompressed
+    constexpr size_t min_pipelined_data_size = 8ULL * 1024ULL * 1024ULL;
+    constexpr size_t pipeline_slice_size = 1024ULL * 1024ULL;
+    constexpr size_t data_decompression_failed = std::numeric_limits< size_t >::max();
+
+    // The index of a data section up to this size is kept by the thread that built it, for the
+    // next save it opens. It takes about half as many bytes as the section.
+    constexpr size_t max_kept_data_index_size = 8ULL * 1024ULL * 1024ULL;
 
     struct SaveFileHeader
     {
@@ -122,6 +162,13 @@ namespace
             throw SaveFixerException( err );
         }
 
+        size_t const total_compressed_size = static_cast< size_t >( header->compressed_info_size ) +
+                                             static_cast< size_t >( header->compressed_data_size );
+        if ( file_data.size() - sizeof( SaveFileHeader ) < total_compressed_size )
+        {
+            throw SaveFixerException( file_path + u8" is invalid or corrupted" );
+        }
+
         size_t const total_decompressed_size = static_cast< size_t >( header->decompressed_info_size ) +
                                                static_cast< size_t >( header->decompressed_data_size );
         if ( total_decompressed_size > max_decompressed_buffer_size )
@@ -147,6 +194,8 @@ namespace
     // Note that for the for the sake of performance this code does not fully parse the JSON,
     // instead it relies on string searches and just enough parsing to find a key within an
     // object. It also tends to assume the JSON is valid and does not contain any optional whitespace.
+    // Strings, objects and arrays are skipped using a JsonIndex of the section rather than by
+    // reading every byte.
 
     [[noreturn]] void throw_for_invalid_json()
     {
@@ -158,188 +207,64 @@ namespace
         return s.substr( a + 1, ( b - a ) - 1 );
     }
 
-    size_t count_preceeding_backslashes( std::u8string_view const json_data, size_t const offset )
-    {
-        if ( offset == 0 )
-        {
-            return 0;
-        }
-
-        for ( size_t i = offset - 1;; --i )
-        {
-            if ( json_data[ i ] != u8'\\' )
-            {
-                return ( offset - i ) - 1;
-            }
-            if ( i == 0 )
-            {
-                return offset - i;
-            }
-        }
-    }
-
-    // Returns the offset of the matching quote, or throws
-    size_t find_closing_quote( std::u8string_view const json_data, size_t const offset_of_opening_quote )
-    {
-        bool escaped = false;
-        for ( size_t i = offset_of_opening_quote + 1; i < json_data.size(); ++i )
-        {
-            switch ( json_data[ i ] )
-            {
-                case u8'\\':
-                    escaped = !escaped;
-                    break;
-                case u8'"':
-                    if ( !escaped )
-                    {
-                        return i;
-                    }
-                    [[fallthrough]];
-                default:
-                    escaped = false;
-                    break;
-            }
-        }
-        throw_for_invalid_json();
-    }
-
     // Returns the offset of the matching quote, or throws
-    size_t rfind_opening_quote( std::u8string_view const json_data, size_t const offset_of_closing_quote )
+    size_t find_closing_quote( JsonIndex const &json, size_t const offset_of_opening_quote )
     {
-        if ( offset_of_closing_quote != 0 )
+        size_t const closing_quote = json.find_quote( offset_of_opening_quote + 1 );
+        if ( closing_quote == JsonIndex::npos )
         {
-            for ( size_t i = offset_of_closing_quote - 1;; --i )
-            {
-                if ( json_data[ i ] == u8'"' )
-                {
-                    if ( size_t const escape_count = count_preceeding_backslashes( json_data, i );
-                         escape_count == 0 )
-                    {
-                        return i;
-                    }
-                    else if ( escape_count % 2 == 1 )
-                    {
-                        i -= escape_count;
-                    }
-                    else
-                    {
-                        throw_for_invalid_json();
-                    }
-                }
-                if ( i == 0 )
-                {
-                    break;
-                }
-            }
+            throw_for_invalid_json();
         }
-        throw_for_invalid_json();
+        return closing_quote;
     }
 
     // Returns the offset of the closing brace, or throws
     // starting_offset must be after the opening brace, before or on the target closing brace,
-    //     not within a string, not at the closing quote of a string, and not within a sub-object or array
+    //     not within a string, and not within a sub-object or array
     // brace must be '}' or ']'
-    size_t find_closing_brace( std::u8string_view const json_data, size_t const starting_offset, char8_t const brace )
+    size_t find_closing_brace( JsonIndex const &json, size_t const starting_offset, char8_t const brace )
     {
-        size_t closing_brace_stack_after_push = 0;
-        size_t closing_brace_stack_after_pop = 0;
-
-        std::vector< char8_t > closing_brace_stack{ brace };
-        for ( size_t i = starting_offset; i < json_data.size(); ++i )
+        size_t const closing_brace = json.find_unmatched_close( starting_offset );
+        if ( closing_brace == JsonIndex::npos || json.text()[ closing_brace ] != brace )
         {
-            switch ( json_data[ i ] )
-            {
-                case u8'"':
-                    i = find_closing_quote( json_data, i );
-                    break;
-                case u8'{':
-                case u8'[':
-                    closing_brace_stack.push_back( json_data[ i ] == u8'{' ? u8'}' : u8']' );
-                    closing_brace_stack_after_push = closing_brace_stack.size();
-                    break;
-                case u8'}':
-                case u8']':
-                    if ( json_data[ i ] == closing_brace_stack.back() )
-                    {
-                        closing_brace_stack.pop_back();
-                        closing_brace_stack_after_pop = closing_brace_stack.size();
-                        if ( closing_brace_stack.empty() )
-                        {
-                            return i;
-                        }
-                    }
-                    else
-                    {
-                        throw_for_invalid_json();
-                    }
-                    break;
-                default:
-                    break;    // Skip other characters
-            }
+            throw_for_invalid_json();
         }
-        throw_for_invalid_json();
+        return closing_brace;
     }
 
     // Returns the offset of the opening brace, or throws
     // starting_offset must be before the closing brace, after or on the target opening brace,
-    //     not within a string, not at the opening quote of a string, and not within a sub-object or array
+    //     not within a string, and not within a sub-object or array
     // brace must be '{' or '['
-    size_t rfind_opening_brace( std::u8string_view const json_data, size_t const starting_offset, char8_t const brace )
+    size_t rfind_opening_brace( JsonIndex const &json, size_t const starting_offset, char8_t const brace )
     {
-        std::vector< char8_t > opening_brace_stack{ brace };
-        for ( size_t i = starting_offset;; --i )
+        size_t const opening_brace = json.rfind_unmatched_open( starting_offset );
+        if ( opening_brace == JsonIndex::npos || json.text()[ opening_brace ] != brace )
         {
-            switch ( json_data[ i ] )
-            {
-                case u8'"':
-                    i = rfind_opening_quote( json_data, i );
-                    break;
-                case u8'}':
-                case u8']':
-                    opening_brace_stack.push_back( json_data[ i ] == u8'}' ? u8'{' : u8'[' );
-                    break;
-                case u8'{':
-                case u8'[':
-                    if ( json_data[ i ] == opening_brace_stack.back() )
-                    {
-                        opening_brace_stack.pop_back();
-                        if ( opening_brace_stack.empty() )
-                        {
-                            return i;
-                        }
-                    }
-                    else
-                    {
-                        throw_for_invalid_json();
-                    }
-                    break;
-                default:
-                    break;    // Skip other characters
-            }
-            if ( i == 0 )
-            {
-                throw_for_invalid_json();
-            }
+            throw_for_invalid_json();
         }
+        return opening_brace;
     }
 
     // Returns the offset of the matching brace, or throws
-    size_t find_matching_brace( std::u8string_view const json_data, size_t const offset_of_brace )
+    size_t find_matching_brace( JsonIndex const &json, size_t const offset_of_brace )
     {
+        std::u8string_view const json_data = json.text();
         switch ( json_data[ offset_of_brace ] )
         {
             case u8'{':
             case u8'[':
                 if ( offset_of_brace + 1 < json_data.size() )
                 {
-                    return find_closing_brace( json_data, offset_of_brace + 1,
+                    return find_closing_brace( json, offset_of_brace + 1,
                                                json_data[ offset_of_brace ] == u8'{' ? u8'}' : u8']' );
                 }
+                break;
             case u8'}':
             case u8']':
                 if ( offset_of_brace != 0 )
                 {
-                    return rfind_opening_brace( json_data, offset_of_brace - 1,
+                    return rfind_opening_brace( json, offset_of_brace - 1,
                                                 json_data[ offset_of_brace ] == u8'}' ? u8'{' : u8'[' );
                 }
                 break;
@@ -351,23 +276,28 @@ namespace
 
     // clang-format off
     template < typename F >
-    concept KeyValueCallback = requires( F f, std::u8string_view json, std::u8string_view key, size_t value_offset )
+    concept KeyValueCallback = requires( F f, JsonIndex const &json, std::u8string_view key, size_t value_offset )
     {
         { f( json, key, value_offset ) } -> std::same_as< bool >;
     };
     // clang-format on
 
     // Calls the callback for every key value pair in the object. Breaks if callback returns false.
-    // start_offset must be the opening quote of one of the keys in the object.
     template < KeyValueCallback F >
-    void for_sibling_key_values_in_object( std::u8string_view const json_data, size_t const start_offset, F callback )
+    void for_key_values_in_object( JsonIndex const &json, size_t const object_opening_brace_offset, F callback )
     {
-        // Start with the keys on and after start_offset
-        for ( size_t i = start_offset; i < json_data.size() && json_data[ i ] == u8'"'; )
+        std::u8string_view const json_data = json.text();
+        size_t const start_pos = object_opening_brace_offset + 1;
+        if ( start_pos >= json_data.size() || ( json_data[ start_pos ] != u8'"' && json_data[ start_pos ] != u8'}' ) )
+        {
+            throw_for_invalid_json();
+        }
+
+        for ( size_t i = start_pos; i < json_data.size() && json_data[ i ] == u8'"'; )
         {
             // Key
             size_t const key_start_quote_pos = i;
-            size_t const key_end_quote_pos = find_closing_quote( json_data, key_start_quote_pos );
+            size_t const key_end_quote_pos = find_closing_quote( json, key_start_quote_pos );
             std::u8string_view const key =
                 string_view_between( json_data, key_start_quote_pos, key_end_quote_pos );
 
@@ -378,7 +308,7 @@ namespace
             }
             size_t const value_start_pos = key_end_quote_pos + 2;
 
-            if ( !callback( json_data, key, value_start_pos ) )
+            if ( !callback( json, key, value_start_pos ) )
             {
                 return;
             }
@@ -388,10 +318,10 @@ namespace
                 switch ( json_data[ value_start_pos ] )
                 {
                     case u8'"':
-                        return find_closing_quote( json_data, value_start_pos );
+                        return find_closing_quote( json, value_start_pos );
                     case u8'{':
                     case u8'[':
-                        return find_matching_brace( json_data, value_start_pos );
+                        return find_matching_brace( json, value_start_pos );
                     default:
                         for ( size_t j = value_start_pos + 1; j < json_data.size(); ++j )
                         {
@@ -411,167 +341,268 @@ namespace
                 ++i;
             }
         }
+    }
+
+    //-------------------------------------------------------------------------
+    // Selecting values by a path of keys
+    //-------------------------------------------------------------------------
+
+    // A key given as a template argument, so that a path of keys is fixed at compile time
+    template < size_t N >
+    struct JsonKey
+    {
+        constexpr JsonKey( char8_t const ( &key )[ N ] ) { std::copy_n( key, N - 1, chars.begin() ); }
+        constexpr std::u8string_view view() const { return std::u8string_view( chars.data(), chars.size() ); }
+
+        std::array< char8_t, N - 1 > chars = {};
+    };
+
+    // The key as it is in a document, in quotes and followed by a colon
+    template < JsonKey Key >
+    constexpr auto key_pattern = []() {
+        std::array< char8_t, Key.chars.size() + 3 > pattern = {};
+        pattern.front() = u8'"';
+        std::copy( Key.chars.begin(), Key.chars.end(), pattern.begin() + 1 );
+        pattern[ pattern.size() - 2 ] = u8'"';
+        pattern.back() = u8':';
+        return pattern;
+    }();
+
+    // Return the start offset of the value with the key in the object, else nullopt
+    template < JsonKey Key >
+    std::optional< size_t > find_value_in_object( JsonIndex const &json, size_t const object_opening_brace_offset )
+    {
+        std::optional< size_t > value_pos;
+        for_key_values_in_object( json, object_opening_brace_offset,
+                                  [ & ]( JsonIndex const &, std::u8string_view key, size_t value_offset ) {
+                                      if ( key == Key.view() )
+                                      {
+                                          value_pos = value_offset;
+                                          return false;
+                                      }
+                                      return true;
+                                  } );
+        return value_pos;
+    }
 
-        // Then look backwards for keys before start_offset
-        for ( size_t i = start_offset - 1; i != 0 && json_data[ i ] != u8'{'; )
+    // Return the start offset of the value at the end of the path of keys from the object, else
+    // nullopt. Each key but the last must be of an object.
+    template < JsonKey Key, JsonKey... Path >
+    std::optional< size_t > select( JsonIndex const &json, size_t const object_opening_brace_offset )
+    {
+        std::optional< size_t > const value_pos = find_value_in_object< Key >( json, object_opening_brace_offset );
+        if constexpr ( sizeof...( Path ) == 0 )
+        {
+            return value_pos;
+        }
+        else
         {
-            if ( json_data[ i ] != u8',' )
+            if ( !value_pos.has_value() || json.text()[ value_pos.value() ] != u8'{' )
             {
-                throw_for_invalid_json();
+                return std::nullopt;
             }
+            return select< Path... >( json, value_pos.value() );
+        }
+    }
 
-            // Value
-            size_t const value_start_pos = [ & ]() {
-                size_t const value_end_pos = i - 1;
-                switch ( json_data[ value_end_pos ] )
-                {
-                    case u8'"':
-                        return rfind_opening_quote( json_data, value_end_pos );
-                    case u8'}':
-                    case u8']':
-                        return find_matching_brace( json_data, value_end_pos );
-                    default:
-                        for ( size_t j = value_end_pos; j != 0; --j )
-                        {
-                            if ( json_data[ j - 1 ] == u8':' )
-                            {
-                                return j;
-                            }
-                        }
-                }
-                throw_for_invalid_json();
-            }();
+    // As above, but the path starts at the first use of its first key anywhere in the document
+    template < JsonKey Key, JsonKey... Path >
+    std::optional< size_t > select( JsonIndex const &json )
+    {
+        std::u8string_view const json_data = json.text();
+        std::u8string_view const pattern( key_pattern< Key >.data(), key_pattern< Key >.size() );
 
-            // Key
-            if ( value_start_pos < 3 || json_data[ value_start_pos - 1 ] != u8':' ||
-                 json_data[ value_start_pos - 2 ] != u8'"' )
-            {
-                throw_for_invalid_json();
-            }
-            size_t const key_end_quote_pos = value_start_pos - 2;
-            size_t const key_start_quote_pos = rfind_opening_quote( json_data, key_end_quote_pos );
-            if ( key_start_quote_pos == 0 )
-            {
-                throw_for_invalid_json();
-            }
+        // A match that does not start with a quote is inside a string
+        size_t key_pos = json_data.find( pattern );
+        while ( key_pos != std::u8string_view::npos && !json.is_quote( key_pos ) )
+        {
+            key_pos = json_data.find( pattern, key_pos + 1 );
+        }
+        size_t const value_pos = key_pos + pattern.size();
+        if ( key_pos == std::u8string_view::npos || value_pos >= json_data.size() )
+        {
+            return std::nullopt;
+        }
 
-            std::u8string_view const key =
-                string_view_between( json_data, key_start_quote_pos, key_end_quote_pos );
-            if ( !callback( json_data, key, value_start_pos ) )
+        if constexpr ( sizeof...( Path ) == 0 )
+        {
+            return value_pos;
+        }
+        else
+        {
+            if ( json_data[ value_pos ] != u8'{' )
             {
-                return;
+                return std::nullopt;
             }
+            return select< Path... >( json, value_pos );
+        }
+    }
 
-            i = key_start_quote_pos - 1;
+    // The string at value_offset without its quotes, or nullopt if there is no value or it is not a
+    // string
+    std::optional< std::u8string_view > get_string( JsonIndex const &json, std::optional< size_t > const value_offset )
+    {
+        if ( !value_offset.has_value() || json.text()[ value_offset.value() ] != u8'"' )
+        {
+            return std::nullopt;
         }
+        return string_view_between( json.text(), value_offset.value(), find_closing_quote( json, value_offset.value() ) );
     }
 
-    // Calls the callback for every key value pair in the object. Breaks if callback returns false.
-    template < KeyValueCallback F >
-    void for_key_values_in_object( std::u8string_view const json_data,
-                                   size_t const object_opening_brace_offset, F callback )
+    //-------------------------------------------------------------------------
+    // Finding the save name and the drivers
+    //-------------------------------------------------------------------------
+
+    // Returns the save name without its quotes, or nullopt if the JSON ends before the name's closing
+    // quote. Throws if the JSON is complete but has no save name.
+    std::optional< std::u8string_view > find_save_name( JsonIndex const &info, bool const is_complete = true )
     {
-        size_t const start_pos = object_opening_brace_offset + 1;
-        if ( start_pos < json_data.size() )
+        // Look for:
+        //   "saveInfo":{...,"name":"<SAVE_NAME>",...}
+
+        try
         {
-            switch ( json_data[ start_pos ] )
+            std::optional< size_t > const name_value_pos = select< u8"saveInfo", u8"name" >( info );
+            if ( std::optional< std::u8string_view > const name = get_string( info, name_value_pos ); name.has_value() )
             {
-                case u8'"':
-                    for_sibling_key_values_in_object( json_data, start_pos, callback );
-                    return;
-                case u8'}':
-                    return;
-                default:
-                    break;
+                return name;
             }
         }
-        throw_for_invalid_json();
+        catch ( SaveFixerException const & )
+        {
+            // Running off the end of a partial JSON document is expected
+            if ( is_complete )
+            {
+                throw;
+            }
+            return std::nullopt;
+        }
+
+        if ( is_complete )
+        {
+            throw SaveFixerException( u8"could not find save name in save file"s );
+        }
+        return std::nullopt;
     }
 
-    // Return the start offset of the value with the given key, else nullopt
-    std::optional< size_t > lookup_value_in_object( std::u8string_view const json_data,
-                                                    size_t const object_opening_brace_offset,
-                                                    std::u8string_view const sought_key )
+    // The keys the data section is scanned for, in the order of JsonKeyHit::key
+    enum class DataKey : size_t
     {
-        std::optional< size_t > value_pos;
-        for_key_values_in_object( json_data, object_opening_brace_offset,
-                                  [ & ]( std::u8string_view, std::u8string_view key, size_t value_offset ) {
-                                      if ( key == sought_key )
-                                      {
-                                          value_pos = value_offset;
-                                          return false;
-                                      }
-                                      return true;
-                                  } );
-        return value_pos;
+        player_team,
+        employeer_team,
+        contract,
+        car_id,
+        first_name,
+        last_name,
+    };
+
+    constexpr std::array< std::u8string_view, 6 > data_keys = {
+        u8"mPlayerTeam", u8"mEmployeerTeam", u8"contract", u8"mCarID", u8"mFirstName", u8"mLastName",
+    };
+
+    bool is_key( JsonKeyHit const &hit, DataKey const key )
+    {
+        return hit.key == static_cast< size_t >( key );
     }
 
-    std::u8string_view get_player_team_id( std::u8string_view const json_data )
+    // The offset of the value after a key, past its quotes and the colon
+    size_t get_value_offset( JsonKeyHit const &hit )
     {
+        return hit.offset + data_keys[ hit.key ].size() + 3;
+    }
+
+    // The hits after offset
+    std::span< JsonKeyHit const >::iterator find_hits_after( std::span< JsonKeyHit const > const hits, size_t const offset )
+    {
+        return std::upper_bound( hits.begin(), hits.end(), offset,
+                                 []( size_t const o, JsonKeyHit const &hit ) { return o < hit.offset; } );
+    }
+
+    std::u8string_view find_player_team_id( JsonIndex const &json, std::span< JsonKeyHit const > const hits )
+    {
+        std::u8string_view const json_data = json.text();
+
         // Look for:
         //   "mPlayerTeam":{...,"$id":"<ID>",...}
 
-        std::u8string_view const player_team_obj_start = u8"\"mPlayerTeam\":{";
-
-        if ( size_t const player_team_key_start = json_data.find( player_team_obj_start );
-             player_team_key_start != std::u8string_view::npos )
+        for ( JsonKeyHit const &hit : hits )
         {
-            size_t const play_team_obj_opening_brace_pos =
-                player_team_key_start + player_team_obj_start.size() - 1;
-
-            std::optional< size_t > const id_value_pos =
-                lookup_value_in_object( json_data, play_team_obj_opening_brace_pos, u8"$id" );
-            if ( id_value_pos.has_value() && json_data[ id_value_pos.value() ] == u8'"' )
+            size_t const value_offset = get_value_offset( hit );
+            if ( is_key( hit, DataKey::player_team ) && value_offset < json_data.size() &&
+                 json_data[ value_offset ] == u8'{' )
             {
-                size_t const value_closing_quote = find_closing_quote( json_data, id_value_pos.value() );
-                return string_view_between( json_data, id_value_pos.value(), value_closing_quote );
+                std::optional< size_t > const id_value_pos = select< u8"$id" >( json, value_offset );
+                if ( std::optional< std::u8string_view > const id = get_string( json, id_value_pos ); id.has_value() )
+                {
+                    return id.value();
+                }
+                break;
             }
         }
         throw SaveFixerException( u8"could not find player team data in save file"s );
     }
 
-    template < typename F >
-    void for_each_employeer_team_ref( std::u8string_view const json_data, std::u8string_view const team_id, F f )
+    // Return the opening brace of the object containing the contract if the employeer team hit is
+    // inside an object with the "contract" key, else return npos
+    size_t find_employee_object_offset( std::span< JsonKeyHit const > const hits, JsonKeyHit const &employeer_team_hit )
     {
         // Look for:
-        //   "mEmployeerTeam":{"ref":"<team_id>"}
+        //   {...,"contract":{...,"mEmployeerTeam":...,...},...}
 
-        std::u8string const employeer_team_ref_str =
-            u8"\"mEmployeerTeam\":{\"$ref\":\""s + std::u8string( team_id ) + u8"\"}"s;
-        for ( size_t start_pos = 0;; )
+        size_t const contract_object_offset = employeer_team_hit.object_offset;
+        size_t const contract_key_size = data_keys[ static_cast< size_t >( DataKey::contract ) ].size() + 3;
+        if ( contract_object_offset == JsonIndex::npos || contract_object_offset < contract_key_size )
         {
-            if ( size_t const ref_pos = json_data.find( employeer_team_ref_str, start_pos );
-                 ref_pos == std::u8string_view::npos )
-            {
-                break;
-            }
-            else
-            {
-                f( ref_pos );
-                start_pos = ref_pos + 1;
-            }
+            return JsonIndex::npos;
+        }
+
+        // The contract key is a hit too, and knows the object it is in
+        auto const contract_hit = find_hits_after( hits, contract_object_offset - contract_key_size - 1 );
+        if ( contract_hit != hits.end() && contract_hit->offset == contract_object_offset - contract_key_size &&
+             is_key( *contract_hit, DataKey::contract ) )
+        {
+            return contract_hit->object_offset;
+        }
+        return JsonIndex::npos;
+    }
+
+    // As above, but only if the employeer team is a ref to the team
+    size_t find_employee_object_offset( JsonIndex const &json, std::span< JsonKeyHit const > const hits,
+                                        JsonKeyHit const &employeer_team_hit, std::u8string_view const team_ref )
+    {
+        // Look for:
+        //   "mEmployeerTeam":{"$ref":"<team_id>"}
+
+        if ( json.text().substr( get_value_offset( employeer_team_hit ), team_ref.size() ) != team_ref )
+        {
+            return JsonIndex::npos;
         }
+        return find_employee_object_offset( hits, employeer_team_hit );
     }
 
-    // Return the offset of the start of the "contract" key if the employeer team ref was inside an
-    // object with that key, else return npos
-    size_t find_employeer_team_ref_contract_offset( std::u8string_view const json_data, size_t const employeer_team_ref_offset )
+    // The id of the team an employeer team hit is for, or nullopt if its value is not a team. The
+    // value is a ref to the team, or the team itself where the save first uses it.
+    std::optional< std::u8string_view > find_employeer_team_id( JsonIndex const &json, JsonKeyHit const &employeer_team_hit )
     {
-        // Look for the opening brace of the object containing the employeer team ref, and
-        // check if it is preceded by a "contract" key.
+        // Look for:
+        //   "mEmployeerTeam":{"$ref":"<team_id>"} or "mEmployeerTeam":{"$id":"<team_id>",...}
 
-        if ( employeer_team_ref_offset != 0 )
+        std::u8string_view const json_data = json.text();
+        size_t const value_offset = get_value_offset( employeer_team_hit );
+        for ( std::u8string_view const prefix : { u8"{\"$ref\":\""sv, u8"{\"$id\":\""sv } )
         {
-            std::u8string_view contract_key = u8"\"contract\":";
-            size_t const object_start_pos =
-                rfind_opening_brace( json_data, employeer_team_ref_offset - 1, u8'{' );
-            if ( object_start_pos > contract_key.size() &&
-                 json_data.substr( object_start_pos - contract_key.size(), contract_key.size() ) == contract_key )
+            if ( json_data.substr( value_offset, prefix.size() ) == prefix )
             {
-                return object_start_pos - contract_key.size();
+                size_t const id_offset = value_offset + prefix.size();
+                size_t const id_end = json.find_quote( id_offset );
+                if ( id_end == JsonIndex::npos )
+                {
+                    return std::nullopt;
+                }
+                return json_data.substr( id_offset, id_end - id_offset );
             }
         }
-        return std::u8string_view::npos;
+        return std::nullopt;
     }
 
     SaveFile::DriverPosition parse_driver_position( std::u8string_view const json_data, size_t value_offset )
@@ -598,187 +629,1043 @@ namespace
         throw_for_invalid_json();
     }
 
-    std::u8string_view parse_driver_name_string( std::u8string_view const json_data, size_t value_offset )
+    std::u8string_view parse_driver_name_string( JsonIndex const &json, size_t value_offset )
     {
-        if ( json_data[ value_offset ] == u8'"' )
+        if ( value_offset < json.text().size() && json.text()[ value_offset ] == u8'"' )
         {
-            return string_view_between( json_data, value_offset, find_closing_quote( json_data, value_offset ) );
+            return string_view_between( json.text(), value_offset, find_closing_quote( json, value_offset ) );
         }
         throw SaveFixerException( u8"invalid driver name in save file"s );
     }
 
-    std::optional< SaveFile::Driver > maybe_get_driver( std::u8string_view const json_data, size_t const contract_key_offset )
+    std::optional< SaveFile::Driver > maybe_get_driver( JsonIndex const &json, std::span< JsonKeyHit const > const hits,
+                                                        size_t const employee_object_offset )
     {
-        // Look for in the object containing the contract:
+        // Look for in the employee object:
         //     "mCarID":<-1|0|1>
         //     "mFirstName":<string>
         //     "mLastName":<string>
+        // The hits in the object's nested objects belong to those objects, so are skipped.
 
         std::optional< size_t > car_id_pos;
         std::optional< std::u8string_view > first_name;
         std::optional< std::u8string_view > last_name;
 
-        for_sibling_key_values_in_object( json_data, contract_key_offset,
-                                          [ & ]( std::u8string_view json, std::u8string_view key, size_t value_offset ) {
-                                              if ( key == u8"mCarID"sv )
-                                              {
-                                                  car_id_pos = value_offset;
-                                              }
-                                              else if ( key == u8"mFirstName"sv )
-                                              {
-                                                  first_name = parse_driver_name_string( json, value_offset );
-                                              }
-                                              else if ( key == u8"mLastName"sv )
-                                              {
-                                                  last_name = parse_driver_name_string( json, value_offset );
-                                              }
-                                              return !( car_id_pos.has_value() && first_name.has_value() &&
-                                                        last_name.has_value() );
-                                          } );
+        size_t const employee_object_end = find_matching_brace( json, employee_object_offset );
+        for ( auto hit = find_hits_after( hits, employee_object_offset );
+              hit != hits.end() && hit->offset < employee_object_end; ++hit )
+        {
+            if ( hit->object_offset != employee_object_offset )
+            {
+                continue;
+            }
+            size_t const value_offset = get_value_offset( *hit );
+            if ( is_key( *hit, DataKey::car_id ) && !car_id_pos.has_value() )
+            {
+                car_id_pos = value_offset;
+            }
+            else if ( is_key( *hit, DataKey::first_name ) && !first_name.has_value() )
+            {
+                first_name = parse_driver_name_string( json, value_offset );
+            }
+            else if ( is_key( *hit, DataKey::last_name ) && !last_name.has_value() )
+            {
+                last_name = parse_driver_name_string( json, value_offset );
+            }
+        }
 
         if ( car_id_pos.has_value() && first_name.has_value() && last_name.has_value() )
         {
             std::u8string name;
             name.append( first_name.value() ).append( u8" "s ).append( last_name.value() );
             return SaveFile::Driver( std::move( name ),
-                                     parse_driver_position( json_data, car_id_pos.value() ),
+                                     parse_driver_position( json.text(), car_id_pos.value() ),
                                      car_id_pos.value() );
         }
         return std::nullopt;
     }
 
     //-------------------------------------------------------------------------
-    // Writing the save file
+    // Finding the drivers in a stream
     //-------------------------------------------------------------------------
 
-    std::u8string_view get_position_as_json_value( SaveFile::DriverPosition const p )
+    // Finds the player team's drivers by the same rules as get_driver_data_from_json(), but in the
+    // data section as it is decompressed, a piece at a time. With no index to skip by, every byte
+    // is read, and only the objects and arrays the scan is in are kept, with what has been found in
+    // them so far. The player team may come after its drivers, so until it is found the drivers of
+    // every team are kept.
+    class StreamedDriverScanner
     {
-        switch ( p )
-        {
-            case SaveFile::DriverPosition::reserve:
-                return u8"-1";
-            case SaveFile::DriverPosition::car1:
-                return u8"0";
-            case SaveFile::DriverPosition::car2:
-                return u8"1";
-            default:
-                throw SaveFixerException( u8"internal error: unreachable"s );
-        }
-    }
+    public:
+        // Each piece carries on from the end of the last
+        void scan( std::u8string_view piece );
 
-    // Unfortunatly there is no way to compress one LZ4 block from multiple sources, so
-    // we have to allocate and copy the complete output data.
-    struct UncompressedOutput
-    {
-        std::unique_ptr< char8_t[] > buffer;
-        std::span< char8_t > info;
-        std::span< char8_t > data;
-    };
+        // Throws SaveFixerException if the player team or its 3 drivers were not found
+        void finish( std::u8string &found_player_team_id, std::array< SaveFile::Driver, 3 > &found_drivers );
 
-    UncompressedOutput create_uncompressed_output_buffer( std::u8string_view const original_save_info,
-                                                          std::u8string_view const original_save_data,
-                                                          size_t const original_save_name_size,
-                                                          std::u8string_view const new_save_name,
-                                                          std::array< SaveFile::Driver, 3 > const &drivers )
-    {
-        // Figure out sizes
-        size_t const info_out_size =
-            original_save_info.size() - original_save_name_size + new_save_name.size();
-        size_t const data_out_size = [ & ]() {
-            size_t size = original_save_data.size();
-            for ( SaveFile::Driver const &d : drivers )
-            {
-                size -= get_position_as_json_value( d.original_position ).size();
-                size += get_position_as_json_value( d.position ).size();
-            }
-            return size;
-        }();
-        size_t const total_out_size = info_out_size + data_out_size;
+    private:
+        // The data keys in the order of DataKey, then the keys of refs
+        enum class Key
+        {
+            player_team,
+            employeer_team,
+            contract,
+            car_id,
+            first_name,
+            last_name,
+            id,
+            ref,
+            other,
+        };
 
-        // Create buffer
-        auto out_buffer = std::make_unique_for_overwrite< char8_t[] >( total_out_size );
-        auto const [ info_buffer, data_buffer ] =
-            split_span( std::span( out_buffer.get(), total_out_size ), info_out_size );
+        static constexpr size_t max_key_size = 16;
+        static constexpr size_t max_car_id_size = 3;
 
-        return UncompressedOutput{ std::move( out_buffer ), info_buffer, data_buffer };
-    }
+        struct Frame
+        {
+            bool is_object = false;
+            Key key = Key::other;    // The key it is the value of in the object it is in
+            size_t offset = 0;       // Of its opening brace
+            bool is_player_team = false;
+
+            bool expects_key = true;
+            Key last_key = Key::other;
+            size_t last_key_offset = 0;
+            Key value_key = Key::other;    // The key of the value being read
+
+            // The first of each driver value, and whether a name is not a string
+            std::optional< size_t > car_id_offset;
+            std::u8string car_id;
+            char8_t car_id_end = 0;
+            std::optional< std::u8string > first_name;
+            std::optional< std::u8string > last_name;
+            bool has_invalid_name = false;
+
+            // The team of an employeer team that is exactly {"$ref":"<team_id>"}, which is passed
+            // up to its contract, then from the contract to the employee
+            std::optional< std::u8string > ref;
+            std::optional< std::u8string > contract_team_id;
+            std::optional< std::u8string > employee_team_id;
+        };
+
+        struct Candidate
+        {
+            std::u8string team_id;
+            bool has_invalid_name;
+            std::optional< SaveFile::Driver > driver;    // nullopt if its car ID is not valid
+        };
+
+        enum class StringTarget
+        {
+            none,
+            key,
+            first_name,
+            last_name,
+            player_team_id,
+            ref,
+        };
+
+        enum class PlayerTeamState
+        {
+            not_found,
+            in_object,
+            found,
+            has_no_id,
+        };
+
+        static Key find_key( std::u8string_view const s )
+        {
+            for ( size_t i = 0; i < data_keys.size(); ++i )
+            {
+                if ( s == data_keys[ i ] )
+                {
+                    return static_cast< Key >( i );
+                }
+            }
+            return ( s == u8"$id"sv ) ? Key::id : ( s == u8"$ref"sv ) ? Key::ref : Key::other;
+        }
+
+        Frame *top() { return ( depth == 0 ) ? nullptr : &frames[ depth - 1 ]; }
+
+        void capture( std::u8string_view const s )
+        {
+            if ( string_target == StringTarget::key && text.size() + s.size() > max_key_size )
+            {
+                string_target = StringTarget::none;
+            }
+            if ( string_target != StringTarget::none )
+            {
+                text.append( s );
+            }
+        }
+
+        void start_value( size_t offset, char8_t first_char );
+        void start_string( size_t offset );
+        void end_string();
+        void end_literal( char8_t end_char );
+        void push( bool is_object, size_t offset );
+        void pop( bool is_object, size_t offset );
+        void add_candidate( Frame &employee );
+
+        size_t piece_offset = 0;
+        std::vector< Frame > frames;
+        size_t depth = 0;
+
+        bool in_string = false;
+        bool is_escaped = false;
+        bool string_is_key = false;
+        StringTarget string_target = StringTarget::none;
+        size_t string_offset = 0;
+        std::u8string text;
+
+        bool in_literal = false;
+        bool is_car_id_literal = false;
+
+        PlayerTeamState player_team_state = PlayerTeamState::not_found;
+        std::u8string player_team_id;
+        std::vector< Candidate > candidates;
+    };
+
+    void StreamedDriverScanner::scan( std::u8string_view const piece )
+    {
+        for ( size_t i = 0; i < piece.size(); ++i )
+        {
+            size_t const offset = piece_offset + i;
+            char8_t const c = piece[ i ];
+            if ( in_string )
+            {
+                if ( is_escaped )
+                {
+                    is_escaped = false;
+                    capture( piece.substr( i, 1 ) );
+                    continue;
+                }
+                size_t const end = std::min( piece.find_first_of( u8"\"\\"sv, i ), piece.size() );
+                capture( piece.substr( i, end - i ) );
+                i = end;
+                if ( end == piece.size() )
+                {
+                    break;
+                }
+                if ( piece[ end ] == u8'\\' )
+                {
+                    is_escaped = true;
+                    capture( u8"\\"sv );
+                    continue;
+                }
+                in_string = false;
+                end_string();
+                continue;
+            }
+
+            if ( in_literal )
+            {
+                if ( c != u8',' && c != u8'}' && c != u8']' && c != u8' ' && c != u8'\t' && c != u8'\n' && c != u8'\r' )
+                {
+                    if ( is_car_id_literal && top()->car_id.size() <= max_car_id_size )
+                    {
+                        top()->car_id.push_back( c );
+                    }
+                    continue;
+                }
+                end_literal( c );
+            }
+
+            switch ( c )
+            {
+                case u8'"':
+                    start_string( offset );
+                    break;
+                case u8'{':
+                case u8'[':
+                    start_value( offset, c );
+                    push( c == u8'{', offset );
+                    break;
+                case u8'}':
+                case u8']':
+                    pop( c == u8'}', offset );
+                    break;
+                case u8':':
+                    if ( Frame *const f = top(); f != nullptr && f->is_object )
+                    {
+                        f->value_key = f->last_key;
+                        f->expects_key = false;
+                    }
+                    break;
+                case u8',':
+                    if ( Frame *const f = top(); f != nullptr && f->is_object )
+                    {
+                        f->value_key = Key::other;
+                        f->expects_key = true;
+                    }
+                    break;
+                case u8' ':
+                case u8'\t':
+                case u8'\n':
+                case u8'\r':
+                    break;
+                default:
+                    start_value( offset, c );
+                    in_literal = true;
+                    break;
+            }
+        }
+        piece_offset += piece.size();
+    }
+
+    void StreamedDriverScanner::start_value( size_t const offset, char8_t const first_char )
+    {
+        string_target = StringTarget::none;
+        Frame *const f = top();
+        if ( f == nullptr || !f->is_object )
+        {
+            return;
+        }
+
+        bool const is_string = ( first_char == u8'"' );
+        switch ( f->value_key )
+        {
+            case Key::car_id:
+                if ( !f->car_id_offset.has_value() )
+                {
+                    f->car_id_offset = offset;
+                    is_car_id_literal = !is_string && first_char != u8'{' && first_char != u8'[';
+                    if ( is_car_id_literal )
+                    {
+                        f->car_id.assign( 1, first_char );
+                    }
+                }
+                break;
+            case Key::first_name:
+            case Key::last_name:
+            {
+                std::optional< std::u8string > &name = ( f->value_key == Key::first_name ) ? f->first_name : f->last_name;
+                if ( !name.has_value() )
+                {
+                    name.emplace();
+                    f->has_invalid_name = f->has_invalid_name || !is_string;
+                    if ( is_string )
+                    {
+                        string_target = ( f->value_key == Key::first_name ) ? StringTarget::first_name
+                                                                            : StringTarget::last_name;
+                    }
+                }
+                break;
+            }
+            case Key::id:
+                if ( f->is_player_team && player_team_state == PlayerTeamState::in_object )
+                {
+                    player_team_state = is_string ? PlayerTeamState::found : PlayerTeamState::has_no_id;
+                    string_target = is_string ? StringTarget::player_team_id : StringTarget::none;
+                }
+                break;
+            case Key::ref:
+                // Only {"$ref":"<team_id>"} with no other keys, which is checked when it ends
+                if ( f->key == Key::employeer_team && is_string && f->last_key_offset == f->offset + 1 &&
+                     offset == f->offset + 8 )
+                {
+                    string_target = StringTarget::ref;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    void StreamedDriverScanner::start_string( size_t const offset )
+    {
+        in_string = true;
+        string_offset = offset;
+        text.clear();
+
+        Frame *const f = top();
+        string_is_key = ( f != nullptr && f->is_object && f->expects_key );
+        if ( string_is_key )
+        {
+            string_target = StringTarget::key;
+        }
+        else
+        {
+            start_value( offset, u8'"' );
+        }
+    }
+
+    void StreamedDriverScanner::end_string()
+    {
+        Frame *const f = top();
+        switch ( string_target )
+        {
+            case StringTarget::none:
+                break;
+            case StringTarget::key:
+                break;
+            case StringTarget::first_name:
+                f->first_name = text;
+                break;
+            case StringTarget::last_name:
+                f->last_name = text;
+                break;
+            case StringTarget::player_team_id:
+                player_team_id = text;
+                break;
+            case StringTarget::ref:
+                f->ref = text;
+                break;
+        }
+        if ( string_is_key )
+        {
+            f->last_key = ( string_target == StringTarget::key ) ? find_key( text ) : Key::other;
+            f->last_key_offset = string_offset;
+        }
+        string_target = StringTarget::none;
+    }
+
+    void StreamedDriverScanner::end_literal( char8_t const end_char )
+    {
+        in_literal = false;
+        if ( is_car_id_literal )
+        {
+            top()->car_id_end = end_char;
+            is_car_id_literal = false;
+        }
+    }
+
+    void StreamedDriverScanner::push( bool const is_object, size_t const offset )
+    {
+        Frame const *const parent = top();
+        Key const key = ( parent != nullptr && parent->is_object ) ? parent->value_key : Key::other;
+        if ( depth == frames.size() )
+        {
+            frames.emplace_back();
+        }
+        Frame &f = frames[ depth++ ];
+        f = Frame();
+        f.is_object = is_object;
+        f.key = key;
+        f.offset = offset;
+
+        // Like find_player_team_id(), only the first player team that is an object is looked in
+        if ( is_object && key == Key::player_team && player_team_state == PlayerTeamState::not_found )
+        {
+            f.is_player_team = true;
+            player_team_state = PlayerTeamState::in_object;
+        }
+    }
+
+    void StreamedDriverScanner::pop( bool const is_object, size_t const offset )
+    {
+        if ( depth == 0 || frames[ depth - 1 ].is_object != is_object )
+        {
+            throw_for_invalid_json();
+        }
+        Frame &f = frames[ --depth ];
+        if ( !is_object )
+        {
+            return;
+        }
+        if ( f.is_player_team && player_team_state == PlayerTeamState::in_object )
+        {
+            player_team_state = PlayerTeamState::has_no_id;
+        }
+
+        if ( Frame *const parent = top(); parent != nullptr && parent->is_object )
+        {
+            if ( f.key == Key::employeer_team && parent->key == Key::contract && f.ref.has_value() &&
+                 offset == f.offset + 10 + f.ref->size() && !parent->contract_team_id.has_value() )
+            {
+                parent->contract_team_id = std::move( f.ref );
+            }
+            if ( f.key == Key::contract && f.contract_team_id.has_value() && !parent->employee_team_id.has_value() )
+            {
+                parent->employee_team_id = std::move( f.contract_team_id );
+            }
+        }
+        if ( f.employee_team_id.has_value() )
+        {
+            add_candidate( f );
+        }
+    }
+
+    void StreamedDriverScanner::add_candidate( Frame &employee )
+    {
+        std::u8string &team_id = employee.employee_team_id.value();
+        bool const has_driver =
+            employee.car_id_offset.has_value() && employee.first_name.has_value() && employee.last_name.has_value();
+        if ( ( player_team_state == PlayerTeamState::found && team_id != player_team_id ) ||
+             !( has_driver || employee.has_invalid_name ) )
+        {
+            return;
+        }
+
+        Candidate &candidate = candidates.emplace_back( Candidate{ std::move( team_id ), employee.has_invalid_name, std::nullopt } );
+        if ( !has_driver || employee.has_invalid_name )
+        {
+            return;
+        }
+
+        // As parse_driver_position(), the car ID must be followed by the end of its value
+        std::optional< SaveFile::DriverPosition > position;
+        if ( employee.car_id_end == u8',' || employee.car_id_end == u8'}' )
+        {
+            position = ( employee.car_id == u8"-1"sv ) ? std::optional( SaveFile::DriverPosition::reserve )
+                       : ( employee.car_id == u8"0"sv ) ? std::optional( SaveFile::DriverPosition::car1 )
+                       : ( employee.car_id == u8"1"sv ) ? std::optional( SaveFile::DriverPosition::car2 )
+                                                        : std::nullopt;
+        }
+        if ( position.has_value() )
+        {
+            std::u8string name = std::move( employee.first_name.value() );
+            name.append( u8" "s ).append( employee.last_name.value() );
+            candidate.driver.emplace( std::move( name ), position.value(), employee.car_id_offset.value() );
+        }
+    }
+
+    void StreamedDriverScanner::finish( std::u8string &found_player_team_id,
+                                        std::array< SaveFile::Driver, 3 > &found_drivers )
+    {
+        if ( in_literal )
+        {
+            end_literal( 0 );
+        }
+        if ( player_team_state != PlayerTeamState::found )
+        {
+            throw SaveFixerException( u8"could not find player team data in save file"s );
+        }
+
+        std::vector< SaveFile::Driver > drivers;
+        for ( Candidate const &candidate : candidates )
+        {
+            if ( candidate.team_id != player_team_id )
+            {
+                continue;
+            }
+            if ( candidate.has_invalid_name )
+            {
+                throw SaveFixerException( u8"invalid driver name in save file"s );
+            }
+            if ( !candidate.driver.has_value() )
+            {
+                throw SaveFixerException( u8"invalid driver position in save file"s );
+            }
+            drivers.push_back( candidate.driver.value() );
+        }
+
+        if ( drivers.size() != 3U )
+        {
+            throw SaveFixerException( u8"unable to locate team's 3 drivers in save file"s );
+        }
+        std::sort( drivers.begin(), drivers.end(), []( SaveFile::Driver const &a, SaveFile::Driver const &b ) {
+            return a.car_id_file_offset < b.car_id_file_offset;
+        } );
+        std::copy( drivers.begin(), drivers.end(), found_drivers.begin() );
+        found_player_team_id = player_team_id;
+    }
+
+    //-------------------------------------------------------------------------
+    // Finding the drivers of every team
+    //-------------------------------------------------------------------------
+
+    // The data section is scanned in parts of at least this size, a few for each thread so that
+    // the threads finish at about the same time
+    constexpr size_t min_audit_part_size = 1024 * 1024;
+    constexpr size_t audit_parts_per_thread = 4;
+
+    struct AuditPart
+    {
+        size_t begin;
+        size_t end;
+        std::vector< JsonKeyHit > hits;
+        size_t first_hit = 0;    // Where the part's hits are in the hits of the whole section
+
+        // The drivers whose contract is in the part, with the teams they are in
+        std::vector< std::pair< std::u8string_view, SaveFile::Driver > > drivers;
+
+        std::optional< std::u8string > error;
+        bool failed = false;
+    };
+
+    // Runs the task for each part on the pool, and throws the first error of a part
+    template< typename F >
+    void for_each_audit_part( ThreadPool &pool, std::vector< AuditPart > &parts, F task )
+    {
+        pool.parallel_for( parts.size(), [ & ]( size_t const i ) {
+            try
+            {
+                task( parts[ i ] );
+            }
+            catch ( SaveFixerException const &ex )
+            {
+                parts[ i ].error = ex.description;
+            }
+            catch ( std::bad_alloc const & )
+            {
+                parts[ i ].failed = true;
+            }
+        } );
+
+        for ( AuditPart const &part : parts )
+        {
+            if ( part.failed )
+            {
+                throw std::bad_alloc();
+            }
+            if ( part.error.has_value() )
+            {
+                throw SaveFixerException( part.error.value() );
+            }
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    // Index file
+    //-------------------------------------------------------------------------
+
+    // The index file of a save is a header followed by what opening the save found, all in native
+    // byte order:
+    //
+    // * magic, version, the compressed and decompressed sizes of both sections, and the hash of
+    //   the compressed sections
+    // * the offset and size of the save name in the info section, then the save name
+    // * the player team ID
+    // * for each driver: the name, the position and the offset of the car ID in the data section
+    // * the number of checkpoints in the compressed data section, then for each: its offsets in
+    //   the compressed and decompressed data, the match it cuts, and its window
+    //
+    // An index file that does not match the save, or which fails to parse, is ignored and written
+    // again because it can always be rebuilt.
+
+    constexpr uint32_t index_file_magic = 0x5358534D;    // "MSXS"
+    constexpr uint32_t index_file_version = 2;
+
+    // Few enough checkpoints that their windows add little to the index file, and close enough
+    // that a range of the data section needs only a few MB decompressed
+    constexpr size_t index_checkpoint_interval = 4ULL * 1024ULL * 1024ULL;
+
+    std::u8string get_index_file_path( std::u8string const &save_file_path )
+    {
+        return save_file_path + u8".idx"s;
+    }
+
+    //-------------------------------------------------------------------------
+    // Writing the save file
+    //-------------------------------------------------------------------------
+
+    std::u8string_view get_position_as_json_value( SaveFile::DriverPosition const p )
+    {
+        switch ( p )
+        {
+            case SaveFile::DriverPosition::reserve:
+                return u8"-1";
+            case SaveFile::DriverPosition::car1:
+                return u8"0";
+            case SaveFile::DriverPosition::car2:
+                return u8"1";
+            default:
+                throw SaveFixerException( u8"internal error: unreachable"s );
+        }
+    }
+
+    std::span< std::byte const > as_bytes( std::u8string_view const s )
+    {
+        return std::as_bytes( std::span( s ) );
+    }
+
+    // The new sections, as the original sections and the edits to them. A section is only gathered
+    // into a buffer if it has to be compressed in full.
+    struct EditedOutput
+    {
+        Lz4EditedData info;
+        Lz4EditedData data;
+    };
+
+    // Sorts the edits to a section, and checks they are inside it and do not overlap or share an
+    // offset
+    Lz4EditedData create_edited_section( std::u8string_view const original_section, std::vector< Lz4Edit > edits )
+    {
+        std::sort( edits.begin(), edits.end(), []( Lz4Edit const &a, Lz4Edit const &b ) { return a.offset < b.offset; } );
+        for ( size_t i = 0; i < edits.size(); ++i )
+        {
+            if ( edits[ i ].offset > original_section.size() ||
+                 edits[ i ].original_size > original_section.size() - edits[ i ].offset ||
+                 ( i > 0 && edits[ i ].offset < edits[ i - 1 ].offset + std::max( edits[ i - 1 ].original_size, size_t{ 1 } ) ) )
+            {
+                throw SaveFixerException( u8"edits to the save are outside it or overlap"s );
+            }
+        }
+        return Lz4EditedData( as_bytes( original_section ), std::move( edits ) );
+    }
+
+    EditedOutput create_edited_output( std::u8string_view const original_save_info,
+                                       std::u8string_view const original_save_data,
+                                       size_t const original_save_name_offset,
+                                       size_t const original_save_name_size,
+                                       std::u8string_view const new_save_name,
+                                       std::array< SaveFile::Driver, 3 > const &drivers,
+                                       std::span< SaveFile::Edit const > const other_edits )
+    {
+        std::vector< Lz4Edit > info_edits;
+        std::vector< Lz4Edit > data_edits;
+
+        // New save name
+        if ( original_save_info.substr( original_save_name_offset, original_save_name_size ) != new_save_name )
+        {
+            info_edits.push_back( Lz4Edit{ original_save_name_offset, original_save_name_size, as_bytes( new_save_name ) } );
+        }
+
+        // New driver positions
+        for ( SaveFile::Driver const &d : drivers )
+        {
+            if ( d.position != d.original_position )
+            {
+                data_edits.push_back( Lz4Edit{ d.car_id_file_offset,
+                                               get_position_as_json_value( d.original_position ).size(),
+                                               as_bytes( get_position_as_json_value( d.position ) ) } );
+            }
+        }
+
+        for ( SaveFile::Edit const &edit : other_edits )
+        {
+            ( edit.section == SaveFile::Section::info ? info_edits : data_edits )
+                .push_back( Lz4Edit{ edit.offset, edit.original_size, as_bytes( edit.new_text ) } );
+        }
+
+        return EditedOutput{ create_edited_section( original_save_info, std::move( info_edits ) ),
+                             create_edited_section( original_save_data, std::move( data_edits ) ) };
+    }
+
+    size_t max_compressed_save_size( EditedOutput const &output )
+    {
+        return sizeof( SaveFileHeader ) + lz4_max_compressed_size( output.info.size() ) +
+               lz4_max_compressed_size( output.data.size() );
+    }
+
+    size_t finish_or_compress( Lz4ParallelCompressor const &compressor, Lz4EditedData const &section,
+                               std::span< std::byte > const output_buffer )
+    {
+        if ( std::optional< size_t > const size = compressor.finish( output_buffer ); size.has_value() )
+        {
+            return size.value();
+        }
+
+        // Only if a chunk failed, so the section is gathered just for this
+        std::vector< std::byte > gathered( section.size() );
+        section.gather( 0, section.size(), gathered.data() );
+        return lz4_compress( gathered, output_buffer );
+    }
+
+    // Compresses a section as it is decompressed, with the edits made on the way. The edits must be
+    // sorted and must not overlap. Returns false if the section is not valid or does not fit in the
+    // compressor's output.
+    bool recompress_streamed_section( Lz4StreamDecompressor &decompressor, std::span< Lz4Edit const > const edits,
+                                      Lz4StreamCompressor &compressor )
+    {
+        size_t next_edit = 0;
+        size_t skip_size = 0;    // The original bytes of the last edit that are still to be skipped
+        for ( ;; )
+        {
+            std::optional< std::span< std::byte const > > const piece = decompressor.next();
+            if ( !piece.has_value() )
+            {
+                return false;
+            }
+            if ( piece->empty() )
+            {
+                break;
+            }
+
+            size_t pos = decompressor.decompressed_size() - piece->size();
+            for ( std::span< std::byte const > rest = piece.value(); !rest.empty(); )
+            {
+                size_t size = rest.size();
+                if ( skip_size != 0 )
+                {
+                    size = std::min( size, skip_size );
+                    skip_size -= size;
+                }
+                else if ( next_edit < edits.size() && edits[ next_edit ].offset == pos )
+                {
+                    if ( !compressor.write( edits[ next_edit ].new_bytes ) )
+                    {
+                        return false;
+                    }
+                    skip_size = edits[ next_edit++ ].original_size;
+                    continue;
+                }
+                else
+                {
+                    if ( next_edit < edits.size() )
+                    {
+                        size = std::min( size, edits[ next_edit ].offset - pos );
+                    }
+                    if ( !compressor.write( rest.first( size ) ) )
+                    {
+                        return false;
+                    }
+                }
+                rest = rest.subspan( size );
+                pos += size;
+            }
+        }
+        return next_edit == edits.size() && decompressor.is_finished();
+    }
+
+    // Writes the header and compressed sections to file_out, which must be at least
+    // max_compressed_save_size() bytes. Returns the size of the save file.
+    size_t compress_save( EditedOutput const &output, std::span< std::byte const > const original_compressed_info,
+                          std::span< std::byte const > const original_compressed_data,
+                          std::span< std::byte > const file_out, ThreadPool *const pool,
+                          CompressionPolicy const &policy )
+    {
+        SaveFileHeader *save_header = reinterpret_cast< SaveFileHeader * >( file_out.data() );
+        std::span< std::byte > const sections_out = file_out.subspan( sizeof( SaveFileHeader ) );
+
+        Lz4Compression const compression =
+            policy.automatic ? lz4_choose_compression( output.info.size() + output.data.size(), policy.time_budget )
+                             : policy.compression;
+
+        // Only the parts of a section near its edits are compressed again, the rest is copied from
+        // the original compressed section. The data section can only be placed once the size of
+        // the info section is known. The copied parts keep the original's compression, and the rest
+        // is compressed with an acceleration of 1, so this is only done for the default compression.
+        std::optional< size_t > compressed_info_size;
+        std::optional< size_t > compressed_data_size;
+        if ( compression.method == Lz4Compression::Method::fast && compression.level == 1 )
+        {
+            compressed_info_size = lz4_recompress_edited_block( original_compressed_info, output.info, sections_out );
+        }
+        if ( compressed_info_size.has_value() )
+        {
+            compressed_data_size = lz4_recompress_edited_block( original_compressed_data, output.data,
+                                                                sections_out.subspan( compressed_info_size.value() ) );
+        }
+
+        // Anything that could not reuse the original is compressed in full on the thread pool, with
+        // both sections compressed at once. The compressors read the sections through their edits,
+        // so the new sections are never copied.
+        if ( !compressed_data_size.has_value() )
+        {
+            std::optional< ThreadPool > local_pool;
+            ThreadPool &compress_pool = ( pool != nullptr ) ? *pool : local_pool.emplace();
+
+            Lz4ParallelCompressor info_compressor( output.info, compression );
+            Lz4ParallelCompressor data_compressor( output.data, compression );
+            TaskGroup group;
+            if ( !compressed_info_size.has_value() )
+            {
+                info_compressor.start( compress_pool, group );
+            }
+            data_compressor.start( compress_pool, group );
+            compress_pool.wait( group );
+
+            if ( !compressed_info_size.has_value() )
+            {
+                compressed_info_size = finish_or_compress( info_compressor, output.info, sections_out );
+            }
+            compressed_data_size =
+                finish_or_compress( data_compressor, output.data, sections_out.subspan( compressed_info_size.value() ) );
+        }
+
+        size_t const output_size = sizeof( SaveFileHeader ) + compressed_info_size.value() + compressed_data_size.value();
+        if ( std::cmp_greater( compressed_info_size.value(), std::numeric_limits< int >::max() ) ||
+             std::cmp_greater( output.info.size(), std::numeric_limits< int >::max() ) ||
+             std::cmp_greater( compressed_data_size.value(), std::numeric_limits< int >::max() ) ||
+             std::cmp_greater( output.data.size(), std::numeric_limits< int >::max() ) )
+        {
+            throw SaveFixerException( u8"output too large"s );
+        }
+
+        save_header->magic = mm_save_file_magic;
+        save_header->version = mm_save_file_supported_version;
+        save_header->compressed_info_size = static_cast< int >( compressed_info_size.value() );
+        save_header->decompressed_info_size = static_cast< int >( output.info.size() );
+        save_header->compressed_data_size = static_cast< int >( compressed_data_size.value() );
+        save_header->decompressed_data_size = static_cast< int >( output.data.size() );
+
+        return output_size;
+    }
+}
+
+std::u8string save_fixer::extract_save_name_from_save_path( std::u8string_view const path )
+{
+    std::u8string_view save_name = path;
+    constexpr std::u8string_view extension = u8".sav";
+    if ( save_name.ends_with( extension ) )
+    {
+        save_name = save_name.substr( 0, save_name.size() - extension.size() );
+    }
+    if ( size_t const last_sep = path.find_last_of( u8"\\/" ); last_sep != std::u8string_view::npos )
+    {
+        save_name = save_name.substr( last_sep + 1 );
+    }
+    if ( save_name.empty() )
+    {
+        assert( false );
+        return u8"Practice Driver Fixed Save"s;
+    }
+    return std::u8string( save_name );
+}
+
+//-----------------------------------------------------------------------------
+// SaveFileInfo
+//-----------------------------------------------------------------------------
+
+SaveFileInfo::SaveFileInfo( std::u8string_view const &file_path ) : original_file_path( file_path )
+{
+    ReadFileMapping const save_file( original_file_path, read_access::partial );
+
+    SaveFileHeader const *header = read_save_file_header( save_file.bytes(), original_file_path );
+    std::span< std::byte const > const compressed_save_info =
+        save_file.bytes().subspan( sizeof( SaveFileHeader ), static_cast< size_t >( header->compressed_info_size ) );
+
+    size_t const info_size = static_cast< size_t >( header->decompressed_info_size );
+    auto const info_buffer = std::make_unique_for_overwrite< std::byte[] >( info_size );
+
+    // The save name is near the start of the info JSON. Decompress a small prefix, and keep
+    // doubling it until the whole name has been decompressed.
+    for ( size_t target_size = std::min( initial_info_prefix_size, info_size );;
+          target_size = std::min( target_size * 2, info_size ) )
+    {
+        size_t const decompressed_size = lz4_decompress_prefix(
+            compressed_save_info, std::span( info_buffer.get(), info_size ), target_size, original_file_path );
+        std::u8string_view const info_prefix( reinterpret_cast< char8_t const * >( info_buffer.get() ),
+                                              decompressed_size );
+
+        if ( std::optional< std::u8string_view > const name =
+                 find_save_name( JsonIndex( info_prefix ), decompressed_size == info_size );
+             name.has_value() )
+        {
+            save_name = name.value();
+            return;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// SaveFile
+//-----------------------------------------------------------------------------
+
+// Everything that is read from the save file, which no edit session changes
+struct SaveFile::Snapshot
+{
+    // The decompressed sections, in a buffer or temporary file that they are decompressed into, or
+    // mapped from a section cache. The index of the data section is only built the first time it
+    // is needed.
+    struct Sections
+    {
+        Sections( size_t info_size, size_t data_size );
+        Sections( TempFileMapping temp_file, size_t info_size );
+        explicit Sections( SectionCache::Entry cached );
+
+        JsonIndex const &get_data_index() const;
+
+        LargeBuffer buffer;
+        std::optional< TempFileMapping > temp_file_mapping;
+        std::optional< ReadFileMapping > mapping;
+        std::span< std::byte > info_buffer;    // Empty if mapped
+        std::span< std::byte > data_buffer;
+        std::u8string_view info;
+        std::u8string_view data;
+
+        mutable std::once_flag data_index_built;
+        mutable std::optional< JsonIndex > data_index;
+    };
+
+    // Decompresses both sections, or maps them from the section cache, and finds the save name and
+    // the drivers, or reads them from the index file if it is used and matches
+    Snapshot( std::u8string const &file_path, std::span< std::byte const > file_data, Residency residency,
+              bool use_index_file, SectionCache *section_cache );
+
+    // Large data sections are searched while they are still being decompressed
+    std::shared_ptr< Sections > decompress_and_search( std::u8string const &file_path, JsonIndex &data_json,
+                                                       JsonKeyScanner &scanner );
+
+    // Returns false if the index file is missing or does not match the compressed sections
+    bool read_index_file( std::u8string const &index_file_path, uint64_t sections_hash );
+    void write_index_file( std::u8string const &index_file_path, uint64_t sections_hash ) const;
+
+    void get_save_name( std::u8string_view save_info );
+    void get_driver_data_from_json( JsonIndex const &data_json, JsonKeyScanner const &scanner );
+
+    // The sections from the section cache, or nullptr if they are not in it
+    std::shared_ptr< Sections const > find_cached_sections() const;
+
+    // The sections, mapped from the section cache or decompressed again if they are not kept
+    std::shared_ptr< Sections const > get_sections( std::u8string const &file_path ) const;
+
+    // Sections to decompress into, in a temporary file next to the save if they are file backed
+    std::shared_ptr< Sections > allocate_sections( std::u8string const &file_path ) const;
+
+    // The sections, which must be kept for views of them to be given out
+    Sections const &get_kept_sections() const;
 
-    UncompressedOutput create_uncompressed_output( std::u8string_view const original_save_info,
-                                                   std::u8string_view const original_save_data,
-                                                   size_t const original_save_name_offset,
-                                                   size_t const original_save_name_size,
-                                                   std::u8string_view const new_save_name,
-                                                   std::array< SaveFile::Driver, 3 > const &drivers )
-    {
-        UncompressedOutput output =
-            create_uncompressed_output_buffer( original_save_info, original_save_data,
-                                               original_save_name_size, new_save_name, drivers );
-        std::span< char8_t > remaining_info_buffer = output.info;
-        std::span< char8_t > remaining_data_buffer = output.data;
+    LargeBuffer compressed_buffer;
+    std::span< std::byte const > compressed_save_info;
+    std::span< std::byte const > compressed_save_data;
+    size_t decompressed_info_size;
+    size_t decompressed_data_size;
+    bool file_backed;
 
-        auto const copy_to_buffer = []( std::u8string_view s, std::span< char8_t > &b ) {
-            if ( s.size() > b.size() )
-            {
-                throw SaveFixerException( u8"internal error: copy out of memory"s );
-            }
-            std::copy( s.begin(), s.end(), b.begin() );
-            b = b.subspan( s.size() );
-        };
-        auto const copy_to_info_buffer = [ & ]( std::u8string_view s ) {
-            copy_to_buffer( s, remaining_info_buffer );
-        };
-        auto const copy_to_data_buffer = [ & ]( std::u8string_view s ) {
-            copy_to_buffer( s, remaining_data_buffer );
-        };
+    SectionCache *section_cache;
+    SectionCache::Key cache_key;
 
-        // Copy info with new save name
-        copy_to_info_buffer( original_save_info.substr( 0, original_save_name_offset ) );
-        copy_to_info_buffer( new_save_name );
-        copy_to_info_buffer( original_save_info.substr( original_save_name_offset + original_save_name_size ) );
-
-        // Copy data with new driver positions
-        size_t not_copied_offset = 0;
-        assert( std::is_sorted( drivers.begin(), drivers.end(),
-                                []( SaveFile::Driver const &a, SaveFile::Driver const &b ) {
-                                    return a.car_id_file_offset < b.car_id_file_offset;
-                                } ) );
-        for ( SaveFile::Driver const &d : drivers )
-        {
-            if ( d.position != d.original_position )
-            {
-                copy_to_data_buffer( original_save_data.substr( not_copied_offset,
-                                                                d.car_id_file_offset - not_copied_offset ) );
-                copy_to_data_buffer( get_position_as_json_value( d.position ) );
-                not_copied_offset =
-                    d.car_id_file_offset + get_position_as_json_value( d.original_position ).size();
-            }
-        }
-        copy_to_data_buffer( original_save_data.substr( not_copied_offset ) );
+    std::shared_ptr< Sections const > sections;    // nullptr if only the compressed sections are kept
 
-        if ( !remaining_info_buffer.empty() || !remaining_data_buffer.empty() )
-        {
-            throw SaveFixerException( u8"internal error: bad copy"s );
-        }
+    std::u8string original_save_name;
+    size_t save_name_offset;
+    size_t save_name_size;
 
-        return output;
-    }
+    std::u8string player_team_id;
+    std::array< Driver, 3 > drivers;    // With their positions in the file
+
+    Lz4Checkpoints data_checkpoints;    // Only read from or written to the index file
+};
+
+SaveFile::SaveFile( std::u8string_view const &file_path, Residency const residency, bool const use_index_file,
+                    SectionCache *const section_cache )
+    : original_file_path( file_path )
+{
+    ReadFileMapping const save_file( original_file_path );
+    snapshot = std::make_shared< Snapshot const >( original_file_path, save_file.bytes(), residency, use_index_file,
+                                                   section_cache );
+    drivers = snapshot->drivers;
 }
 
-//-----------------------------------------------------------------------------
-// SaveFile
-//-----------------------------------------------------------------------------
+SaveFile::Snapshot::Sections::Sections( size_t const info_size, size_t const data_size )
+    : buffer( info_size + data_size )
+{
+    std::tie( info_buffer, data_buffer ) = split_span( buffer.bytes(), info_size );
+    info = std::u8string_view( reinterpret_cast< char8_t const * >( info_buffer.data() ), info_buffer.size() );
+    data = std::u8string_view( reinterpret_cast< char8_t const * >( data_buffer.data() ), data_buffer.size() );
+}
+
+SaveFile::Snapshot::Sections::Sections( TempFileMapping temp_file, size_t const info_size )
+    : temp_file_mapping( std::move( temp_file ) )
+{
+    std::tie( info_buffer, data_buffer ) = split_span( temp_file_mapping->bytes(), info_size );
+    info = std::u8string_view( reinterpret_cast< char8_t const * >( info_buffer.data() ), info_buffer.size() );
+    data = std::u8string_view( reinterpret_cast< char8_t const * >( data_buffer.data() ), data_buffer.size() );
+}
+
+SaveFile::Snapshot::Sections::Sections( SectionCache::Entry cached )
+    : info( reinterpret_cast< char8_t const * >( cached.info.data() ), cached.info.size() )
+    , data( reinterpret_cast< char8_t const * >( cached.data.data() ), cached.data.size() )
+{
+    mapping.emplace( std::move( cached.mapping ) );
+}
 
-SaveFile::SaveFile( std::u8string_view const &file_path ) : original_file_path( file_path )
+JsonIndex const &SaveFile::Snapshot::Sections::get_data_index() const
 {
-    open_and_decompress_save( original_file_path );
-    get_save_name();
-    get_driver_data_from_json();
+    std::call_once( data_index_built, [ this ]() { data_index.emplace( data ); } );
+    return data_index.value();
 }
 
-void SaveFile::open_and_decompress_save( std::u8string const &file_path )
+SaveFile::Snapshot::Snapshot( std::u8string const &file_path, std::span< std::byte const > const file_data,
+                              Residency const residency, bool const use_index_file,
+                              SectionCache *const cache )
+    : file_backed( residency == Residency::file_backed )
+    , section_cache( cache )
 {
-    ReadFileMapping const save_file( file_path );
-    std::span< std::byte const > remaining_file_data = save_file.bytes();
+    std::span< std::byte const > remaining_file_data = file_data;
 
     SaveFileHeader const *header = read_save_file_header( remaining_file_data, file_path );
     remaining_file_data =
@@ -786,63 +1673,277 @@ void SaveFile::open_and_decompress_save( std::u8string const &file_path )
                                      static_cast< size_t >( header->compressed_info_size ) +
                                          static_cast< size_t >( header->compressed_data_size ) );
 
-    auto const [ compressed_save_info, compressed_save_data ] =
-        split_span( remaining_file_data, static_cast< size_t >( header->compressed_info_size ) );
+    // The compressed sections are kept so that writing can reuse the parts that did not change
+    compressed_buffer = LargeBuffer( remaining_file_data.size() );
+    std::copy( remaining_file_data.begin(), remaining_file_data.end(), compressed_buffer.get() );
+    std::tie( compressed_save_info, compressed_save_data ) =
+        split_span( std::span< std::byte const >( compressed_buffer.get(), remaining_file_data.size() ),
+                    static_cast< size_t >( header->compressed_info_size ) );
+
+    decompressed_info_size = static_cast< size_t >( header->decompressed_info_size );
+    decompressed_data_size = static_cast< size_t >( header->decompressed_data_size );
+
+    // The cache and the index file are both checked against a hash of the compressed sections
+    std::span< std::byte const > const compressed_sections( compressed_buffer.get(), remaining_file_data.size() );
+    uint64_t const sections_hash = ( use_index_file || section_cache != nullptr ) ? hash_bytes( compressed_sections ) : 0;
+    cache_key = SectionCache::Key{ sections_hash, compressed_save_info.size(), compressed_save_data.size(),
+                                   decompressed_info_size, decompressed_data_size };
+
+    // A matching index file leaves nothing to search for, so the sections are only read if they
+    // are kept
+    std::u8string const index_file_path = get_index_file_path( file_path );
+    if ( use_index_file && read_index_file( index_file_path, sections_hash ) )
+    {
+        if ( residency != Residency::compressed )
+        {
+            sections = get_sections( file_path );
+        }
+        return;
+    }
+
+    // The index of a small data section is kept for the next save read on this thread, as
+    // allocating it again costs more than building it. The index of a larger one is freed once the
+    // save is open, so no thread holds on to memory for the largest save it has ever opened.
+    thread_local JsonIndex kept_data_json;
+    JsonIndex unkept_data_json;
+    JsonIndex &data_json =
+        decompressed_data_size <= max_kept_data_index_size ? kept_data_json : unkept_data_json;
+    data_json.clear();
+    data_json.reserve( decompressed_data_size );
+
+    JsonKeyScanner scanner( data_keys );
+    std::shared_ptr< Sections const > read_sections = find_cached_sections();
+    if ( read_sections )
+    {
+        get_save_name( read_sections->info );
+        data_json.append( read_sections->data, true );
+        scanner.scan( data_json );
+    }
+    else
+    {
+        std::shared_ptr< Sections > const decompressed = decompress_and_search( file_path, data_json, scanner );
+        if ( section_cache != nullptr )
+        {
+            section_cache->insert( cache_key, decompressed->info_buffer, decompressed->data_buffer );
+        }
+        read_sections = decompressed;
+    }
+
+    get_driver_data_from_json( data_json, scanner );
+    if ( residency != Residency::compressed )
+    {
+        sections = read_sections;
+    }
+    if ( use_index_file )
+    {
+        std::span< std::byte const > const data_bytes( reinterpret_cast< std::byte const * >( read_sections->data.data() ),
+                                                       read_sections->data.size() );
+        data_checkpoints =
+            Lz4Checkpoints::build( compressed_save_data, data_bytes, index_checkpoint_interval ).value_or( Lz4Checkpoints() );
+        write_index_file( index_file_path, sections_hash );
+    }
+}
+
+std::shared_ptr< SaveFile::Snapshot::Sections > SaveFile::Snapshot::decompress_and_search(
+    std::u8string const &file_path, JsonIndex &data_json, JsonKeyScanner &scanner )
+{
+    auto const decompressed = allocate_sections( file_path );
+    std::span< std::byte > const save_info_buffer = decompressed->info_buffer;
+    std::span< std::byte > const save_data_buffer = decompressed->data_buffer;
+    std::u8string_view const save_info = decompressed->info;
+    std::u8string_view const save_data = decompressed->data;
+
+    // Searching while decompressing only helps if both can run at once
+    if ( save_data_buffer.size() < min_pipelined_data_size || std::thread::hardware_concurrency() < 2 )
+    {
+        lz4_decompress( compressed_save_info, save_info_buffer, file_path );
+        lz4_decompress( compressed_save_data, save_data_buffer, file_path );
+        get_save_name( save_info );
+        data_json.append( save_data, true );
+        scanner.scan( data_json );
+    }
+    else
+    {
+        // The data section is decompressed a slice at a time on another thread, while this thread
+        // decompresses the info section and then searches each slice of the data as it arrives
+        std::atomic< size_t > decompressed_data_size = 0;
+        std::jthread data_decompressor( [ & ]( std::stop_token const stop ) {
+            Lz4SliceDecompressor decompressor( compressed_save_data, save_data_buffer );
+            while ( !decompressor.is_finished() && !stop.stop_requested() )
+            {
+                bool const ok = decompressor.decompress_next( pipeline_slice_size );
+                decompressed_data_size.store( ok ? decompressor.decompressed_size() : data_decompression_failed,
+                                              std::memory_order_release );
+                decompressed_data_size.notify_one();
+                if ( !ok )
+                {
+                    return;
+                }
+            }
+        } );
 
-    size_t const total_decompressed_size = static_cast< size_t >( header->decompressed_info_size ) +
-                                           static_cast< size_t >( header->decompressed_data_size );
-    decompressed_buffer = std::make_unique_for_overwrite< std::byte[] >( total_decompressed_size );
-    auto const [ save_info_buffer, save_data_buffer ] =
-        split_span( std::span( decompressed_buffer.get(), total_decompressed_size ),
-                    static_cast< size_t >( header->decompressed_info_size ) );
+        lz4_decompress( compressed_save_info, save_info_buffer, file_path );
+        get_save_name( save_info );
 
-    lz4_decompress( compressed_save_info, save_info_buffer, file_path );
-    lz4_decompress( compressed_save_data, save_data_buffer, file_path );
+        for ( size_t size = 0; size != save_data.size(); )
+        {
+            decompressed_data_size.wait( size, std::memory_order_acquire );
+            size = decompressed_data_size.load( std::memory_order_acquire );
+            if ( size == data_decompression_failed )
+            {
+                throw SaveFixerException( file_path + u8" is invalid or corrupted" );
+            }
+            data_json.append( save_data.substr( 0, size ), size == save_data.size() );
+            scanner.scan( data_json );
+        }
+    }
 
-    save_info = std::u8string_view( reinterpret_cast< char8_t const * >( save_info_buffer.data() ),
-                                    save_info_buffer.size() );
-    save_data = std::u8string_view( reinterpret_cast< char8_t const * >( save_data_buffer.data() ),
-                                    save_data_buffer.size() );
+    return decompressed;
 }
 
-void SaveFile::get_save_name()
+bool SaveFile::Snapshot::read_index_file( std::u8string const &index_file_path, uint64_t const sections_hash )
 {
-    std::u8string_view const save_info_obj_start = u8"\"saveInfo\":{";
+    if ( query_file( index_file_path ) == path_state::does_not_exist )
+    {
+        return false;
+    }
 
-    if ( size_t const save_info_key_start = save_info.find( save_info_obj_start );
-         save_info_key_start != std::u8string_view::npos )
+    try
     {
-        size_t const save_info_obj_opening_brace_pos = save_info_key_start + save_info_obj_start.size() - 1;
+        ReadFileMapping const index_file( index_file_path );
+        CacheReader reader( index_file.bytes() );
+        if ( reader.read< uint32_t >() != index_file_magic || reader.read< uint32_t >() != index_file_version ||
+             reader.read< uint64_t >() != compressed_save_info.size() ||
+             reader.read< uint64_t >() != compressed_save_data.size() ||
+             reader.read< uint64_t >() != decompressed_info_size || reader.read< uint64_t >() != decompressed_data_size ||
+             reader.read< uint64_t >() != sections_hash )
+        {
+            return false;
+        }
 
-        std::optional< size_t > const name_value_pos =
-            lookup_value_in_object( save_info, save_info_obj_opening_brace_pos, u8"name" );
-        if ( name_value_pos.has_value() && save_info[ name_value_pos.value() ] == u8'"' )
+        save_name_offset = reader.read< uint64_t >();
+        save_name_size = reader.read< uint64_t >();
+        original_save_name = reader.read_string();
+        player_team_id = reader.read_string();
+        for ( Driver &driver : drivers )
         {
-            size_t const name_closing_quote = find_closing_quote( save_info, name_value_pos.value() );
-            save_name_offset = name_value_pos.value() + 1;
-            save_name_size = name_closing_quote - save_name_offset;
-            return;
+            driver.name = reader.read_string();
+            uint8_t const position = reader.read< uint8_t >();
+            driver.car_id_file_offset = reader.read< uint64_t >();
+            if ( position > static_cast< uint8_t >( DriverPosition::car2 ) )
+            {
+                return false;
+            }
+            driver.position = driver.original_position = static_cast< DriverPosition >( position );
+            if ( driver.car_id_file_offset > decompressed_data_size ||
+                 get_position_as_json_value( driver.position ).size() > decompressed_data_size - driver.car_id_file_offset )
+            {
+                return false;
+            }
+        }
+
+        // The count is not trusted to size the vector, as a damaged index file could make it huge
+        std::vector< Lz4Checkpoint > checkpoints;
+        for ( uint64_t i = 0, count = reader.read< uint64_t >(); i < count; ++i )
+        {
+            Lz4Checkpoint &checkpoint = checkpoints.emplace_back();
+            checkpoint.cut_input_offset = reader.read< uint64_t >();
+            checkpoint.cut_output_offset = reader.read< uint64_t >();
+            checkpoint.match_offset = reader.read< uint64_t >();
+            checkpoint.match_size = reader.read< uint64_t >();
+            checkpoint.input_offset = reader.read< uint64_t >();
+            checkpoint.output_offset = reader.read< uint64_t >();
+            std::span< std::byte const > const window = reader.read_bytes();
+            checkpoint.window.assign( window.begin(), window.end() );
         }
+        data_checkpoints = Lz4Checkpoints( std::move( checkpoints ), decompressed_data_size );
+
+        return reader.empty() && save_name_offset <= decompressed_info_size &&
+               save_name_size <= decompressed_info_size - save_name_offset &&
+               original_save_name.size() == save_name_size;
+    }
+    catch ( CacheReader::Invalid const & )
+    {
+        return false;
+    }
+    catch ( SaveFixerException const & )
+    {
+        return false;
+    }
+}
+
+void SaveFile::Snapshot::write_index_file( std::u8string const &index_file_path, uint64_t const sections_hash ) const
+{
+    CacheWriter writer;
+    writer.write( index_file_magic );
+    writer.write( index_file_version );
+    writer.write( static_cast< uint64_t >( compressed_save_info.size() ) );
+    writer.write( static_cast< uint64_t >( compressed_save_data.size() ) );
+    writer.write( static_cast< uint64_t >( decompressed_info_size ) );
+    writer.write( static_cast< uint64_t >( decompressed_data_size ) );
+    writer.write( sections_hash );
+    writer.write( static_cast< uint64_t >( save_name_offset ) );
+    writer.write( static_cast< uint64_t >( save_name_size ) );
+    writer.write_string( original_save_name );
+    writer.write_string( player_team_id );
+    for ( Driver const &driver : drivers )
+    {
+        writer.write_string( driver.name );
+        writer.write( static_cast< uint8_t >( driver.position ) );
+        writer.write( static_cast< uint64_t >( driver.car_id_file_offset ) );
+    }
+    writer.write( static_cast< uint64_t >( data_checkpoints.get_checkpoints().size() ) );
+    for ( Lz4Checkpoint const &checkpoint : data_checkpoints.get_checkpoints() )
+    {
+        writer.write( static_cast< uint64_t >( checkpoint.cut_input_offset ) );
+        writer.write( static_cast< uint64_t >( checkpoint.cut_output_offset ) );
+        writer.write( static_cast< uint64_t >( checkpoint.match_offset ) );
+        writer.write( static_cast< uint64_t >( checkpoint.match_size ) );
+        writer.write( static_cast< uint64_t >( checkpoint.input_offset ) );
+        writer.write( static_cast< uint64_t >( checkpoint.output_offset ) );
+        writer.write_bytes( checkpoint.window );
+    }
+
+    try
+    {
+        write_cache_file( index_file_path, writer.bytes );
+    }
+    catch ( SaveFixerException const & )
+    {
+        // The save can still be opened without it, for example from a folder that is read only
     }
-    throw SaveFixerException( u8"could not find save name in save file"s );
 }
 
-void SaveFile::get_driver_data_from_json()
+void SaveFile::Snapshot::get_save_name( std::u8string_view const save_info )
+{
+    std::u8string_view const name = find_save_name( JsonIndex( save_info ) ).value();
+    original_save_name = name;
+    save_name_offset = static_cast< size_t >( name.data() - save_info.data() );
+    save_name_size = name.size();
+}
+
+void SaveFile::Snapshot::get_driver_data_from_json( JsonIndex const &data_json, JsonKeyScanner const &scanner )
 {
-    std::u8string_view const player_team_id = get_player_team_id( save_data );
+    std::span< JsonKeyHit const > const hits = scanner.get_hits();
+    player_team_id = find_player_team_id( data_json, hits );
+    std::u8string const team_ref = u8"{\"$ref\":\""s + player_team_id + u8"\"}"s;
 
     std::vector< Driver > found_drivers;
-    for_each_employeer_team_ref( save_data, player_team_id, [ & ]( size_t const employeer_team_ref_offset ) {
-        size_t const contract_key_offset =
-            find_employeer_team_ref_contract_offset( save_data, employeer_team_ref_offset );
-        if ( contract_key_offset != std::u8string_view::npos )
+    for ( JsonKeyHit const &hit : hits )
+    {
+        if ( !is_key( hit, DataKey::employeer_team ) )
+        {
+            continue;
+        }
+        size_t const employee_object_offset = find_employee_object_offset( data_json, hits, hit, team_ref );
+        if ( employee_object_offset != JsonIndex::npos )
         {
-            if ( std::optional< Driver > d = maybe_get_driver( save_data, contract_key_offset ); d.has_value() )
+            if ( std::optional< Driver > d = maybe_get_driver( data_json, hits, employee_object_offset ); d.has_value() )
             {
                 found_drivers.emplace_back( std::move( d.value() ) );
             }
         }
-    } );
+    }
 
     if ( found_drivers.size() != 3U )
     {
@@ -855,47 +1956,398 @@ void SaveFile::get_driver_data_from_json()
     std::copy( found_drivers.begin(), found_drivers.end(), drivers.begin() );
 }
 
+std::shared_ptr< SaveFile::Snapshot::Sections const > SaveFile::Snapshot::find_cached_sections() const
+{
+    if ( section_cache == nullptr )
+    {
+        return nullptr;
+    }
+    std::optional< SectionCache::Entry > cached = section_cache->find( cache_key );
+    return cached.has_value() ? std::make_shared< Sections const >( std::move( cached.value() ) ) : nullptr;
+}
+
+std::shared_ptr< SaveFile::Snapshot::Sections > SaveFile::Snapshot::allocate_sections( std::u8string const &file_path ) const
+{
+    if ( file_backed )
+    {
+        TempFileMapping temp_file( file_path, decompressed_info_size + decompressed_data_size );
+        return std::make_shared< Sections >( std::move( temp_file ), decompressed_info_size );
+    }
+    return std::make_shared< Sections >( decompressed_info_size, decompressed_data_size );
+}
+
+std::shared_ptr< SaveFile::Snapshot::Sections const > SaveFile::Snapshot::get_sections( std::u8string const &file_path ) const
+{
+    if ( sections )
+    {
+        return sections;
+    }
+    if ( std::shared_ptr< Sections const > cached = find_cached_sections() )
+    {
+        return cached;
+    }
+    auto decompressed = allocate_sections( file_path );
+    lz4_decompress( compressed_save_info, decompressed->info_buffer, file_path );
+
+    // The parts of the data section between checkpoints can be decompressed at the same time
+    if ( !data_checkpoints.get_checkpoints().empty() && std::thread::hardware_concurrency() >= 2 )
+    {
+        ThreadPool pool;
+        if ( data_checkpoints.decompress( compressed_save_data, decompressed->data_buffer, pool ) )
+        {
+            return decompressed;
+        }
+    }
+    lz4_decompress( compressed_save_data, decompressed->data_buffer, file_path );
+    return decompressed;
+}
+
+SaveFile::Snapshot::Sections const &SaveFile::Snapshot::get_kept_sections() const
+{
+    if ( !sections )
+    {
+        throw SaveFixerException( u8"the decompressed save is not kept in memory"s );
+    }
+    return *sections;
+}
+
+std::u8string_view SaveFile::get_original_save_name() const
+{
+    return snapshot->original_save_name;
+}
+
+std::u8string_view SaveFile::get_player_team_id() const
+{
+    return snapshot->player_team_id;
+}
+
+std::u8string_view SaveFile::get_save_data() const
+{
+    return snapshot->get_kept_sections().data;
+}
+
+std::u8string SaveFile::read_save_data( size_t const offset, size_t const size ) const
+{
+    if ( offset > snapshot->decompressed_data_size || size > snapshot->decompressed_data_size - offset )
+    {
+        throw SaveFixerException( u8"the range is outside the data section of "s + original_file_path );
+    }
+    if ( snapshot->sections )
+    {
+        return std::u8string( snapshot->sections->data.substr( offset, size ) );
+    }
+
+    std::u8string range( size, u8'\0' );
+    if ( snapshot->data_checkpoints.decompress_range( snapshot->compressed_save_data, offset, offset + size,
+                                                      std::as_writable_bytes( std::span( range ) ) ) )
+    {
+        return range;
+    }
+    return std::u8string( snapshot->get_sections( original_file_path )->data.substr( offset, size ) );
+}
+
+std::vector< SaveFile::TeamDrivers > SaveFile::find_all_team_drivers( ThreadPool *const pool ) const
+{
+    std::optional< ThreadPool > local_pool;
+    ThreadPool &audit_pool = ( pool != nullptr ) ? *pool : local_pool.emplace();
+
+    std::shared_ptr< Snapshot::Sections const > const sections = snapshot->get_sections( original_file_path );
+    JsonIndex const &data_json = sections->get_data_index();
+    size_t const size = data_json.text().size();
+    size_t const part_count =
+        std::clamp( size / min_audit_part_size, size_t{ 1 }, audit_pool.thread_count() * audit_parts_per_thread );
+    std::vector< AuditPart > parts( part_count );
+    for ( size_t i = 0; i < part_count; ++i )
+    {
+        parts[ i ].begin = i * ( size / part_count );
+        parts[ i ].end = ( i + 1 == part_count ) ? size : ( i + 1 ) * ( size / part_count );
+    }
+
+    for_each_audit_part( audit_pool, parts, [ & ]( AuditPart &part ) {
+        JsonKeyScanner scanner( data_keys );
+        scanner.scan( data_json, part.begin, part.end );
+        part.hits = scanner.get_hits();
+    } );
+
+    // A contract can be found from any part, as the employee it is in can start in an earlier part
+    std::vector< JsonKeyHit > hits;
+    for ( AuditPart &part : parts )
+    {
+        part.first_hit = hits.size();
+        hits.insert( hits.end(), part.hits.begin(), part.hits.end() );
+        part.hits = {};
+    }
+
+    for_each_audit_part( audit_pool, parts, [ & ]( AuditPart &part ) {
+        size_t const hits_end = ( &part == &parts.back() ) ? hits.size() : ( &part + 1 )->first_hit;
+        for ( size_t i = part.first_hit; i < hits_end; ++i )
+        {
+            if ( !is_key( hits[ i ], DataKey::employeer_team ) )
+            {
+                continue;
+            }
+            std::optional< std::u8string_view > const team_id = find_employeer_team_id( data_json, hits[ i ] );
+            size_t const employee_object_offset = find_employee_object_offset( hits, hits[ i ] );
+            if ( team_id.has_value() && employee_object_offset != JsonIndex::npos )
+            {
+                if ( std::optional< Driver > d = maybe_get_driver( data_json, hits, employee_object_offset ); d.has_value() )
+                {
+                    part.drivers.emplace_back( team_id.value(), std::move( d.value() ) );
+                }
+            }
+        }
+    } );
+
+    std::vector< TeamDrivers > teams;
+    std::unordered_map< std::u8string_view, size_t > team_indexes;
+    for ( AuditPart &part : parts )
+    {
+        for ( auto &[ team_id, driver ] : part.drivers )
+        {
+            auto const [ team, is_new ] = team_indexes.try_emplace( team_id, teams.size() );
+            if ( is_new )
+            {
+                teams.push_back( TeamDrivers{ std::u8string( team_id ), {} } );
+            }
+            teams[ team->second ].drivers.push_back( std::move( driver ) );
+        }
+    }
+    return teams;
+}
+
+bool SaveFile::team_positions_are_valid( std::span< Driver const > const drivers )
+{
+    auto const count = [ & ]( DriverPosition const p ) {
+        return std::count_if( drivers.begin(), drivers.end(), [ & ]( Driver const &d ) { return d.position == p; } );
+    };
+    return count( DriverPosition::car1 ) == 1 && count( DriverPosition::car2 ) == 1;
+}
+
+bool SaveFile::fix_team_positions( std::span< Driver > const drivers )
+{
+    if ( drivers.size() < 2 )
+    {
+        return false;
+    }
+
+    bool has_car1 = false;
+    bool has_car2 = false;
+    for ( Driver &d : drivers )
+    {
+        if ( d.position != DriverPosition::reserve )
+        {
+            bool &has_car = ( d.position == DriverPosition::car1 ) ? has_car1 : has_car2;
+            if ( has_car )
+            {
+                d.position = DriverPosition::reserve;
+            }
+            has_car = true;
+        }
+    }
+
+    auto const give_missing_cars = [ & ]( bool const lost_a_car ) {
+        for ( Driver &d : drivers )
+        {
+            if ( ( has_car1 && has_car2 ) || d.position != DriverPosition::reserve ||
+                 ( d.original_position != DriverPosition::reserve ) != lost_a_car )
+            {
+                continue;
+            }
+            d.position = has_car1 ? DriverPosition::car2 : DriverPosition::car1;
+            ( has_car1 ? has_car2 : has_car1 ) = true;
+        }
+    };
+    give_missing_cars( true );
+    give_missing_cars( false );
+    return true;
+}
+
+void SaveFile::set_driver_position( Driver const &driver )
+{
+    for ( Driver &d : drivers )
+    {
+        if ( d.car_id_file_offset == driver.car_id_file_offset )
+        {
+            d.position = driver.position;
+            return;
+        }
+    }
+    if ( driver.position != driver.original_position )
+    {
+        add_edit( Edit{ Section::data, driver.car_id_file_offset,
+                        get_position_as_json_value( driver.original_position ).size(),
+                        std::u8string( get_position_as_json_value( driver.position ) ) } );
+    }
+}
+
+JsonRefTable SaveFile::build_ref_table( ThreadPool *const pool ) const
+{
+    return JsonRefTable( snapshot->get_kept_sections().get_data_index(), pool );
+}
+
 std::array< SaveFile::DriverRef, 3 > SaveFile::get_drivers()
 {
     return { drivers[ 0 ].ref(), drivers[ 1 ].ref(), drivers[ 2 ].ref() };
 }
 
-void SaveFile::write( std::u8string const &file_path, std::u8string const &new_save_name, bool allow_overwrite ) const
+bool SaveFile::driver_positions_are_unique( std::array< DriverPosition, 3 > const &positions )
+{
+    auto const count = [ & ]( DriverPosition const p ) { return std::count( positions.begin(), positions.end(), p ); };
+    return count( DriverPosition::car1 ) == 1 && count( DriverPosition::car2 ) == 1 &&
+           count( DriverPosition::reserve ) == 1;
+}
+
+bool SaveFile::driver_positions_are_unique() const
+{
+    return driver_positions_are_unique( { drivers[ 0 ].position, drivers[ 1 ].position, drivers[ 2 ].position } );
+}
+
+void SaveFile::write( std::u8string const &file_path, std::u8string const &new_save_name, bool allow_overwrite,
+                      ThreadPool *const pool, CompressionPolicy const &compression ) const
 {
-    UncompressedOutput output = create_uncompressed_output( save_info, save_data, save_name_offset,
-                                                            save_name_size, new_save_name, drivers );
+    std::shared_ptr< Snapshot::Sections const > const sections = snapshot->get_sections( original_file_path );
+    EditedOutput const output = create_edited_output( sections->info, sections->data, snapshot->save_name_offset,
+                                                      snapshot->save_name_size, new_save_name, drivers, edits );
 
     constexpr bool overwrite_temp_file = true;
-    size_t const max_output_size = sizeof( SaveFileHeader ) + lz4_max_compressed_size( output.info ) +
-                                   lz4_max_compressed_size( output.data );
+    size_t const max_output_size = max_compressed_save_size( output );
     WriteFileMapping file_out( file_path + u8".mmsftmp"s, max_output_size, overwrite_temp_file );
+    size_t const output_size =
+        compress_save( output, snapshot->compressed_save_info, snapshot->compressed_save_data, file_out.bytes(), pool,
+                       compression );
+
+    WriteFileMapping::write_truncate_and_rename( std::move( file_out ), file_path, output_size, allow_overwrite );
+}
+
+//-----------------------------------------------------------------------------
+// StreamedSaveFile
+//-----------------------------------------------------------------------------
+
+StreamedSaveFile::StreamedSaveFile( std::u8string_view const &file_path ) : original_file_path( file_path )
+{
+    ReadFileMapping const save_file( original_file_path );
+    save_file_hash = hash_bytes( save_file.bytes() );
+
+    SaveFileHeader const *header = read_save_file_header( save_file.bytes(), original_file_path );
+    auto const [ compressed_save_info, compressed_save_data ] =
+        split_span( save_file.bytes().subspan( sizeof( SaveFileHeader ) ), static_cast< size_t >( header->compressed_info_size ) );
+
+    save_info.resize( static_cast< size_t >( header->decompressed_info_size ) );
+    lz4_decompress( compressed_save_info, std::as_writable_bytes( std::span( save_info ) ), original_file_path );
+    std::u8string_view const name = find_save_name( JsonIndex( save_info ) ).value();
+    save_name_offset = static_cast< size_t >( name.data() - save_info.data() );
+    save_name_size = name.size();
+
+    Lz4StreamDecompressor decompressor( compressed_save_data.first( static_cast< size_t >( header->compressed_data_size ) ),
+                                        static_cast< size_t >( header->decompressed_data_size ) );
+    StreamedDriverScanner scanner;
+    for ( ;; )
+    {
+        std::optional< std::span< std::byte const > > const piece = decompressor.next();
+        if ( !piece.has_value() )
+        {
+            throw SaveFixerException( original_file_path + u8" is invalid or corrupted" );
+        }
+        if ( piece->empty() )
+        {
+            break;
+        }
+        scanner.scan( std::u8string_view( reinterpret_cast< char8_t const * >( piece->data() ), piece->size() ) );
+    }
+    scanner.finish( player_team_id, drivers );
+}
+
+std::u8string_view StreamedSaveFile::get_original_save_name() const
+{
+    return std::u8string_view( save_info ).substr( save_name_offset, save_name_size );
+}
+
+std::array< SaveFile::DriverRef, 3 > StreamedSaveFile::get_drivers()
+{
+    return { drivers[ 0 ].ref(), drivers[ 1 ].ref(), drivers[ 2 ].ref() };
+}
+
+bool StreamedSaveFile::driver_positions_are_unique() const
+{
+    return SaveFile::driver_positions_are_unique( { drivers[ 0 ].position, drivers[ 1 ].position, drivers[ 2 ].position } );
+}
+
+void StreamedSaveFile::write( std::u8string const &file_path, std::u8string const &new_save_name,
+                              bool const allow_overwrite, CompressionPolicy const &policy ) const
+{
+    ReadFileMapping const save_file( original_file_path );
+    if ( hash_bytes( save_file.bytes() ) != save_file_hash )
+    {
+        throw SaveFixerException( original_file_path + u8" has changed since it was opened"s );
+    }
+    SaveFileHeader const *header = read_save_file_header( save_file.bytes(), original_file_path );
+    std::span< std::byte const > const compressed_save_data = save_file.bytes().subspan(
+        sizeof( SaveFileHeader ) + static_cast< size_t >( header->compressed_info_size ),
+        static_cast< size_t >( header->compressed_data_size ) );
+
+    std::u8string new_save_info = save_info;
+    new_save_info.replace( save_name_offset, save_name_size, new_save_name );
+
+    // The drivers are in the order they are in the file, so their edits are sorted
+    std::vector< Lz4Edit > data_edits;
+    size_t new_data_size = static_cast< size_t >( header->decompressed_data_size );
+    for ( SaveFile::Driver const &d : drivers )
+    {
+        if ( d.position != d.original_position )
+        {
+            std::u8string_view const original_value = get_position_as_json_value( d.original_position );
+            std::u8string_view const new_value = get_position_as_json_value( d.position );
+            data_edits.push_back( Lz4Edit{ d.car_id_file_offset, original_value.size(), as_bytes( new_value ) } );
+            new_data_size = new_data_size - original_value.size() + new_value.size();
+        }
+    }
+
+    Lz4Compression const compression =
+        policy.automatic ? lz4_choose_compression( new_save_info.size() + new_data_size, policy.time_budget )
+                         : policy.compression;
 
-    SaveFileHeader *save_header = reinterpret_cast< SaveFileHeader * >( file_out.data() );
-    std::span< std::byte > file_out_remaining = file_out.bytes().subspan( sizeof( SaveFileHeader ) );
+    constexpr bool overwrite_temp_file = true;
+    size_t const max_output_size = sizeof( SaveFileHeader ) + lz4_max_compressed_size( new_save_info.size() ) +
+                                   lz4_max_compressed_size( new_data_size );
+    WriteFileMapping file_out( file_path + u8".mmsftmp"s, max_output_size, overwrite_temp_file );
+    std::span< std::byte > const sections_out = file_out.bytes().subspan( sizeof( SaveFileHeader ) );
 
-    size_t const compressed_info_size =
-        lz4_compress( std::as_writable_bytes( output.info ), file_out_remaining );
-    file_out_remaining = file_out_remaining.subspan( compressed_info_size );
+    Lz4StreamCompressor info_compressor( sections_out, compression );
+    info_compressor.write( as_bytes( new_save_info ) );
+    std::optional< size_t > const compressed_info_size = info_compressor.finish();
+    if ( !compressed_info_size.has_value() )
+    {
+        throw SaveFixerException( u8"failed to compress the save"s );
+    }
 
-    size_t const compressed_data_size =
-        lz4_compress( std::as_writable_bytes( output.data ), file_out_remaining );
-    file_out_remaining = file_out_remaining.subspan( compressed_data_size );
+    Lz4StreamDecompressor decompressor( compressed_save_data, static_cast< size_t >( header->decompressed_data_size ) );
+    Lz4StreamCompressor data_compressor( sections_out.subspan( compressed_info_size.value() ), compression );
+    if ( !recompress_streamed_section( decompressor, data_edits, data_compressor ) )
+    {
+        throw SaveFixerException( original_file_path + u8" is invalid or corrupted" );
+    }
+    std::optional< size_t > const compressed_data_size = data_compressor.finish();
+    if ( !compressed_data_size.has_value() )
+    {
+        throw SaveFixerException( u8"failed to compress the save"s );
+    }
 
-    if ( std::cmp_greater( compressed_info_size, std::numeric_limits< int >::max() ) ||
-         std::cmp_greater( output.info.size(), std::numeric_limits< int >::max() ) ||
-         std::cmp_greater( compressed_data_size, std::numeric_limits< int >::max() ) ||
-         std::cmp_greater( output.data.size(), std::numeric_limits< int >::max() ) )
+    if ( std::cmp_greater( compressed_info_size.value(), std::numeric_limits< int >::max() ) ||
+         std::cmp_greater( new_save_info.size(), std::numeric_limits< int >::max() ) ||
+         std::cmp_greater( compressed_data_size.value(), std::numeric_limits< int >::max() ) ||
+         std::cmp_greater( new_data_size, std::numeric_limits< int >::max() ) )
     {
         throw SaveFixerException( u8"output too large"s );
     }
 
+    SaveFileHeader *const save_header = reinterpret_cast< SaveFileHeader * >( file_out.data() );
     save_header->magic = mm_save_file_magic;
     save_header->version = mm_save_file_supported_version;
-    save_header->compressed_info_size = static_cast< int >( compressed_info_size );
-    save_header->decompressed_info_size = static_cast< int >( output.info.size() );
-    save_header->compressed_data_size = static_cast< int >( compressed_data_size );
-    save_header->decompressed_data_size = static_cast< int >( output.data.size() );
+    save_header->compressed_info_size = static_cast< int >( compressed_info_size.value() );
+    save_header->decompressed_info_size = static_cast< int >( new_save_info.size() );
+    save_header->compressed_data_size = static_cast< int >( compressed_data_size.value() );
+    save_header->decompressed_data_size = static_cast< int >( new_data_size );
 
-    WriteFileMapping::write_truncate_and_rename( std::move( file_out ), file_path,
-                                                 max_output_size - file_out_remaining.size(), allow_overwrite );
+    size_t const output_size = sizeof( SaveFileHeader ) + compressed_info_size.value() + compressed_data_size.value();
+    WriteFileMapping::write_truncate_and_rename( std::move( file_out ), file_path, output_size, allow_overwrite );
 }
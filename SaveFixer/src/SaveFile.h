@@ -1,24 +1,84 @@
 #pragma once
 
 #include "Common.h"
+#include "Lz4Block.h"
 
 #include <array>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
 
 namespace save_fixer
 {
+    class JsonRefTable;
+    class SectionCache;
+    class ThreadPool;
+
+    // How the sections of a new save are compressed. The default is LZ4's fast path, which suits
+    // interactive saves. Smaller saves load faster in the game, so with automatic the strongest
+    // level expected to compress the whole save within time_budget is used instead.
+    struct CompressionPolicy
+    {
+        bool automatic = false;
+        Lz4Compression compression;                        // if not automatic
+        std::chrono::milliseconds time_budget{ 1000 };    // if automatic
+    };
+
+    // Motorsport Manager names a save after its file, without the directory or extension
+    std::u8string extract_save_name_from_save_path( std::u8string_view path );
+
+    // Reads just enough of a Motorsport Manager save file to find the save name. Only the start of
+    // the info section is decompressed, which is much cheaper than opening a SaveFile.
+    class SaveFileInfo
+    {
+    public:
+        SaveFileInfo( std::u8string_view const &file_path );
+
+        std::u8string const &get_original_file_path() const { return original_file_path; }
+        std::u8string const &get_save_name() const { return save_name; }
+
+    private:
+        std::u8string const original_file_path;
+        std::u8string save_name;
+    };
+
     // Class that handles the reading of a Motorsport Manager save file to find the player
     // team's drivers and their car IDs (DriverPosition). The practice driver bug occurs
     // when these car IDs are incorrect. This class also allows the positions to be updated
     // and then a new save file to be written with those updates.
+    //
+    // What is read from the file never changes, and copies of a SaveFile share it. Each copy is an
+    // edit session with its own driver positions and edits, so many variants of a save can be made
+    // for the cost of one decode, and written from different threads at once.
     class SaveFile
     {
     public:
-        SaveFile( std::u8string_view const &file_path );
+        // How much of the save is kept in memory while it is open
+        enum class Residency
+        {
+            decompressed,    // Both sections as they are read, so nothing is decompressed again
+            compressed,      // Only the compressed sections, which are decompressed again for each write
+            file_backed,     // Both sections, decompressed into a mapped temporary file next to the save
+                             // so that they can be paged out rather than held in memory
+        };
+
+        // With use_index_file, what opening the save finds is kept in an index file next to it,
+        // <file_path>.idx, so reopening the save skips searching it, and skips decompressing it as
+        // well if only the compressed sections are kept. The index file is checked against a hash
+        // of the compressed sections and written again if it does not match. It also has checkpoints
+        // through the compressed data section, so that read_save_data() decompresses only a few MB
+        // and the whole section can be decompressed on many threads.
+        //
+        // With a section cache, the decompressed sections are mapped from the cache rather than
+        // decompressed whenever they are in it, and added to it when they are not. The cache must
+        // outlive the SaveFile and its copies.
+        SaveFile( std::u8string_view const &file_path, Residency residency = Residency::decompressed,
+                  bool use_index_file = false, SectionCache *section_cache = nullptr );
 
         enum class DriverPosition
         {
@@ -52,26 +112,124 @@ namespace save_fixer
             size_t car_id_file_offset;
         };
 
+        // The drivers of one team, in the order they are in the file
+        struct TeamDrivers
+        {
+            std::u8string team_id;
+            std::vector< Driver > drivers;
+        };
+
         std::u8string const &get_original_file_path() const { return original_file_path; }
+        std::u8string_view get_original_save_name() const;
+        std::u8string_view get_player_team_id() const;
+
+        // The decompressed data section, which the offsets in a ref table are into. Throws
+        // SaveFixerException if only the compressed sections are kept.
+        std::u8string_view get_save_data() const;
+
+        // The part of the data section from offset. If the sections are not kept, it is decompressed
+        // from the checkpoint before it in the index file, so only a few MB of the section are,
+        // else the whole section is decompressed again. Throws SaveFixerException if the part is
+        // not in the section.
+        std::u8string read_save_data( size_t offset, size_t size ) const;
+
+        // Maps every "$id" in the data section to its object and its refs, with the section
+        // scanned on the pool, or on a new pool if none is given. Throws SaveFixerException if
+        // only the compressed sections are kept.
+        JsonRefTable build_ref_table( ThreadPool *pool = nullptr ) const;
+
         std::array< DriverRef, 3 > get_drivers();
 
+        // The practice driver bug is present when two drivers share a position
+        static bool driver_positions_are_unique( std::array< DriverPosition, 3 > const &positions );
+        bool driver_positions_are_unique() const;
+
+        // Finds the drivers of every team, not just the player team's, by grouping the employees by
+        // the team in their contract. The data section is scanned once, in parts on the pool, or on
+        // a new pool if none is given. The teams are in the order their first driver is in the file.
+        std::vector< TeamDrivers > find_all_team_drivers( ThreadPool *pool = nullptr ) const;
+
+        // A team's positions are valid when each car has exactly one driver, however many reserves
+        // there are
+        static bool team_positions_are_valid( std::span< Driver const > drivers );
+
+        // Gives each car to exactly one driver. The first driver in the file with a car keeps it,
+        // and a car that no one has goes to a driver that lost a shared car, else to the first
+        // reserve. Returns false if the team has fewer than two drivers.
+        static bool fix_team_positions( std::span< Driver > drivers );
+
+        // Writes the position of a driver from find_all_team_drivers when the save is written. Must
+        // be called at most once for each driver outside the player team.
+        void set_driver_position( Driver const &driver );
+
+        enum class Section
+        {
+            info,
+            data,
+        };
+
+        // A change to a decompressed section, made when the save is written. The offset and
+        // original size are in the original section.
+        struct Edit
+        {
+            Section section;
+            size_t offset;
+            size_t original_size;
+            std::u8string new_text;
+        };
+
+        // Edits are made along with the new save name and driver positions. They are checked when
+        // the save is written, and must not overlap each other, the save name or a changed driver
+        // position. An edit that replaces nothing makes that section be compressed in full.
+        void add_edit( Edit edit ) { edits.push_back( std::move( edit ) ); }
+        std::span< Edit const > get_edits() const { return edits; }
+
+        // Sections that have to be compressed in full are compressed on the pool, or on a new pool
+        // if none is given
         void write( std::u8string const &file_path, std::u8string const &save_name,
-                    bool allow_overwrite = false ) const;
+                    bool allow_overwrite = false, ThreadPool *pool = nullptr,
+                    CompressionPolicy const &compression = {} ) const;
 
     private:
-        void open_and_decompress_save( std::u8string const &file_path );
-        void get_save_name();
-        void get_driver_data_from_json();
+        struct Snapshot;
 
-        std::u8string const original_file_path;
+        std::u8string original_file_path;
+        std::shared_ptr< Snapshot const > snapshot;
 
-        std::unique_ptr< std::byte[] > decompressed_buffer;
-        std::u8string_view save_info;
-        std::u8string_view save_data;
+        std::array< Driver, 3 > drivers;
+        std::vector< Edit > edits;
+    };
+
+    // Fixes the player team's drivers in a save without ever holding its data section in memory,
+    // for saves too large to open as a SaveFile. Opening the save decompresses the data section
+    // through a 64KB window to find the drivers, and writing decompresses it again and compresses
+    // it as it goes, with the new positions put in on the way. Only the info section, which is
+    // small, is held in full, so the memory used does not grow with the save. The cost is the
+    // second decompression, and that the new save is compressed on one thread.
+    class StreamedSaveFile
+    {
+    public:
+        // Throws SaveFixerException on error
+        explicit StreamedSaveFile( std::u8string_view const &file_path );
+
+        std::u8string const &get_original_file_path() const { return original_file_path; }
+        std::u8string_view get_original_save_name() const;
+        std::u8string_view get_player_team_id() const { return player_team_id; }
+
+        std::array< SaveFile::DriverRef, 3 > get_drivers();
+        bool driver_positions_are_unique() const;
+
+        // Throws SaveFixerException if the save has changed since it was opened
+        void write( std::u8string const &file_path, std::u8string const &save_name, bool allow_overwrite = false,
+                    CompressionPolicy const &compression = {} ) const;
 
+    private:
+        std::u8string original_file_path;
+        uint64_t save_file_hash;
+        std::u8string save_info;
         size_t save_name_offset;
         size_t save_name_size;
-
-        std::array< Driver, 3 > drivers;
+        std::u8string player_team_id;
+        std::array< SaveFile::Driver, 3 > drivers;
     };
 }
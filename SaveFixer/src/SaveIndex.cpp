@@ -0,0 +1,265 @@
+#include "SaveIndex.h"
+
+#include "CacheFile.h"
+#include "FileSystem.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <map>
+
+using namespace save_fixer;
+
+// The cache file is a header followed by the entries, all in native byte order:
+//
+// * magic, version, entry count
+// * for each entry: file size, modified time, flags, then length prefixed strings for the path,
+//   error, save name, player team ID, and the three driver names each followed by their position
+//
+// A cache written by a different version, or which fails to parse, is ignored rather than
+// reported as an error because it can always be rebuilt.
+
+namespace
+{
+    constexpr uint32_t cache_magic = 0x4958534D;    // "MSXI"
+    constexpr uint32_t cache_version = 1;
+
+    constexpr uint8_t entry_flag_error = 1;
+    constexpr uint8_t entry_flag_practice_driver_bug = 2;
+
+    //-------------------------------------------------------------------------
+    // Listing the saves folder
+    //-------------------------------------------------------------------------
+
+    struct ListedFile
+    {
+        std::u8string file_path;
+        uint64_t file_size;
+        int64_t modified_time;
+    };
+
+    std::vector< ListedFile > list_save_files( std::u8string const &directory_path )
+    {
+        std::error_code ec;
+        std::filesystem::directory_iterator it( std::filesystem::path( directory_path ), ec );
+        if ( ec )
+        {
+            throw SaveFixerException( u8"failed to read folder \""s + directory_path + u8"\""s );
+        }
+
+        std::vector< ListedFile > files;
+        for ( ; it != std::filesystem::directory_iterator(); it.increment( ec ) )
+        {
+            if ( ec )
+            {
+                throw SaveFixerException( u8"failed to read folder \""s + directory_path + u8"\""s );
+            }
+
+            std::filesystem::directory_entry const &entry = *it;
+            if ( entry.path().extension() != ".sav" || !entry.is_regular_file( ec ) )
+            {
+                continue;
+            }
+
+            uint64_t const file_size = entry.file_size( ec );
+            std::filesystem::file_time_type const modified_time = entry.last_write_time( ec );
+            if ( ec )
+            {
+                // The file was removed while the folder was being read
+                continue;
+            }
+            files.push_back(
+                ListedFile{ entry.path().u8string(), file_size, modified_time.time_since_epoch().count() } );
+        }
+        return files;
+    }
+
+    //-------------------------------------------------------------------------
+    // Indexing a save
+    //-------------------------------------------------------------------------
+
+    SaveIndexEntry index_save_file( ListedFile const &file )
+    {
+        SaveIndexEntry entry;
+        entry.file_path = file.file_path;
+        entry.file_size = file.file_size;
+        entry.modified_time = file.modified_time;
+
+        try
+        {
+            SaveFile save_file( file.file_path );
+
+            entry.save_name = save_file.get_original_save_name();
+            entry.player_team_id = save_file.get_player_team_id();
+            std::array< SaveFile::DriverRef, 3 > const drivers = save_file.get_drivers();
+            for ( size_t i = 0; i < drivers.size(); ++i )
+            {
+                entry.drivers[ i ] = SaveIndexEntry::Driver{ std::u8string( drivers[ i ].name ), drivers[ i ].position };
+            }
+            entry.has_practice_driver_bug = !save_file.driver_positions_are_unique();
+        }
+        catch ( SaveFixerException const &ex )
+        {
+            entry.error = ex.description;
+        }
+        catch ( std::bad_alloc const & )
+        {
+            entry.error = u8"out of memory"s;
+        }
+        return entry;
+    }
+
+    //-------------------------------------------------------------------------
+    // Cache file
+    //-------------------------------------------------------------------------
+
+    SaveFile::DriverPosition read_driver_position( CacheReader &reader )
+    {
+        switch ( uint8_t const value = reader.read< uint8_t >() )
+        {
+            case static_cast< uint8_t >( SaveFile::DriverPosition::reserve ):
+            case static_cast< uint8_t >( SaveFile::DriverPosition::car1 ):
+            case static_cast< uint8_t >( SaveFile::DriverPosition::car2 ):
+                return static_cast< SaveFile::DriverPosition >( value );
+            default:
+                throw CacheReader::Invalid();
+        }
+    }
+
+    std::vector< SaveIndexEntry > read_cache_file( std::u8string const &cache_file_path )
+    {
+        if ( query_file( cache_file_path ) == path_state::does_not_exist )
+        {
+            return {};
+        }
+
+        try
+        {
+            ReadFileMapping const cache_file( cache_file_path );
+            CacheReader reader( cache_file.bytes() );
+            if ( reader.read< uint32_t >() != cache_magic || reader.read< uint32_t >() != cache_version )
+            {
+                return {};
+            }
+
+            std::vector< SaveIndexEntry > entries;
+            for ( uint32_t i = 0, count = reader.read< uint32_t >(); i < count; ++i )
+            {
+                SaveIndexEntry &entry = entries.emplace_back();
+                entry.file_size = reader.read< uint64_t >();
+                entry.modified_time = reader.read< int64_t >();
+                uint8_t const flags = reader.read< uint8_t >();
+                entry.file_path = reader.read_string();
+                std::u8string error = reader.read_string();
+                if ( flags & entry_flag_error )
+                {
+                    entry.error = std::move( error );
+                }
+                entry.save_name = reader.read_string();
+                entry.player_team_id = reader.read_string();
+                for ( SaveIndexEntry::Driver &driver : entry.drivers )
+                {
+                    driver.name = reader.read_string();
+                    driver.position = read_driver_position( reader );
+                }
+                entry.has_practice_driver_bug = ( flags & entry_flag_practice_driver_bug ) != 0;
+            }
+
+            if ( !reader.empty() )
+            {
+                return {};
+            }
+            return entries;
+        }
+        catch ( CacheReader::Invalid const & )
+        {
+            return {};
+        }
+        catch ( SaveFixerException const & )
+        {
+            return {};
+        }
+    }
+
+    std::vector< std::byte > serialize_cache( std::vector< SaveIndexEntry > const &entries )
+    {
+        CacheWriter writer;
+        writer.write( cache_magic );
+        writer.write( cache_version );
+        writer.write( static_cast< uint32_t >( entries.size() ) );
+        for ( SaveIndexEntry const &entry : entries )
+        {
+            uint8_t const flags = ( entry.error.has_value() ? entry_flag_error : 0 ) |
+                                  ( entry.has_practice_driver_bug ? entry_flag_practice_driver_bug : 0 );
+            writer.write( entry.file_size );
+            writer.write( entry.modified_time );
+            writer.write( flags );
+            writer.write_string( entry.file_path );
+            writer.write_string( entry.error.has_value() ? std::u8string_view( entry.error.value() ) : u8""sv );
+            writer.write_string( entry.save_name );
+            writer.write_string( entry.player_team_id );
+            for ( SaveIndexEntry::Driver const &driver : entry.drivers )
+            {
+                writer.write_string( driver.name );
+                writer.write( static_cast< uint8_t >( driver.position ) );
+            }
+        }
+        return std::move( writer.bytes );
+    }
+}
+
+SaveIndex::SaveIndex( std::optional< std::u8string > cache_path ) : cache_file_path( std::move( cache_path ) )
+{
+    if ( cache_file_path.has_value() )
+    {
+        entries = read_cache_file( cache_file_path.value() );
+    }
+}
+
+size_t SaveIndex::update( std::u8string const &directory_path )
+{
+    std::map< std::u8string_view, SaveIndexEntry const * > cached;
+    for ( SaveIndexEntry const &entry : entries )
+    {
+        cached.emplace( entry.file_path, &entry );
+    }
+
+    std::vector< ListedFile > const files = list_save_files( directory_path );
+
+    // Reuse the cached entry for any file with the same path, size and modified time
+    std::vector< SaveIndexEntry > new_entries( files.size() );
+    std::vector< size_t > changed_files;
+    for ( size_t i = 0; i < files.size(); ++i )
+    {
+        if ( auto const it = cached.find( files[ i ].file_path );
+             it != cached.end() && it->second->file_size == files[ i ].file_size &&
+             it->second->modified_time == files[ i ].modified_time )
+        {
+            new_entries[ i ] = *it->second;
+        }
+        else
+        {
+            changed_files.push_back( i );
+        }
+    }
+
+    ThreadPool pool;
+    pool.parallel_for( changed_files.size(), [ & ]( size_t const i ) {
+        new_entries[ changed_files[ i ] ] = index_save_file( files[ changed_files[ i ] ] );
+    } );
+
+    std::sort( new_entries.begin(), new_entries.end(),
+               []( SaveIndexEntry const &a, SaveIndexEntry const &b ) { return a.file_path < b.file_path; } );
+    entries = std::move( new_entries );
+    return changed_files.size();
+}
+
+void SaveIndex::write_cache() const
+{
+    if ( !cache_file_path.has_value() )
+    {
+        return;
+    }
+
+    write_cache_file( cache_file_path.value(), serialize_cache( entries ) );
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Common.h"
+#include "SaveFile.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace save_fixer
+{
+    // What was found in one save file when the saves folder was indexed
+    struct SaveIndexEntry
+    {
+        struct Driver
+        {
+            std::u8string name;
+            SaveFile::DriverPosition position;
+        };
+
+        std::u8string file_path;
+        uint64_t file_size = 0;
+        int64_t modified_time = 0;
+
+        // Set if the save could not be read, in which case the other fields are empty
+        std::optional< std::u8string > error;
+
+        std::u8string save_name;
+        std::u8string player_team_id;
+        std::array< Driver, 3 > drivers;
+        bool has_practice_driver_bug = false;
+    };
+
+    // Index of every save file in a folder. Saves are opened in parallel, and the results can be
+    // kept in a cache file so that only new or changed saves are opened next time.
+    class SaveIndex
+    {
+    public:
+        // The cache file is read if it exists. A missing, outdated or corrupt cache is ignored.
+        explicit SaveIndex( std::optional< std::u8string > cache_file_path = std::nullopt );
+
+        // Updates the index to match the .sav files in the directory. Returns the number of saves
+        // that had to be opened. Throws SaveFixerException if the directory cannot be read.
+        size_t update( std::u8string const &directory_path );
+
+        // Writes the cache file, if there is one
+        void write_cache() const;
+
+        // Sorted by file path
+        std::vector< SaveIndexEntry > const &get_entries() const { return entries; }
+
+    private:
+        std::optional< std::u8string > const cache_file_path;
+        std::vector< SaveIndexEntry > entries;
+    };
+}
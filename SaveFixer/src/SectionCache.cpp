@@ -0,0 +1,187 @@
+#include "SectionCache.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+using namespace save_fixer;
+
+// Each entry is a file of a header followed by the decompressed info and data sections, so that
+// mapping the file gives the sections as they are. The header is in native byte order:
+//
+// * magic, version
+// * the key: hash, compressed info size, compressed data size, decompressed info size,
+//   decompressed data size
+//
+// The files are named after the hash. How recently an entry was used is its modified time, which
+// is updated whenever it is found.
+
+namespace
+{
+    constexpr uint32_t entry_magic = 0x4358534D;    // "MSXC"
+    constexpr uint32_t entry_version = 1;
+    constexpr std::u8string_view entry_extension = u8".mmsc";
+
+    struct EntryHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        SectionCache::Key key;
+    };
+
+    struct ListedEntry
+    {
+        std::filesystem::path path;
+        uint64_t size;
+        std::filesystem::file_time_type last_used;
+    };
+}
+
+SectionCache::SectionCache( std::u8string directory, uint64_t const max_cache_size )
+    : directory_path( std::move( directory ) )
+    , max_size( max_cache_size )
+{
+    std::error_code ec;
+    std::filesystem::create_directories( std::filesystem::path( directory_path ), ec );
+    if ( ec )
+    {
+        throw SaveFixerException( u8"failed to create folder \""s + directory_path + u8"\""s );
+    }
+}
+
+std::u8string SectionCache::get_entry_path( Key const &key ) const
+{
+    constexpr std::u8string_view digits = u8"0123456789abcdef";
+    std::array< char8_t, 16 > name;
+    for ( size_t i = 0; i < name.size(); ++i )
+    {
+        name[ i ] = digits[ ( key.hash >> ( ( name.size() - 1 - i ) * 4 ) ) & 0xF ];
+    }
+    std::u8string path = directory_path;
+    path.append( u8"/"s ).append( name.data(), name.size() ).append( entry_extension );
+    return path;
+}
+
+std::optional< SectionCache::Entry > SectionCache::find( Key const &key ) const
+{
+    std::u8string const entry_path = get_entry_path( key );
+    if ( query_file( entry_path ) == path_state::does_not_exist )
+    {
+        return std::nullopt;
+    }
+
+    try
+    {
+        ReadFileMapping mapping( entry_path );
+        std::span< std::byte const > const bytes = mapping.bytes();
+        EntryHeader header;
+        if ( bytes.size() < sizeof( EntryHeader ) )
+        {
+            return std::nullopt;
+        }
+        std::memcpy( &header, bytes.data(), sizeof( EntryHeader ) );
+        if ( header.magic != entry_magic || header.version != entry_version || header.key != key ||
+             bytes.size() - sizeof( EntryHeader ) != key.decompressed_info_size + key.decompressed_data_size )
+        {
+            return std::nullopt;
+        }
+
+        std::error_code ec;
+        std::filesystem::last_write_time( std::filesystem::path( entry_path ),
+                                          std::filesystem::file_time_type::clock::now(), ec );
+
+        std::span< std::byte const > const info = bytes.subspan( sizeof( EntryHeader ), key.decompressed_info_size );
+        std::span< std::byte const > const data = bytes.subspan( sizeof( EntryHeader ) + key.decompressed_info_size );
+        return Entry{ std::move( mapping ), info, data };
+    }
+    catch ( SaveFixerException const & )
+    {
+        return std::nullopt;
+    }
+}
+
+void SectionCache::insert( Key const &key, std::span< std::byte const > const info,
+                           std::span< std::byte const > const data )
+{
+    size_t const entry_size = sizeof( EntryHeader ) + info.size() + data.size();
+    if ( entry_size > max_size )
+    {
+        return;
+    }
+
+    std::lock_guard const lock( insert_mutex );
+    std::u8string const entry_path = get_entry_path( key );
+    try
+    {
+        constexpr bool overwrite_temp_file = true;
+        WriteFileMapping file_out( entry_path + u8".mmsftmp"s, entry_size, overwrite_temp_file );
+        EntryHeader const header{ entry_magic, entry_version, key };
+        std::memcpy( file_out.data(), &header, sizeof( EntryHeader ) );
+        std::copy( info.begin(), info.end(), file_out.data() + sizeof( EntryHeader ) );
+        std::copy( data.begin(), data.end(), file_out.data() + sizeof( EntryHeader ) + info.size() );
+
+        constexpr bool allow_overwrite = true;
+        WriteFileMapping::write_truncate_and_rename( std::move( file_out ), entry_path, entry_size, allow_overwrite );
+    }
+    catch ( SaveFixerException const & )
+    {
+        return;
+    }
+
+    remove_least_recently_used();
+}
+
+void SectionCache::remove_least_recently_used()
+{
+    std::error_code ec;
+    std::filesystem::directory_iterator it( std::filesystem::path( directory_path ), ec );
+    if ( ec )
+    {
+        return;
+    }
+
+    std::vector< ListedEntry > entries;
+    uint64_t total_size = 0;
+    for ( ; it != std::filesystem::directory_iterator(); it.increment( ec ) )
+    {
+        if ( ec )
+        {
+            return;
+        }
+
+        std::filesystem::directory_entry const &entry = *it;
+        if ( entry.path().extension().u8string() != entry_extension || !entry.is_regular_file( ec ) )
+        {
+            continue;
+        }
+
+        uint64_t const size = entry.file_size( ec );
+        std::filesystem::file_time_type const last_used = entry.last_write_time( ec );
+        if ( ec )
+        {
+            // Another process removed the entry
+            continue;
+        }
+        entries.push_back( ListedEntry{ entry.path(), size, last_used } );
+        total_size += size;
+    }
+
+    std::sort( entries.begin(), entries.end(),
+               []( ListedEntry const &a, ListedEntry const &b ) { return a.last_used < b.last_used; } );
+    for ( ListedEntry const &entry : entries )
+    {
+        if ( total_size <= max_size )
+        {
+            break;
+        }
+
+        // An entry that is still mapped may not be removable, in which case it is tried again
+        // after the next insert
+        if ( std::filesystem::remove( entry.path, ec ) )
+        {
+            total_size -= entry.size;
+        }
+    }
+}
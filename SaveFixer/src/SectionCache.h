@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Common.h"
+#include "FileSystem.h"
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+
+namespace save_fixer
+{
+    // A folder of decompressed save sections, so that opening a save again maps its sections
+    // rather than decompressing them. Each entry is a file named after the hash of the compressed
+    // sections, and the least recently used entries are removed once the folder holds more than
+    // max_size bytes of them.
+    //
+    // Can be used from many threads at once.
+    class SectionCache
+    {
+    public:
+        // Identifies the sections of a save by the hash of its compressed sections and the sizes of
+        // both sections
+        struct Key
+        {
+            uint64_t hash;
+            uint64_t compressed_info_size;
+            uint64_t compressed_data_size;
+            uint64_t decompressed_info_size;
+            uint64_t decompressed_data_size;
+
+            bool operator==( Key const & ) const = default;
+        };
+
+        // The mapped entry of a save, with its info section followed by its data section
+        struct Entry
+        {
+            ReadFileMapping mapping;
+            std::span< std::byte const > info;
+            std::span< std::byte const > data;
+        };
+
+        // Creates the folder if it does not exist. Throws SaveFixerException on error.
+        SectionCache( std::u8string directory_path, uint64_t max_size );
+
+        // The entry with the key, or nullopt if there is none or it does not match the key. Finding
+        // an entry makes it the most recently used.
+        std::optional< Entry > find( Key const &key ) const;
+
+        // Adds an entry, then removes the least recently used entries until the rest fit. Failing to
+        // write the entry is not an error, as the sections can always be decompressed again.
+        void insert( Key const &key, std::span< std::byte const > info, std::span< std::byte const > data );
+
+    private:
+        std::u8string get_entry_path( Key const &key ) const;
+
+        void remove_least_recently_used();
+
+        std::u8string const directory_path;
+        uint64_t const max_size;
+        std::mutex insert_mutex;
+    };
+}
@@ -0,0 +1,142 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+using namespace save_fixer;
+
+namespace
+{
+    thread_local ThreadPool const *current_pool = nullptr;
+    thread_local size_t current_worker_index = 0;
+}
+
+ThreadPool::ThreadPool( size_t thread_count )
+{
+    if ( thread_count == 0 )
+    {
+        thread_count = std::max( 1U, std::thread::hardware_concurrency() );
+    }
+
+    for ( size_t i = 0; i < thread_count; ++i )
+    {
+        queues.push_back( std::make_unique< WorkQueue >() );
+    }
+    for ( size_t i = 0; i < thread_count; ++i )
+    {
+        workers.emplace_back( [ this, i ]() { worker_main( i ); } );
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard const lock( sleep_mutex );
+        stopping = true;
+    }
+    wake_workers.notify_all();
+    workers.clear();
+}
+
+void ThreadPool::run( TaskGroup &group, std::function< void() > task )
+{
+    ++group.pending;
+
+    // Tasks spawned by a worker go on its own queue, others are spread over all the queues
+    size_t const queue_index =
+        ( current_pool == this ) ? current_worker_index : ( next_external_queue++ % queues.size() );
+    {
+        std::lock_guard const lock( queues[ queue_index ]->mutex );
+        queues[ queue_index ]->tasks.push_back( Task{ &group, std::move( task ) } );
+    }
+    ++queued_task_count;
+
+    {
+        std::lock_guard const lock( sleep_mutex );
+    }
+    wake_workers.notify_all();
+}
+
+void ThreadPool::wait( TaskGroup &group )
+{
+    size_t const preferred_queue = ( current_pool == this ) ? current_worker_index : 0;
+    while ( group.pending != 0 )
+    {
+        if ( !try_run_one_task( preferred_queue ) )
+        {
+            std::unique_lock lock( sleep_mutex );
+            wake_workers.wait( lock, [ & ]() { return group.pending == 0 || queued_task_count != 0; } );
+        }
+    }
+}
+
+void ThreadPool::worker_main( size_t const worker_index )
+{
+    current_pool = this;
+    current_worker_index = worker_index;
+
+    while ( true )
+    {
+        if ( try_run_one_task( worker_index ) )
+        {
+            continue;
+        }
+
+        std::unique_lock lock( sleep_mutex );
+        wake_workers.wait( lock, [ & ]() { return stopping || queued_task_count != 0; } );
+        if ( stopping && queued_task_count == 0 )
+        {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::try_run_one_task( size_t const preferred_queue )
+{
+    std::optional< Task > task = pop_task( preferred_queue );
+    for ( size_t i = 1; !task.has_value() && i < queues.size(); ++i )
+    {
+        task = steal_task( ( preferred_queue + i ) % queues.size() );
+    }
+    if ( !task.has_value() )
+    {
+        return false;
+    }
+
+    --queued_task_count;
+    task->function();
+
+    if ( --task->group->pending == 0 )
+    {
+        {
+            std::lock_guard const lock( sleep_mutex );
+        }
+        wake_workers.notify_all();
+    }
+    return true;
+}
+
+std::optional< ThreadPool::Task > ThreadPool::pop_task( size_t const queue_index )
+{
+    WorkQueue &queue = *queues[ queue_index ];
+    std::lock_guard const lock( queue.mutex );
+    if ( queue.tasks.empty() )
+    {
+        return std::nullopt;
+    }
+    Task task = std::move( queue.tasks.back() );
+    queue.tasks.pop_back();
+    return task;
+}
+
+std::optional< ThreadPool::Task > ThreadPool::steal_task( size_t const queue_index )
+{
+    WorkQueue &queue = *queues[ queue_index ];
+    std::lock_guard const lock( queue.mutex );
+    if ( queue.tasks.empty() )
+    {
+        return std::nullopt;
+    }
+    Task task = std::move( queue.tasks.front() );
+    queue.tasks.pop_front();
+    return task;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace save_fixer
+{
+    // Counts the tasks of one job that have not finished yet
+    class TaskGroup
+    {
+    public:
+        TaskGroup() = default;
+        TaskGroup( TaskGroup const & ) = delete;
+        TaskGroup &operator=( TaskGroup const & ) = delete;
+
+    private:
+        friend class ThreadPool;
+        std::atomic< size_t > pending = 0;
+    };
+
+    // Work stealing thread pool. Each worker has its own queue, and takes the newest task from
+    // it so that tasks spawned by a task run while their data is still in the cache. Idle
+    // workers steal the oldest task from another worker's queue.
+    //
+    // Tasks must not throw, any errors have to be caught and reported by the task itself.
+    class ThreadPool
+    {
+    public:
+        // A thread_count of 0 uses one thread per core
+        explicit ThreadPool( size_t thread_count = 0 );
+        ~ThreadPool();
+
+        ThreadPool( ThreadPool const & ) = delete;
+        ThreadPool &operator=( ThreadPool const & ) = delete;
+
+        size_t thread_count() const { return workers.size(); }
+
+        void run( TaskGroup &group, std::function< void() > task );
+
+        // Blocks until every task in the group has finished. The calling thread runs queued tasks
+        // while it waits, so it is safe to wait from inside a task.
+        void wait( TaskGroup &group );
+
+        // Calls f( i ) for every i in [0, count) and waits for them all to finish
+        template < typename F >
+        void parallel_for( size_t const count, F f )
+        {
+            TaskGroup group;
+            for ( size_t i = 0; i < count; ++i )
+            {
+                run( group, [ &f, i ]() { f( i ); } );
+            }
+            wait( group );
+        }
+
+    private:
+        struct Task
+        {
+            TaskGroup *group;
+            std::function< void() > function;
+        };
+
+        struct WorkQueue
+        {
+            std::mutex mutex;
+            std::deque< Task > tasks;
+        };
+
+        void worker_main( size_t worker_index );
+        bool try_run_one_task( size_t preferred_queue );
+        std::optional< Task > pop_task( size_t queue_index );
+        std::optional< Task > steal_task( size_t queue_index );
+
+        std::vector< std::unique_ptr< WorkQueue > > queues;
+        std::vector< std::jthread > workers;
+
+        std::mutex sleep_mutex;
+        std::condition_variable wake_workers;
+        std::atomic< size_t > queued_task_count = 0;
+        std::atomic< size_t > next_external_queue = 0;
+        bool stopping = false;
+    };
+}
@@ -6,6 +6,8 @@
 
 #include "WindowsCommon.h"
 
+#include <array>
+
 using namespace save_fixer;
 
 namespace
@@ -203,7 +205,7 @@ public:
     std::span< std::byte const > view;
 };
 
-ReadFileMapping::ReadFileMapping( std::u8string const &file_path )
+ReadFileMapping::ReadFileMapping( std::u8string const &file_path, read_access )
 {
     // The file handle does not need to remain open after the mapping has been created.
     UniqueFileHandle const file_handle = create_file( file_path, GENERIC_READ, OPEN_EXISTING );
@@ -312,3 +314,96 @@ void WriteFileMapping::write_truncate_and_rename( WriteFileMapping &&mapping, st
         throw_windows_error( u8"failed to write file", new_file_path );
     }
 }
+
+//-----------------------------------------------------------------------------
+// TempFileMapping
+//-----------------------------------------------------------------------------
+
+class TempFileMapping::impl
+{
+public:
+    impl( UniqueFileHandle f, UniqueMappingHandle m, UniqueViewHandle vh, std::span< std::byte > v )
+        : file( std::move( f ) ), mapping( std::move( m ) ), view_handle( std::move( vh ) ), view( v )
+    {
+    }
+
+    UniqueFileHandle file;
+    UniqueMappingHandle mapping;
+    UniqueViewHandle view_handle;
+    std::span< std::byte > view;
+};
+
+TempFileMapping::TempFileMapping( std::u8string const &near_file_path, size_t const size )
+{
+    size_t const last_sep = near_file_path.find_last_of( u8"\\/" );
+    std::u8string const directory =
+        ( last_sep == std::u8string::npos ) ? u8"."s : near_file_path.substr( 0, last_sep + 1 );
+    std::wstring const wdirectory = utf8_to_wide( directory );
+    std::array< wchar_t, MAX_PATH > wtemp_path;
+    if ( ::GetTempFileNameW( wdirectory.c_str(), L"mms", 0, wtemp_path.data() ) == 0 )
+    {
+        throw_windows_error( u8"failed to create file in", directory );
+    }
+
+    // A temporary file's pages are only written to it when memory is short, and the file is
+    // deleted when the last handle to it is closed
+    UniqueFileHandle file_handle( ::CreateFileW( wtemp_path.data(), GENERIC_READ | GENERIC_WRITE | DELETE, 0, nullptr,
+                                                 CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                                                 nullptr ) );
+    if ( !file_handle.is_valid() )
+    {
+        DWORD const err = ::GetLastError();
+        ::DeleteFileW( wtemp_path.data() );
+        throw_windows_error( u8"failed to create file in", directory, err );
+    }
+    UniqueMappingHandle file_mapping = create_write_file_mapping( file_handle, directory, size );
+    auto [ view_handle, view_span ] = map_write_view_of_file( file_mapping, directory, size );
+
+    pimpl = std::make_unique< impl >( std::move( file_handle ), std::move( file_mapping ), std::move( view_handle ),
+                                      view_span );
+}
+
+TempFileMapping::~TempFileMapping() = default;
+TempFileMapping::TempFileMapping( TempFileMapping && ) noexcept = default;
+TempFileMapping &TempFileMapping::operator=( TempFileMapping && ) noexcept = default;
+
+std::span< std::byte > TempFileMapping::bytes() const
+{
+    return pimpl->view;
+}
+
+//-----------------------------------------------------------------------------
+// LargeBuffer
+//-----------------------------------------------------------------------------
+
+LargeBuffer::LargeBuffer( size_t const size ) : buffer_size( size )
+{
+    // Large pages are always resident, but can only be allocated by a process that has been
+    // given SeLockMemoryPrivilege, which most are not
+    size_t const large_page_size = ::GetLargePageMinimum();
+    if ( large_page_size != 0 && size >= large_page_size )
+    {
+        size_t const rounded_size = ( size + large_page_size - 1 ) & ~( large_page_size - 1 );
+        void *const view =
+            ::VirtualAlloc( nullptr, rounded_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+        if ( view != nullptr )
+        {
+            buffer = static_cast< std::byte * >( view );
+            mapped_size = rounded_size;
+            return;
+        }
+    }
+    buffer = new std::byte[ size ];
+}
+
+void LargeBuffer::release()
+{
+    if ( mapped_size != 0 )
+    {
+        ::VirtualFree( buffer, 0, MEM_RELEASE );
+    }
+    else
+    {
+        delete[] buffer;
+    }
+}
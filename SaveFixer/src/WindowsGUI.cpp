@@ -48,26 +48,6 @@ namespace
         return std::u8string();
     }
 
-    std::u8string extract_save_name_from_save_path( std::u8string_view const path )
-    {
-        std::u8string_view save_name = path;
-        constexpr std::u8string_view extension = u8".sav";
-        if ( save_name.ends_with( extension ) )
-        {
-            save_name = save_name.substr( 0, save_name.size() - extension.size() );
-        }
-        if ( size_t const last_sep = path.find_last_of( u8"\\/" ); last_sep != std::u8string_view::npos )
-        {
-            save_name = save_name.substr( last_sep + 1 );
-        }
-        if ( save_name.empty() )
-        {
-            assert( false );
-            return u8"Practice Driver Fixed Save"s;
-        }
-        return std::u8string( save_name );
-    }
-
     struct HWNDHandleTraits
     {
         using HandleType = HWND;
@@ -379,7 +359,7 @@ namespace
                     // Cancelled
                     return;
                 }
-                save_file.emplace( std::move( save_path.value() ) );
+                save_file.emplace( std::move( save_path.value() ), SaveFile::Residency::compressed );
             }
             catch ( SaveFixerException const &ex )
             {
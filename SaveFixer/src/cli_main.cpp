@@ -0,0 +1,31 @@
+#include "CommandLine.h"
+
+#include <vector>
+
+#ifdef _WIN32
+
+#include "WindowsCommon.h"
+
+int wmain( int argc, wchar_t **argv )
+{
+    std::vector< std::u8string > args;
+    for ( int i = 1; i < argc; ++i )
+    {
+        args.push_back( save_fixer::wide_to_utf8( argv[ i ] ) );
+    }
+    return save_fixer::run_command_line( args );
+}
+
+#else
+
+int main( int argc, char **argv )
+{
+    std::vector< std::u8string > args;
+    for ( int i = 1; i < argc; ++i )
+    {
+        args.emplace_back( save_fixer::char_as_u8( argv[ i ] ) );
+    }
+    return save_fixer::run_command_line( args );
+}
+
+#endif
@@ -0,0 +1,206 @@
+// Measures the page faults taken filling a LargeBuffer against filling memory from
+// make_unique_for_overwrite, which is what the decompressed sections of a save were held in before.
+//
+//   large_buffer_bench <save file> [runs]    decompresses both sections of the save
+//   large_buffer_bench <size in MB> [runs]   fills a buffer of that size with memset
+//
+// Each allocation is timed from before it is made until it has been filled, so faulting the pages
+// in up front is counted. The huge pages column is AnonHugePages from /proc/self/smaps_rollup while
+// the buffer is alive, which shows whether transparent huge pages were used, and is n/a where it
+// cannot be read. Running with /sys/kernel/mm/transparent_hugepage/enabled set to never checks the
+// fallback.
+
+#include "FileSystem.h"
+
+#include "lz4.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+using namespace save_fixer;
+
+namespace
+{
+    struct SaveFileHeader
+    {
+        int magic;
+        int version;
+        int compressed_info_size;
+        int decompressed_info_size;
+        int compressed_data_size;
+        int decompressed_data_size;
+    };
+
+    struct Result
+    {
+        double milliseconds = 0.0;
+        long minor_faults = 0;
+        std::optional< long > huge_pages_kb;
+    };
+
+    long get_minor_faults()
+    {
+        rusage usage;
+        ::getrusage( RUSAGE_SELF, &usage );
+        return usage.ru_minflt;
+    }
+
+    std::optional< long > get_anon_huge_pages_kb()
+    {
+        std::ifstream smaps( "/proc/self/smaps_rollup" );
+        std::string line;
+        while ( std::getline( smaps, line ) )
+        {
+            constexpr std::string_view key = "AnonHugePages:";
+            if ( line.starts_with( key ) )
+            {
+                return std::stol( line.substr( key.size() ) );
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Either decompresses the save into the buffer or fills it
+    class Filler
+    {
+    public:
+        explicit Filler( std::string const &argument )
+        {
+            size_t megabytes = 0;
+            auto const [ end, ec ] = std::from_chars( argument.data(), argument.data() + argument.size(), megabytes );
+            if ( ec == std::errc() && end == argument.data() + argument.size() )
+            {
+                fill_size = megabytes * 1024 * 1024;
+                return;
+            }
+
+            save_file.emplace( char_as_u8( argument.c_str() ) );
+            std::span< std::byte const > const bytes = save_file->bytes();
+            if ( bytes.size() < sizeof( SaveFileHeader ) )
+            {
+                throw SaveFixerException( u8"not a save file"s );
+            }
+            std::memcpy( &header, bytes.data(), sizeof( SaveFileHeader ) );
+            if ( header.compressed_info_size < 0 || header.compressed_data_size < 0 ||
+                 header.decompressed_info_size < 0 || header.decompressed_data_size < 0 ||
+                 bytes.size() - sizeof( SaveFileHeader ) < static_cast< size_t >( header.compressed_info_size ) +
+                                                               static_cast< size_t >( header.compressed_data_size ) )
+            {
+                throw SaveFixerException( u8"not a save file"s );
+            }
+            fill_size = static_cast< size_t >( header.decompressed_info_size ) +
+                        static_cast< size_t >( header.decompressed_data_size );
+        }
+
+        size_t size() const { return fill_size; }
+
+        void fill( std::byte *const buffer ) const
+        {
+            if ( !save_file.has_value() )
+            {
+                std::memset( buffer, 1, fill_size );
+                return;
+            }
+
+            char const *const compressed =
+                reinterpret_cast< char const * >( save_file->bytes().data() ) + sizeof( SaveFileHeader );
+            char *const output = reinterpret_cast< char * >( buffer );
+            if ( LZ4_decompress_safe( compressed, output, header.compressed_info_size, header.decompressed_info_size ) !=
+                     header.decompressed_info_size ||
+                 LZ4_decompress_safe( compressed + header.compressed_info_size, output + header.decompressed_info_size,
+                                      header.compressed_data_size,
+                                      header.decompressed_data_size ) != header.decompressed_data_size )
+            {
+                throw SaveFixerException( u8"failed to decompress the save"s );
+            }
+        }
+
+    private:
+        std::optional< ReadFileMapping > save_file;
+        SaveFileHeader header = {};
+        size_t fill_size = 0;
+    };
+
+    template < typename Allocate >
+    Result measure( Filler const &filler, Allocate const &allocate )
+    {
+        long const faults_before = get_minor_faults();
+        auto const start = std::chrono::steady_clock::now();
+
+        auto buffer = allocate( filler.size() );
+        filler.fill( buffer.get() );
+
+        Result result;
+        result.milliseconds = std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - start ).count();
+        result.minor_faults = get_minor_faults() - faults_before;
+        result.huge_pages_kb = get_anon_huge_pages_kb();
+        return result;
+    }
+
+    void print_result( char const *const name, Result const &result )
+    {
+        std::string huge_pages = "n/a";
+        if ( result.huge_pages_kb.has_value() )
+        {
+            huge_pages = std::to_string( result.huge_pages_kb.value() ) + " kB";
+        }
+        std::printf( "%-26s %10.2f ms %12ld faults   huge pages %s\n", name, result.milliseconds, result.minor_faults,
+                     huge_pages.c_str() );
+    }
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc < 2 || argc > 3 )
+    {
+        std::fprintf( stderr, "usage: large_buffer_bench <save file | size in MB> [runs]\n" );
+        return 2;
+    }
+
+    try
+    {
+        Filler const filler( argv[ 1 ] );
+        int const runs = argc == 3 ? std::max( 1, std::atoi( argv[ 2 ] ) ) : 5;
+        std::printf( "%zu bytes, best of %d runs\n", filler.size(), runs );
+
+        // The runs alternate so that neither allocator always gets the memory the other just freed
+        Result best_new;
+        Result best_large;
+        for ( int i = 0; i < runs; ++i )
+        {
+            Result const with_new = measure( filler, []( size_t const size ) {
+                return std::make_unique_for_overwrite< std::byte[] >( size );
+            } );
+            Result const with_large = measure( filler, []( size_t const size ) { return LargeBuffer( size ); } );
+            if ( i == 0 || with_new.milliseconds < best_new.milliseconds )
+            {
+                best_new = with_new;
+            }
+            if ( i == 0 || with_large.milliseconds < best_large.milliseconds )
+            {
+                best_large = with_large;
+            }
+        }
+
+        print_result( "make_unique_for_overwrite", best_new );
+        print_result( "LargeBuffer", best_large );
+        return 0;
+    }
+    catch ( SaveFixerException const &ex )
+    {
+        std::fprintf( stderr, "large_buffer_bench: %s\n", u8_as_char( ex.description.c_str() ) );
+        return 1;
+    }
+}
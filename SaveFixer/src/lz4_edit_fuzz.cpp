@@ -0,0 +1,158 @@
+// Checks lz4_recompress_edited_block against LZ4 itself on random blocks and edits. Each round
+// makes a block of text like a save's, compresses it with LZ4, edits a few random ranges of it,
+// most of them near the end of the block where LZ4's rules for the last sequences apply, and
+// decompresses the result with LZ4 to compare it with the edited text.
+//
+//   lz4_edit_fuzz [rounds] [seed]
+//
+// Stops at the first block that does not decompress to the edited text, prints how to repeat it
+// and exits with 1.
+
+#include "Lz4Block.h"
+
+#include "lz4.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+using namespace save_fixer;
+
+namespace
+{
+    // Repetitive JSON, so the block has plenty of matches for the edits to land in
+    std::string make_text( std::mt19937_64 &random, size_t const size )
+    {
+        static char const *const names[] = { "car1", "car2", "reserve", "name", "id", "team", "driver", "$ref" };
+        std::string text = "{";
+        while ( text.size() < size )
+        {
+            text += "\"";
+            text += names[ random() % std::size( names ) ];
+            text += "\":";
+            if ( random() % 2 == 0 )
+            {
+                text += std::to_string( random() % 1000 );
+            }
+            else
+            {
+                text += "\"A Rather Long Save Name\"";
+            }
+            text += random() % 8 == 0 ? "}," : ",";
+        }
+        text.resize( size - 2 );
+        text += "}}";
+        return text;
+    }
+
+    // Up to three edits that do not touch each other, with the last one near the end of the text
+    std::vector< Lz4Edit > make_edits( std::mt19937_64 &random, size_t const size, std::vector< std::string > &new_bytes )
+    {
+        size_t const count = 1 + random() % 3;
+        std::vector< size_t > starts;
+        for ( size_t i = 0; i + 1 < count; ++i )
+        {
+            starts.push_back( random() % size );
+        }
+        starts.push_back( size - 1 - std::min( size - 1, static_cast< size_t >( random() % 24 ) ) );
+        std::sort( starts.begin(), starts.end() );
+
+        std::vector< Lz4Edit > edits;
+        new_bytes.clear();
+        new_bytes.reserve( count );
+        size_t end = 0;
+        for ( size_t const start : starts )
+        {
+            if ( start < end )
+            {
+                continue;
+            }
+            size_t const original_size = std::min( size - start, 1 + static_cast< size_t >( random() % 4 ) );
+            std::string &bytes = new_bytes.emplace_back( random() % 5, 'x' );
+            for ( char &c : bytes )
+            {
+                c = static_cast< char >( 'a' + random() % 26 );
+            }
+            edits.push_back( Lz4Edit{ start, original_size, std::as_bytes( std::span( bytes ) ) } );
+            end = start + original_size;
+        }
+        return edits;
+    }
+
+    std::string apply_edits( std::string const &text, std::vector< Lz4Edit > const &edits )
+    {
+        std::string edited;
+        size_t pos = 0;
+        for ( Lz4Edit const &edit : edits )
+        {
+            edited.append( text, pos, edit.offset - pos );
+            edited.append( reinterpret_cast< char const * >( edit.new_bytes.data() ), edit.new_bytes.size() );
+            pos = edit.offset + edit.original_size;
+        }
+        edited.append( text, pos );
+        return edited;
+    }
+
+    // Returns false if the edited block does not decompress to the edited text
+    bool check_round( std::mt19937_64 &random, size_t &reused )
+    {
+        size_t const size = 16 + random() % ( random() % 4 == 0 ? 200000 : 4000 );
+        std::string const text = make_text( random, size );
+
+        std::vector< char > block( static_cast< size_t >( LZ4_compressBound( static_cast< int >( size ) ) ) );
+        int const acceleration = random() % 2 == 0 ? 1 : 1 + static_cast< int >( random() % 8 );
+        int const block_size = LZ4_compress_fast( text.data(), block.data(), static_cast< int >( size ),
+                                                  static_cast< int >( block.size() ), acceleration );
+
+        std::vector< std::string > new_bytes;
+        std::vector< Lz4Edit > edits = make_edits( random, size, new_bytes );
+        std::string const edited = apply_edits( text, edits );
+        Lz4EditedData const new_data( std::as_bytes( std::span( text ) ), std::move( edits ) );
+
+        std::vector< std::byte > output( static_cast< size_t >( LZ4_compressBound( static_cast< int >( edited.size() ) ) ) );
+        std::optional< size_t > const output_size = lz4_recompress_edited_block(
+            std::as_bytes( std::span( block ).first( static_cast< size_t >( block_size ) ) ), new_data, output );
+        if ( !output_size.has_value() )
+        {
+            // The caller compresses the edited text in full, which is always right
+            return true;
+        }
+        ++reused;
+
+        std::string decompressed( edited.size(), '\0' );
+        int const decompressed_size =
+            LZ4_decompress_safe( reinterpret_cast< char const * >( output.data() ), decompressed.data(),
+                                 static_cast< int >( output_size.value() ), static_cast< int >( decompressed.size() ) );
+        return decompressed_size == static_cast< int >( edited.size() ) && decompressed == edited;
+    }
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc > 3 )
+    {
+        std::fprintf( stderr, "usage: lz4_edit_fuzz [rounds] [seed]\n" );
+        return 2;
+    }
+    unsigned long const rounds = argc >= 2 ? std::strtoul( argv[ 1 ], nullptr, 10 ) : 10000;
+    unsigned long const seed = argc >= 3 ? std::strtoul( argv[ 2 ], nullptr, 10 ) : std::random_device()();
+
+    size_t reused = 0;
+    for ( unsigned long round = 0; round < rounds; ++round )
+    {
+        // Each round has its own generator, so a failing round can be run again on its own
+        std::mt19937_64 random( seed + round );
+        if ( !check_round( random, reused ) )
+        {
+            std::printf( "round %lu does not decompress to the edited text, lz4_edit_fuzz 1 %lu repeats it\n", round,
+                         seed + round );
+            return 1;
+        }
+    }
+    std::printf( "seed %lu: %lu rounds passed, %zu of them reused the original sequences\n", seed, rounds, reused );
+    return 0;
+}